@@ -1,13 +1,61 @@
+#define _GNU_SOURCE
+#define _FILE_OFFSET_BITS 64
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
 #include <errno.h>
+#include <limits.h>
 #include <math.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <getopt.h>
 #include <sys/ipc.h>
 #include <sys/msg.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/syscall.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#ifdef HAVE_IO_URING
+#include <linux/io_uring.h>
+#endif
+
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
 
 #include "SDL.h"
 
+#ifdef USE_SDL2
+/* SDL2 has no YUV overlays, a streaming texture stands in for one. The
+ * UI thread keeps it locked while the render thread may draw into the
+ * pixels and unlocks (uploads) it to present, see present_overlay */
+typedef struct {
+    Uint32 format;
+    int w, h;
+    int planes;
+    Uint16* pitches;
+    Uint8** pixels;
+    Uint16 pitch[3];
+    Uint8* plane[3];
+    SDL_Texture* texture;
+} SDL_Overlay;
+typedef SDL_Keycode SDLKey;
+#define SDL_YV12_OVERLAY SDL_PIXELFORMAT_YV12
+#define SDL_IYUV_OVERLAY SDL_PIXELFORMAT_IYUV
+#define SDL_YUY2_OVERLAY SDL_PIXELFORMAT_YUY2
+#define SDL_UYVY_OVERLAY SDL_PIXELFORMAT_UYVY
+#define SDL_YVYU_OVERLAY SDL_PIXELFORMAT_YVYU
+#endif
+
 /* Supported YUV-formats */
 #define YV12 0
 #define IYUV 1
@@ -33,14 +81,287 @@
 #define CB_ONLY 'h'
 #define CR_ONLY 'i'
 #define ALL_PLANES 'j'
+#define GOTO 'k'            /* seek to absolute frame, trick play */
+
+/* Trick play */
+#define MAX_SPEED 16
+#define PRELOAD_DEFAULT_MB 2048
+#define FRAME_MS 40             /* playback interval without a frame rate */
+
+/* YUV4MPEG2 input */
+#define Y4M_MAGIC "YUV4MPEG2 "
+#define Y4M_MAX_HEADER 1024
+
+/* Size and format probe of raw clips without them */
+#define PROBE_ROWS 32           /* row pairs scored per plane */
+#define PROBE_HINTS 8           /* sizes taken from the file name */
+#define PLAYLIST_PREFETCH_MB 64 /* of the next clip read while one plays */
+#define INDEX_MAGIC "YVIDX01\n"
+
+/* Worker pool */
+#define MAX_THREADS 64
+
+/* Software scaler, SCALE_SDL leaves scaling to SDL_DisplayYUVOverlay */
+#define SCALE_SDL 0
+#define SCALE_NEAREST 1
+#define SCALE_BILINEAR 2
+#define SCALE_AREA 3
+#define SCALE_MODES 4
+
+/* 10 bpp to the 8 bit display planes */
+#define BITS_ROUND 0            /* top 8 bits, rounded */
+#define BITS_MID 1              /* bits 8..1, wrapping */
+#define BITS_LOW 2              /* bits 7..0, wrapping */
+#define BITS_STRETCH 3          /* luma 0.5..99.5 percentile to 0..255 */
+#define BITS_MODES 4
+
+/* scopes, drawn instead of the frame */
+#define SCOPE_OFF 0
+#define SCOPE_LUMA 1            /* luma waveform */
+#define SCOPE_PARADE 2          /* R, G and B waveforms side by side */
+#define SCOPE_VECTOR 3          /* Cb/Cr vectorscope */
+#define SCOPE_MODES 4
+#define SCOPE_STRIP 16          /* waveform columns binned together */
+#define SCOPE_BIN 0             /* scope_job phases */
+#define SCOPE_MERGE 1
+
+/* YCbCr -> RGB matrices */
+#define BT601 0
+#define BT709 1
+#define BT2020 2
+
+/* Render thread commands, UI thread -> render thread */
+#define CMD_QUEUE_SIZE 64       /* power of two */
+#define CMD_KEY 0
+#define CMD_CLICK 1
+#define CMD_GOTO 2
+#define CMD_QUIT 3
+#define CMD_CONTROL 4           /* request waiting in R.control */
+#define CMD_REGION 5            /* mouse drag, x << 16 | y of both corners */
+
+/* SDL_USEREVENT codes, render and slave thread -> UI thread */
+#define EV_GOTO 0
+#define EV_PRESENT 1
+#define EV_RESIZE 2
+#define EV_CAPTION 3
+
+/* Clip analysis, flags per frame */
+#define STAT_CUT 1
+#define STAT_BLACK 2
+#define STAT_FROZEN 4
+#define BLACK_LEVEL 24.0        /* max mean luma of a black frame */
+#define BLACK_VARIANCE 16.0     /* max luma variance of a black frame */
+#define FROZEN_SAD 0.25         /* max mean abs diff to previous frame */
+#define CUT_SAD 12.0            /* min mean abs diff of a cut */
+#define CUT_RATIO 3.0           /* cut: diff vs average of recent frames */
+#define CUT_WINDOW 8
+
+/* Blocking and ringing */
+#define EDGE_STRONG 64          /* min gradient |dx| + |dy| of an edge */
+#define EDGE_SMOOTH 24          /* smooth pel below, where ringing shows */
+#define BLOCK_EPS 0.1           /* keeps flat frames at a ratio of 1.0 */
+#define CTU_DEFAULT 64
+#define ARTIFACTS_OFF 0
+#define ARTIFACTS_CAPTION 1     /* metrics in the caption */
+#define ARTIFACTS_OVERLAY 2     /* and blockiness per 8x8 block */
+#define ARTIFACTS_MODES 3
+
+/* Asynchronous reader */
+#define AIO_ALIGN 4096          /* O_DIRECT offset/length alignment */
+#define AIO_MAX_DEPTH 32        /* max number of frames kept in flight */
+#define AIO_DEFAULT_DEPTH 8
+#define SLOT_EMPTY 0
+#define SLOT_INFLIGHT 1
+#define SLOT_READY 2
+
+/* .yvz: frames packed one by one, see struct pack_header */
+#define PACK_MAGIC "YVZPACK1"
+#define PACK_LZ4 1
+#define PACK_ZSTD 2
+#define PACK_ZSTD_LEVEL 3
+#define PACK_MAX_DEPTH 32       /* frames unpacked ahead */
+#define PACK_WINDOW_MB 512      /* unless they need more memory than this */
+#define LZ4_HASH_BITS 16
+#define LZ4_MFLIMIT 12
+#define LZ4_LASTLITERALS 5
+#define LZ4_MAX_OFFSET 65535
+
+#define BATCH_READERS 2         /* jobs reading from one device at once */
+
+struct scale_plane {
+    Uint8* src;
+    Uint32 src_w;
+    Uint32 src_h;
+    Uint32 src_pitch;
+    Uint8* dst;
+    Uint32 dst_w;
+    Uint32 dst_h;
+    Uint32 dst_pitch;
+    Uint32 mode;              /* SCALE_NEAREST, SCALE_BILINEAR or SCALE_AREA */
+    Uint32* xs;               /* source column of each output pel, area: edges */
+    Uint16* fx;               /* bilinear: 8 bit weight of the next column */
+    Uint32 tap_mode;          /* mode and widths xs and fx were built for */
+    Uint32 tap_src_w;
+    Uint32 tap_dst_w;
+};
+
+struct command {
+    Uint32 type;              /* CMD_KEY, CMD_CLICK, CMD_GOTO or CMD_QUIT */
+    Sint32 a;                 /* key, mouse x or frame */
+    Sint32 b;                 /* mouse y */
+    double t;                 /* now() when queued */
+};
+
+/* one input of a session, see struct session_state */
+struct session_input {
+    double at;                /* seconds after the event loop started */
+    double latency;           /* seconds until the next input may run */
+    Uint32 type;              /* CMD_KEY, CMD_CLICK or CMD_REGION */
+    Sint32 a;
+    Sint32 b;
+};
+
+struct frame_stats {
+    double mean;              /* luma */
+    double variance;
+    double sad;               /* mean abs luma diff to previous frame */
+    Uint32 flags;             /* STAT_CUT, STAT_BLACK, STAT_FROZEN */
+};
+
+/* gradient sums of one 8x8 block, see block_rows() */
+struct block_sums {
+    Uint32 border;            /* |dx| of the left column, |dy| of the top row */
+    Uint32 inner;             /* all other |dx| and |dy| */
+    Uint32 edge;              /* pels with a gradient >= EDGE_STRONG */
+    Uint32 smooth;            /* sum of gradients < EDGE_SMOOTH */
+    Uint32 smooth_n;          /* and their number */
+};
+
+/* blockiness on the 8x8, 16x16 and CTU grid, ringing */
+struct artifacts {
+    double block[3];
+    double ringing;
+};
+
+/* one control socket request, answered by the render thread */
+struct control {
+    char* line;
+    char reply[16384];        /* status line */
+    Uint8* data;              /* payload after the status line, or NULL */
+    Uint32 size;
+    SDL_sem* done;
+};
+
+/* Frame offsets of a YUV4MPEG2 file. Every frame has its own FRAME
+ * header, so where frame n starts cannot be computed from n. The index
+ * is built with one pass over the headers and cached in <file>.idx */
+struct frame_index {
+    Uint64 header;            /* stream header bytes, 0 for raw files */
+    Uint64* offset;           /* start of the samples of each frame */
+    Uint32 count;
+    Uint64 size;              /* file size, offset of frames past the end */
+};
+
+/* saved in front of the offsets in <file>.idx */
+struct index_file {
+    char magic[8];
+    Uint64 size;              /* of the clip when indexed */
+    Sint64 mtime_sec;
+    Sint64 mtime_nsec;
+    Uint32 frame_bytes;
+    Uint32 count;
+};
+
+/* one manifest entry: a reference and a test clip of the same geometry */
+struct batch_job {
+    char* ref;
+    char* test;
+    Uint32 line;              /* in the manifest */
+    Uint32 width;
+    Uint32 height;
+    Uint32 format;
+    Uint32 dev[2];            /* batch_state.dev[] of ref and test */
+    Uint32 devs;              /* 0 if a file is missing, 2 if on two devices */
+    Uint32 started;
+    char error[128];          /* set before or while running */
+};
+
+struct batch_state {
+    struct batch_job* jobs;
+    Uint32 count;
+    Uint32 first;             /* jobs before this are all started */
+    dev_t* dev;               /* distinct devices of all clips */
+    Uint32* readers;          /* jobs reading from dev[i] */
+    Uint32 devs;
+    Uint32 failed;
+    FILE* out;
+    double start;
+    SDL_mutex* lock;
+    SDL_cond* cond;
+};
+
+/* a size and format the probe tries on a raw clip */
+struct probe_candidate {
+    Uint32 width;
+    Uint32 height;
+    Uint32 format;
+    Uint32 rank;              /* named in the file name */
+    double score;             /* row-to-row difference, -1 impossible */
+};
+
+struct probe_size {
+    const char* name;         /* as in foreman_cif.yuv, or NULL */
+    Uint32 width;
+    Uint32 height;
+};
+
+/* one --playlist line, width 0 if the clip brings or needs a guess */
+struct playlist_entry {
+    char* name;
+    Uint32 width;
+    Uint32 height;
+    Uint32 format;
+};
 
 /* PROTOTYPES */
 Uint32 rd(Uint8* data, Uint32 size);
+double now(void);
+Uint32 seek_frame(Uint64 frame);
+Uint32 fetch_frame(void);
+Uint32 preload(Uint32 first, Uint32 last);
+void preload_free(void);
+void set_marker(Uint32 b);
+void toggle_loop(void);
+Sint64 loop_target(Sint64 target);
+Uint32 aio_open(void);
+void aio_close(void);
+void aio_account(void);
+Uint32 aio_submit(Uint32 slot, Uint64 frame);
+Uint32 aio_reap(Uint32 wait);
+Uint32 aio_slot(Uint64 frame);
+Uint32 aio_fill(void);
+Uint32 aio_read(Uint8* data, Uint32 size);
+Uint32 pack_header(char* name);
+void pack_chunks(Uint32 chunks, Uint32* size);
+Uint32 pack_open(void);
+void pack_close(void);
+Uint32 pack_decode(Uint64 frame, Uint8* dst, Uint8* scratch);
+int pack_thread(void* data);
+void pack_seek(Uint64 frame);
+Uint32 pack_read(Uint8* data, Uint32 size);
+Uint32 aio_seek(Uint64 frame);
+#ifdef HAVE_IO_URING
+int io_uring_setup(unsigned entries, struct io_uring_params* p);
+int io_uring_enter(int ring_fd, unsigned to_submit, unsigned min_complete,
+                   unsigned flags);
+int io_uring_register(int ring_fd, unsigned opcode, void* arg, unsigned nr_args);
+Uint32 uring_init(void);
+void uring_exit(void);
+#endif
 Uint32 read_yv12(void);
 Uint32 read_iyuv(void);
 Uint32 read_422(void);
-Uint32 read_y42210(void);
-Uint32 read_yv1210(void);
+Uint32 read_10bit(void);
 Uint32 allocate_memory(void);
 void draw_grid422(void);
 void draw_grid420(void);
@@ -50,40 +371,507 @@ void cr_only(void);
 void draw_420(void);
 void draw_422(void);
 Uint32 diff_mode(void);
+Uint32 temporal_mode(void);
+void diff_luma(Uint8* ref, Uint8* cmp, Uint8* dst, Uint32 n);
+void diff_luma16(Uint16* ref, Uint16* cmp, Uint8* dst, Uint32 n);
+void show_diff(void);
 void calc_psnr(Uint8* frame0, Uint8* frame1);
+double luma_psnr(Uint8* frame0, Uint8* frame1);
+void plane_histogram(Uint8* data, Uint32 size, Uint32* counts);
+void plane_histogram16(Uint16* data, Uint32 size, Uint32* counts);
+Uint64 plane_sse16(Uint16* a, Uint16* b, Uint32 n);
+void bits_lut(Uint8* lut, Uint32 mode);
+void stretch_lut(Uint8* lut);
+void to_display(Uint16* src, Uint8* dst, Uint32 n, Uint8* lut);
+void display_planes(void);
+Uint32 scope_alloc(void);
+void scope_rows(Uint32 max, Uint32 height);
+void scope_shade(Uint32* counts, Uint8* dst, Uint32 n, Uint32 gain);
+void scope_job(void* arg, Uint32 index, Uint32 count);
+void scope_graticule(void);
+Uint32 make_scope(void);
+void draw_scope(void);
 void usage(char* name);
-void mb_loop(char* str, Uint32 rows, Uint8* data, Uint32 pitch);
+void mb_loop(char* str, Uint32 rows, Uint32 cols, Uint8* data, Uint32 pitch);
 void show_mb(Uint32 mouse_x, Uint32 mouse_y);
+void block_sad_sse(Uint8* a, Uint8* b, Uint32 pitch, Uint32 w, Uint32 h,
+                   Uint32* sad, Uint32* sse);
+void block_sad_sse16(Uint16* a, Uint16* b, Uint32 pitch, Uint32 w, Uint32 h,
+                     Uint32* sad, Uint32* sse);
+void mb_errors(Uint8* frame0, Uint8* frame1);
+void draw_heatmap(void);
 void draw_frame(void);
 Uint32 read_frame(void);
+Uint32 goto_frame(Uint32 frame);
 void setup_param(void);
 void check_input(void);
 Uint32 open_input(void);
 Uint32 create_message_queue(void);
 void destroy_message_queue(void);
 Uint32 connect_message_queue(void);
-Uint32 send_message(char cmd);
+Uint32 send_message(char cmd, Uint32 frame);
 Uint32 read_message(void);
 Uint32 event_dispatcher(void);
+Uint32 push_command(Uint32 type, Sint32 a, Sint32 b);
+Uint32 pop_command(struct command* cmd, Uint32 wait);
+Uint32 control_open(void);
+void control_close(void);
+Uint32 send_all(int fd, const void* data, Uint64 size);
+Uint32 control_request(int client, char* line, SDL_sem* done);
+int control_thread(void* data);
+void run_control(void);
+void post_event(Sint32 code, void* data1, void* data2);
+void post_caption(void);
+void resize(void);
+void play(SDLKey sym);
+Uint32 handle_key(SDLKey sym);
+int render_thread(void* data);
+Uint32 session_open(void);
+void session_close(void);
+void record_input(Uint32 type, Sint32 a, Sint32 b);
+void input_handled(void);
+Uint32 wait_handled(void);
+int replay_thread(void* data);
+Uint32 same_input(const struct session_input* x, const struct session_input* y);
+int compare_inputs(const void* a, const void* b);
+void session_report(double seconds);
+int slave_thread(void* data);
+void stop_slave(void);
 Uint32 event_loop(void);
 Uint32 parse_input(int argc, char **argv);
 Uint32 sdl_init(void);
 void set_caption(char *array, Uint32 frame, Uint32 bytes);
 void set_zoom_rect(void);
+Uint32 pool_start(Uint32 count);
+void pool_stop(void);
+void pool_run(void (*job)(void* arg, Uint32 index, Uint32 count), void* arg);
+int pool_worker(void* data);
+void scale_nearest(struct scale_plane* sp, Uint32 y0, Uint32 y1);
+void scale_bilinear(struct scale_plane* sp, Uint32 y0, Uint32 y1, Uint16* row);
+void scale_area(struct scale_plane* sp, Uint32 y0, Uint32 y1, Uint32* acc);
+Uint32 scale_taps(void);
+void scale_job(void* arg, Uint32 index, Uint32 count);
+void packed_job(void* arg, Uint32 index, Uint32 count);
+Uint32 scale_frame(SDL_Overlay* dst);
+SDL_Overlay* stage_overlay(void);
+Uint32 video_mode(Uint32 w, Uint32 h);
+void video_caption(const char* caption);
+SDL_Thread* start_thread(int (*fn)(void*), const char* name, void* data);
+Uint32 lock_overlay(SDL_Overlay* o);
+SDL_Overlay* new_overlay(Uint32 w, Uint32 h);
+void free_overlay(SDL_Overlay* o);
+void present_overlay(SDL_Overlay* o, Uint32 upload);
+Uint32 create_overlays(Uint32 w, Uint32 h);
 void histogram(void);
 Uint32 ten2eight(Uint8* src, Uint8* dst, Uint32 length);
-
+Uint8* map_input(char* filename, Uint64* size);
+Uint64 frame_offset(Uint32 file, Uint64 frame);
+Uint32 frame_total(Uint32 file, Uint64 size);
+Uint32 y4m_parse(char* name, Uint64* header, Uint32* width, Uint32* height,
+                 Uint32* format, Uint32* frame_ms);
+Uint32 y4m_header(Uint32 file, char* name);
+Uint32 load_index(struct frame_index* ix, char* path, struct stat* st, Uint32 frame_bytes);
+void save_index(struct frame_index* ix, char* path, struct stat* st, Uint32 frame_bytes);
+Uint32 index_frames(struct frame_index* ix, char* name, Uint32 frame_bytes);
+Uint32 build_index(Uint32 file, char* name);
+Uint32 parse_range(char* arg);
+Uint32 parse_mb_list(char* arg, Uint32 rect);
+void plane_layout(Uint32* offset, Uint32* pitch, Uint32* width, Uint32* height,
+                  Uint32* step);
+void format_layout(Uint32 format, Uint32 w, Uint32 h, Uint32* offset,
+                   Uint32* pitch, Uint32* width, Uint32* height, Uint32* step);
+Uint64 format_frame_size(Uint32 format, Uint32 w, Uint32 h);
+Uint32 parse_format(char* arg, Uint32* format);
+double probe_plane(const Uint8* base, Uint32 width, Uint32 height, Uint32 pitch,
+                   Uint32 step, Uint32 bytes, Uint64* samples);
+double probe_score(const Uint8* data, Uint64 size, Uint32 w, Uint32 h, Uint32 format);
+Uint32 probe_hints(char* name, Uint32* hint, Uint32 max, Uint32* format, Uint32* ten_bit);
+Uint32 probe_geometry(char* name, Uint32* width, Uint32* height, Uint32* format, Uint32 report);
+void set_overlay_format(void);
+Uint32 read_playlist(char* name);
+Uint32 clip_geometry(struct playlist_entry* clip);
+Uint32 clip_probe(struct playlist_entry* clip);
+int prefetch_thread(void* data);
+void prefetch_clip(Uint32 index);
+void free_frame_buffers(void);
+void close_clip(void);
+Uint32 start_clip(Uint32 index, Uint32 prefetched, Uint32* buffers);
+Uint32 open_clip(Uint32 index);
+Uint32 clip_end(void);
+Uint32 parse_crop(char* arg);
+Uint32 parse_blank(char* arg);
+Uint32 extract_mb(void);
+void rgb_coefficients(Sint32* coef);
+void yuv2rgb_row(Uint8* y, Uint8* cb, Uint8* cr, Uint8* rgb, Uint32 width,
+                 Sint32* coef);
+void yuv2rgb(Uint8* y, Uint8* cb, Uint8* cr, Uint8* rgb, Sint32* coef);
+void decode_frame(Uint8* frame, Uint8* y, Uint8* cb, Uint8* cr);
+Uint32 write_ppm(char* name, Uint8* rgb, Uint32 width, Uint32 height);
+Uint32 write_png(char* name, Uint8* rgb, Uint32 width, Uint32 height);
+Uint32 write_image(char* name, Uint8* rgb, Uint32 width, Uint32 height);
+void image_name(char* dst, Uint32 bytes, char* pattern, Uint32 frame);
+Uint32 dump_frame(void);
+void export_job(void* arg, Uint32 index, Uint32 count);
+Uint32 export_frames(void);
+void load_frame(Uint8* frame, Uint16* y, Uint16* cb, Uint16* cr);
+void store_frame(Uint16* planes, Uint8* out);
+void convert_job(void* arg, Uint32 index, Uint32 count);
+Uint32 copy_frames(int in, int out, Uint64 offset, Uint64 length, Uint8* data);
+Uint32 write_frames(void);
+void luma_stats(Uint8* cur, Uint8* prev, Uint32 n, Uint64* sum, Uint64* sq,
+                Uint64* sad);
+void analyse_job(void* arg, Uint32 index, Uint32 count);
+Uint32 analyse_clip(Uint32 first, Uint32 last);
+Uint32 write_stats(void);
+void next_event(void);
+void block_rows(Uint8* luma, Uint32 y0, Uint32 y1, Uint8* pad, Uint32* colsum,
+                Uint32* rowsum, struct block_sums* blocks);
+void artifact_result(Uint32* colsum, Uint32* rowsum, struct block_sums* blocks,
+                     struct artifacts* out);
+Uint32 artifact_alloc(void);
+void artifact_job(void* arg, Uint32 index, Uint32 count);
+Uint32 frame_artifacts(void);
+Uint32 sat_alloc(Uint32 planes, Uint32* width, Uint32* height, Uint32 copy);
+void sat_free(void);
+void sat_row(const Uint8* src, Uint32 step, Uint32 bytes, Uint32 width,
+             Uint64* sum, Uint64* sq);
+void sat_rows_job(void* arg, Uint32 index, Uint32 count);
+void sat_cols_job(void* arg, Uint32 index, Uint32 count);
+void sat_build(void);
+void sat_frame(Uint8* y, Uint8* cb, Uint8* cr);
+void sat_region(Uint32 p, Uint32 x0, Uint32 y0, Uint32 x1, Uint32 y1,
+                double* mean, double* variance);
+void region_range(Uint32 p, Uint32 x0, Uint32 y0, Uint32 x1, Uint32 y1,
+                  Uint32* min, Uint32* max);
+void region_stats(Uint32 x0, Uint32 y0, Uint32 x1, Uint32 y1);
+void region_probe(Sint32 a, Sint32 b);
+Uint32 write_variance(void);
+void draw_blockiness(void);
+void artifact_clip_job(void* arg, Uint32 index, Uint32 count);
+Uint32 write_artifacts(void);
+Uint32 lz4_pack(const Uint8* src, Uint32 n, Uint8* dst, Uint32 cap, Uint32* table);
+Uint32 lz4_unpack(const Uint8* src, Uint32 n, Uint8* dst, Uint32 size);
+Uint32 pack_bound(Uint32 codec, Uint32 n);
+Uint32 unpack_chunk(Uint32 codec, const Uint8* src, Uint32 n, Uint8* dst, Uint32 size);
+Uint32 write_all(int out, const Uint8* data, Uint64 size);
+void pack_job(void* arg, Uint32 index, Uint32 count);
+Uint32 write_pack(void);
+Uint64 plane_sse8(const Uint8* a, const Uint8* b, Uint32 n, Uint32 step);
+double sse_psnr(Uint64 sse, Uint64 n, Uint32 depth);
+void json_string(FILE* fp, const char* s);
+void json_psnr(FILE* fp, const char* key, double psnr);
+Uint32 batch_compare(struct batch_job* job, FILE* out, Uint32 worker, double queued);
+void batch_job(void* arg, Uint32 index, Uint32 count);
+Uint32 batch_device(struct batch_state* bs, char* name);
+Uint32 read_manifest(struct batch_state* bs);
+Uint32 run_batch(void);
+Uint32 run_headless(void);
+
+#ifdef USE_SDL2
+SDL_Window* window;
+SDL_Renderer* renderer;
+#else
 SDL_Surface *screen;
+const SDL_VideoInfo* info = NULL;
+#endif
 SDL_Event event;
 SDL_Rect video_rect;
 SDL_Overlay *my_overlay;
-const SDL_VideoInfo* info = NULL;
 Uint32 FORMAT = YV12;
+const char* format_names[] = {"YV12", "IYUV", "YUY2", "UYVY", "YVYU", "YV1210", "Y42210"};
+/* session inputs by CMD_ type */
+const char* input_names[] = {"key", "click", "goto", "quit", "control", "region"};
+/* the probe tries them in this order, the first wins a tie */
+const struct probe_size probe_sizes[] = {
+    {"cif", 352, 288}, {"qcif", 176, 144}, {"4cif", 704, 576}, {"sqcif", 128, 96},
+    {"16cif", 1408, 1152}, {"sif", 352, 240}, {"vga", 640, 480}, {"qvga", 320, 240},
+    {NULL, 160, 120}, {"ntsc", 720, 480}, {"pal", 720, 576}, {"720p", 1280, 720},
+    {"1080p", 1920, 1080}, {"1080i", 1920, 1080}, {NULL, 1920, 1088}, {"2k", 2048, 1080},
+    {NULL, 2560, 1440}, {"2160p", 3840, 2160}, {"4k", 3840, 2160}, {"uhd", 3840, 2160},
+    {NULL, 4096, 2160}, {"8k", 7680, 4320}
+};
 FILE* fd;
 
+/* Frame slots used by the asynchronous reader. Frame n always lives in
+ * slot n / |step| % depth, and the window of depth frames next,
+ * next + step, ... is kept in flight; step is the trick play speed.
+ * With io_uring the slots are registered buffers read with O_DIRECT;
+ * without it the same slots are filled with plain pread(). */
+struct aio_reader {
+    Uint32 active;            /* reader in use for fd */
+    Uint32 uring;             /* 1 - io_uring, 0 - pread fallback */
+    Uint32 fixed;             /* slots registered as fixed buffers */
+    int fd;                   /* input, O_DIRECT when possible */
+    Uint32 depth;             /* number of frame slots */
+    Uint32 slot_size;         /* bytes per slot, multiple of AIO_ALIGN */
+    Uint8* slots;             /* depth * slot_size bytes */
+    Uint64 frame[AIO_MAX_DEPTH];  /* frame held by slot */
+    Uint32 state[AIO_MAX_DEPTH];  /* SLOT_EMPTY, SLOT_INFLIGHT, SLOT_READY */
+    Uint32 skip[AIO_MAX_DEPTH];   /* frame start within slot (alignment) */
+    Uint32 len[AIO_MAX_DEPTH];    /* valid bytes from frame start */
+    Uint32 bad[AIO_MAX_DEPTH];    /* read failed */
+    Uint64 next;              /* frame currently consumed by rd() */
+    Uint32 pos;               /* bytes of that frame already consumed */
+    Sint32 step;              /* distance of the frames read ahead */
+    Uint64 frames;            /* complete frames in the file */
+    Uint32 inflight;          /* reads submitted but not completed */
+    Uint32 max_inflight;
+    Uint64 bytes;             /* bytes completed */
+    double busy;              /* seconds with at least one read in flight */
+    double depth_sum;         /* inflight integrated over busy time */
+    double t_last;
+#ifdef HAVE_IO_URING
+    int ring_fd;
+    Uint8* sq_ptr;
+    Uint8* cq_ptr;
+    size_t sq_len;
+    size_t cq_len;
+    struct io_uring_sqe* sqes;
+    size_t sqes_len;
+    struct io_uring_cqe* cqes;
+    Uint32* sq_head;
+    Uint32* sq_tail;
+    Uint32* sq_mask;
+    Uint32* sq_array;
+    Uint32* cq_head;
+    Uint32* cq_tail;
+    Uint32* cq_mask;
+#endif
+};
+
+struct aio_reader AIO;
+
+/* .yvz file: header, then the packed chunks of every frame (the whole
+ * frame or one per plane), then frames * chunks + 1 chunk offsets */
+struct pack_header {
+    char magic[8];            /* PACK_MAGIC */
+    char format[8];           /* format_names[] */
+    Uint32 width;
+    Uint32 height;
+    Uint32 frame_ms;
+    Uint32 codec;             /* PACK_LZ4, PACK_ZSTD */
+    Uint32 chunks;            /* per frame, 1 or 3 */
+    Uint32 frames;
+    Uint64 index;             /* offset of the chunk offsets, 0 while packing */
+};
+
+/* .yvz input: decoder threads unpack a window of frames ahead of the
+ * frame rd() consumes, like the asynchronous reader reads ahead */
+struct pack_reader {
+    Uint32 packed;            /* input is a .yvz file */
+    Uint32 active;            /* decoder threads running */
+    int fd;
+    Uint32 codec;
+    Uint32 chunks;
+    Uint32 chunk_size[3];     /* raw bytes */
+    Uint64 max_chunk;         /* packed bytes */
+    Uint64* index;            /* offset of every chunk and of the end */
+    Uint32 frames;
+    Uint32 depth;             /* number of frame slots */
+    Uint8* slots;             /* depth * file_frame_size bytes */
+    Uint64 frame[PACK_MAX_DEPTH];  /* frame held by slot */
+    Uint32 state[PACK_MAX_DEPTH];  /* SLOT_EMPTY, SLOT_INFLIGHT, SLOT_READY */
+    Uint32 bad[PACK_MAX_DEPTH];    /* did not unpack */
+    Uint64 next;              /* frame currently consumed by rd() */
+    Uint32 pos;               /* bytes of that frame already consumed */
+    SDL_mutex* lock;          /* protects slot state, next and quit */
+    SDL_cond* cond;           /* slot state or window changed */
+    SDL_Thread* thread[MAX_THREADS];
+    Uint32 threads;
+    Uint32 quit;
+    Uint64 bytes_in;          /* packed bytes read */
+    Uint64 bytes_out;
+    double busy;              /* seconds spent unpacking, all threads */
+};
+
+struct pack_reader PAK;
+
+/* The render thread owns P, the input files and the back overlay: it
+ * reads and converts the next frame while the front overlay stays on
+ * screen. The UI thread only waits for SDL events, presents, resizes and
+ * sets the caption. Commands go UI -> render through a single producer,
+ * single consumer ring; results come back as SDL user events. */
+struct render_state {
+    SDL_Thread* thread;
+    SDL_Thread* slave;        /* message queue reader in SLAVE-mode */
+    SDL_sem* wake;            /* one count per queued command */
+    SDL_sem* back_free;       /* back overlay no longer on screen */
+    SDL_sem* resized;         /* UI thread done with EV_RESIZE */
+    SDL_mutex* lock;          /* protects caption */
+    struct command queue[CMD_QUEUE_SIZE];
+    Uint32 head;              /* next command to run, render thread */
+    Uint32 tail;              /* next free entry, UI thread */
+    SDL_Overlay* overlay[2];
+    Uint32 back;              /* overlay the render thread draws into */
+    Uint32 quit;
+    Uint32 frame;             /* frames displayed, 1 based */
+    char caption[256];
+    SDL_Thread* control_thread;
+    struct control* control;  /* pending control socket request */
+};
+
+struct render_state R;
+
+/* Input sessions: --record writes every key and click the UI thread
+ * forwards, --replay feeds them back as SDL events. Meanwhile every
+ * input is timed from queueing until the render thread is ready for
+ * the next one, and reported on exit. */
+struct session_state {
+    char* record_file;
+    char* replay_file;
+    char* latency_file;       /* every input as CSV */
+    Uint32 fast;              /* replay without the recorded pauses */
+    Uint32 on;                /* time inputs */
+    FILE* record;             /* UI thread */
+    FILE* replay;             /* replay_thread */
+    SDL_Thread* thread;
+    SDL_sem* handled;         /* one count per input done (or dropped) */
+    double start;             /* event loop started */
+    struct command taken;     /* input the render thread works on */
+    Uint32 busy;
+    /* main() asks for the first frame with a key, which is no input */
+    Uint32 started;           /* UI thread, past that key */
+    Uint32 first_done;        /* render thread, that key handled */
+    struct session_input* inputs;
+    Uint32 count;
+    Uint32 size;
+    Uint32 dropped;           /* UI thread, command queue was full */
+    Uint32 drawn;             /* frames, render thread */
+};
+
+struct session_state SES;
+
+/* Persistent workers. pool_run() hands every worker its own index and
+ * runs index 0 on the calling thread. */
+struct worker_pool {
+    Uint32 count;             /* threads including the caller */
+    SDL_Thread* thread[MAX_THREADS];
+    SDL_sem* go[MAX_THREADS];
+    SDL_sem* done;
+    void (*job)(void* arg, Uint32 index, Uint32 count);
+    void* arg;
+    Uint32 quit;
+};
+
+struct worker_pool POOL;
+
+/* Built-in scaler: frames are drawn into a stage overlay at source size
+ * (so grid, heatmap and plane masks work as before) and then resampled
+ * per plane into the real overlay, which has the zoomed size. Packed
+ * 4:2:2 is split into planes first and interleaved again afterwards. */
+struct scaler {
+    SDL_Overlay* stage;
+    Uint16 stage_pitch[3];
+    Uint8* stage_pixels[3];
+    Uint8* src_planes;        /* packed formats - deinterleaved stage */
+    Uint8* dst_planes;        /* packed formats - scaled planes */
+    Uint32 dst_size;
+    struct scale_plane plane[3];
+    Uint32* scratch;          /* rows of each worker */
+    Uint32 scratch_stride;    /* Uint32s per worker */
+    Uint64 scratch_size;
+    SDL_Overlay* packed;      /* overlay being (de)interleaved */
+    Uint32 interleave;        /* packed_job direction */
+};
+
+struct scaler SC;
+
+/* Frames kept in memory as the readers leave them (planes, and the
+ * packed frame for 4:2:2), so playback inside the range does no I/O */
+struct preload {
+    Uint8* data;
+    Uint64 bytes;             /* mapped size */
+    Uint32 first;
+    Uint32 count;
+    Uint32 frame_bytes;
+    Uint32 stale;             /* file position lags P.next_frame */
+};
+
+struct preload PRE;
+
+/* Waveform and vectorscope. The workers bin the planes of the frame on
+ * screen (10 bpp as read) into counts, which are shaded into a picture
+ * of the frame size that is drawn in place of the frame */
+struct scope {
+    Uint32* bins;             /* waveform counts, width x height */
+    Uint32* vbins;            /* vectorscope counts, a table per worker */
+    Uint32 vsize;             /* vectorscope bins per axis */
+    Uint32 tables;            /* vbins tables in use */
+    Uint16 row[1024];         /* sample value -> waveform row */
+    Uint32 max;               /* sample value on the top row */
+    Uint16* col;              /* parade: source column -> panel column,
+                               * vectorscope: picture column -> Cb bin */
+    Uint8* vshade;            /* shaded vectorscope counts */
+    Uint8* y;                 /* shaded picture, width x height */
+    Uint8* cb;                /* width / 2 x height */
+    Uint8* cr;
+    Uint8* rgb;               /* parade, a row per worker */
+    Sint32 coef[6];
+    Uint32 phase;             /* SCOPE_BIN, SCOPE_MERGE */
+};
+
+struct scope SCOPE;
+
+/* blocking and ringing of the frame on screen */
+struct artifact_state {
+    Uint8* src;               /* 8 bit luma measured */
+    Uint8* luma;              /* 10 bpp rounded to 8 bit */
+    Uint8* pad;               /* block_rows() scratch, one per worker */
+    Uint32* colsum;           /* one per worker, merged into the first */
+    Uint32* rowsum;
+    struct block_sums* blocks;
+    struct artifacts frame;
+};
+
+struct artifact_state ART;
+
+/* Summed-area tables of the planes of a frame: the sum and the sum of
+ * squares of all samples above and left of a point, (width + 1) x
+ * (height + 1) with a zero first row and column, so any rectangle costs
+ * four lookups. Built row by row, then column strip by column strip. */
+struct sat_tables {
+    Uint64* sum[3];
+    Uint64* sq[3];
+    Uint8* copy[3];           /* samples summed, viewer only, for min/max */
+    Uint32 width[3];
+    Uint32 height[3];
+    Uint32 planes;            /* 1 (luma) or 3 */
+    const Uint8* src[3];      /* plane being summed */
+    Uint32 pitch[3];          /* in samples */
+    Uint32 step[3];
+    Uint32 bytes;             /* per sample */
+};
+
+struct sat_tables SAT;
+
+/* --playlist: clips played back to back in one window. While one plays
+ * a thread opens the next, finds its size and format and frame index
+ * and reads its first frames into the page cache, open_clip() takes
+ * over the file and what was found */
+struct playlist {
+    struct playlist_entry* clips;
+    Uint32 count;
+    Uint32 current;
+    SDL_Thread* thread;       /* prefetching clips[next] */
+    Uint32 next;
+    Uint32 stop;              /* prefetch no longer wanted */
+    int fd;                   /* of clips[next], -1 if it didn't open */
+    Uint64 bytes;             /* prefetched */
+    Sint32 probed;            /* geometry below: 1 found, -1 failed (and
+                               * reported), 0 left to open_clip() */
+    Uint32 width;
+    Uint32 height;
+    Uint32 format;
+    Uint32 frame_ms;          /* 0 unless a Y4M header gives it */
+    struct frame_index index; /* of a Y4M clip */
+};
+
+struct playlist LIST;
+
 struct my_msgbuf {
     long mtype;
     char mtext[2];
+    Uint32 frame;             /* frame displayed after cmd, zero based */
 };
 
 struct param {
@@ -91,7 +879,16 @@ struct param {
     Uint32 height;            /* frame height - in pixels */
     Uint32 wh;                /* width x height */
     Uint32 frame_size;        /* size of 1 frame - in bytes */
+    Uint32 file_frame_size;   /* size of 1 frame on disk - in bytes */
     Sint32 zoom;              /* zoom-factor */
+    double scale;             /* fractional zoom, 0 - use zoom */
+    Uint32 fit;               /* scale to fit the desktop */
+    Uint32 scaler;            /* SCALE_SDL, SCALE_NEAREST, ... */
+    Uint32 threads;           /* worker threads incl. the caller */
+    Uint32 screen_w;          /* desktop size, for fit */
+    Uint32 screen_h;
+    Sint32 speed;             /* playback speed, negative is backwards */
+    Uint32 num_frames;        /* frames in filename */
     Uint32 zoom_width;
     Uint32 zoom_height;
     Uint32 grid;              /* grid-mode - on or off */
@@ -105,6 +902,28 @@ struct param {
     Uint32 cb_only;           /* Only Cb plane */
     Uint32 cr_only;           /* Only Cr plane */
     Uint32 mb;                /* macroblock-mode - on or off */
+    Uint32 heatmap;           /* per-MB error heatmap in diff-mode */
+    Uint32 mb_cols;           /* macroblocks per row */
+    Uint32 mb_rows;           /* macroblocks per column */
+    Uint32* mb_sad;           /* luma SAD per MB - diff-mode */
+    Uint32* mb_sse;           /* luma SSE per MB - diff-mode */
+    Uint8* y_ref;             /* luma of filename - diff-mode, as y_in */
+    Uint8* y_cmp;             /* luma of diff_filename - diff-mode, as y_in */
+    Uint8* cb_ref;            /* chroma of filename - both diff modes, as cb_in */
+    Uint8* cr_ref;            /* as cr_in */
+    Uint32 temporal;          /* diff against previous frame */
+    Uint8* y_prev;            /* luma of last frame read - temporal diff, as y_in */
+    Uint32 prev_frame;        /* frame in y_prev plus one, 0 if none */
+    Uint32 next_frame;        /* frame the next read returns */
+    Uint32 preload_mb;        /* memory budget for preloading, 0 = off */
+    Uint32 mark_a;            /* A-B markers, frame plus one, 0 if unset */
+    Uint32 mark_b;
+    Uint32 loop;              /* loop playback between loop_a and loop_b */
+    Uint32 loop_a;
+    Uint32 loop_b;
+    char* control_path;       /* Unix socket for remote control */
+    int control_fd;
+    Uint32 no_display;        /* control socket turned drawing off */
     Uint32 y_size;            /* sizeof luma-data for 1 frame - in bytes */
     Uint32 cb_size;           /* sizeof croma-data for 1 frame - in bytes */
     Uint32 cr_size;           /* sizeof croma-data for 1 frame - in bytes */
@@ -112,6 +931,13 @@ struct param {
     Uint8* y_data;            /* pointer towards luma-data */
     Uint8* cb_data;           /* pointer towards croma-data */
     Uint8* cr_data;           /* pointer towards croma-data */
+    Uint32 depth;             /* bits per sample, 8 or 10 */
+    Uint32 sample_bytes;      /* 1, or 2 (native endian) for 10 bpp */
+    Uint32 bits;              /* 10 bpp to display: BITS_ROUND, ... */
+    Uint32 scope;             /* SCOPE_OFF, SCOPE_LUMA, ... */
+    Uint8* y_in;              /* samples as read; 10 bpp stays 16 bit here */
+    Uint8* cb_in;             /* and y_data.. are made for display only, */
+    Uint8* cr_in;             /* 8 bpp formats share y_data.. */
     char* filename;           /* obvious */
     char* fname_diff;         /* see above */
     Uint32 overlay_format;    /* YV12, IYUV, YUY2, UYVY or YVYU - SDL */
@@ -122,6 +948,42 @@ struct param {
     int msqid;
     key_t key;
     FILE* fd2;                /* diff file */
+    Uint32 aio_depth;         /* asynchronous reader, 0 - plain fread */
+    Uint32 first_frame;       /* headless range - zero based, inclusive */
+    Uint32 last_frame;        /* headless range - defaults to last frame */
+    Uint32 range_set;
+    char* extract;            /* headless MB extraction - output file */
+    char* export;             /* headless image export - output name */
+    char* output;             /* headless raw YUV output file */
+    Uint32 out_format;        /* format of output, default FORMAT */
+    Uint32 out_format_set;
+    Uint32 crop[4];           /* x, y, w, h; w == 0 means no crop */
+    Uint32 blank;             /* bit per plane Y, Cb, Cr set to mid grey */
+    char* stats_file;         /* headless timeline CSV */
+    char* artifacts_file;     /* headless blockiness/ringing CSV */
+    char* variance_file;      /* headless MB luma variance .npy */
+    Uint32 sat;               /* summed-area tables of every frame read,
+                               * 1 and 2 until their cost is shown */
+    char* pack;               /* headless .yvz output */
+    Uint32 codec;             /* PACK_LZ4, PACK_ZSTD */
+    Uint32 pack_chunks;       /* 1 or 3, one per plane */
+    Uint32 probed;            /* size and format guessed, 2 once shown */
+    double start;             /* main() entered */
+    char* batch;              /* headless manifest of clip pairs */
+    char* playlist;           /* clips played back to back */
+    char* results;            /* JSONL of the batch, default stdout */
+    Uint32 readers;           /* batch jobs per device */
+    Uint32 ctu;               /* third blockiness grid, 32, 64 or 128 */
+    Uint32 artifacts;         /* ARTIFACTS_OFF, ARTIFACTS_CAPTION, ... */
+    struct frame_stats* stats;  /* analysis of frames stats_first.. */
+    Uint32 stats_first;
+    Uint32 stats_count;
+    Uint32 matrix;            /* BT601, BT709 or BT2020 for RGB output */
+    Uint32 full_range;        /* YCbCr uses 0-255 instead of 16-235/240 */
+    Uint32* mb_list;          /* x, y pairs of MBs to extract */
+    Uint32 mb_count;
+    struct frame_index index[2];  /* Y4M input and diff file */
+    Uint32 frame_ms;          /* playback interval */
 };
 
 /* Global parameter struct */
@@ -131,6 +993,13 @@ Uint32 rd(Uint8* data, Uint32 size)
 {
     Uint32 cnt;
 
+    if (PAK.active && fd != P.fd2) {
+        return pack_read(data, size);
+    }
+    if (AIO.active && fd != P.fd2) {
+        return aio_read(data, size);
+    }
+
     cnt = fread(data, sizeof(Uint8), size, fd);
     if (cnt < size) {
         fprintf(stderr, "No more data to read!\n");
@@ -139,915 +1008,8245 @@ Uint32 rd(Uint8* data, Uint32 size)
     return 1;
 }
 
-Uint32 read_yv12(void)
+double now(void)
 {
-    if (!rd(P.y_data, P.y_size)) return 0;
-    if (!rd(P.cb_data, P.cb_size)) return 0;
-    if (!rd(P.cr_data, P.cr_size)) return 0;
+    struct timespec ts;
 
-    return 1;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
 }
 
-Uint32 read_iyuv(void)
+/* position all inputs at the start of frame (zero based) */
+Uint32 seek_frame(Uint64 frame)
 {
-    if (!rd(P.y_data, P.y_size)) return 0;
-    if (!rd(P.cb_data, P.cb_size)) return 0;
-    if (!rd(P.cr_data, P.cr_size)) return 0;
 
+    /* preloaded, seek lazily once reading leaves the range */
+    if (!P.diff && frame >= PRE.first && frame < (Uint64)PRE.first + PRE.count) {
+        P.next_frame = frame;
+        PRE.stale = 1;
+        return 1;
+    }
+    PRE.stale = 0;
+
+    if (AIO.active && !aio_seek(frame)) {
+        return 0;
+    }
+    P.next_frame = frame;
+    if (PAK.active) {
+        pack_seek(frame);
+    } else if (fseeko(fd, frame_offset(0, frame), SEEK_SET)) {
+        perror("fseeko");
+        return 0;
+    }
+    if (P.diff && fseeko(P.fd2, frame_offset(1, frame), SEEK_SET)) {
+        perror("fseeko");
+        return 0;
+    }
     return 1;
 }
 
-Uint32 read_422(void)
+#ifdef HAVE_IO_URING
+int io_uring_setup(unsigned entries, struct io_uring_params* p)
 {
-    Uint8* y = P.y_data;
-    Uint8* cb = P.cb_data;
-    Uint8* cr = P.cr_data;
+    return syscall(__NR_io_uring_setup, entries, p);
+}
 
-    if (!rd(P.raw, P.frame_size)) return 0;
+int io_uring_enter(int ring_fd, unsigned to_submit,
+                          unsigned min_complete, unsigned flags)
+{
+    return syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete,
+                   flags, NULL, 0);
+}
 
-    for (Uint32 i = P.y_start_pos; i < P.frame_size; i += 2) *y++ = P.raw[i];
-    for (Uint32 i = P.cb_start_pos; i < P.frame_size; i += 4) *cb++ = P.raw[i];
-    for (Uint32 i = P.cr_start_pos; i < P.frame_size; i += 4) *cr++ = P.raw[i];
-    return 1;
+int io_uring_register(int ring_fd, unsigned opcode, void* arg,
+                             unsigned nr_args)
+{
+    return syscall(__NR_io_uring_register, ring_fd, opcode, arg, nr_args);
 }
 
-Uint32 read_y42210(void)
+Uint32 uring_init(void)
 {
-    Uint32 ret = 1;
-    Uint8* data;
-    Uint8* tmp;
+    struct io_uring_params p;
+    struct iovec iov;
 
-    data = malloc(sizeof(Uint8) * P.frame_size * 2);
-    if (!data) {
-        fprintf(stderr, "Error allocating memory...\n");
+    memset(&p, 0, sizeof(p));
+    AIO.ring_fd = io_uring_setup(AIO.depth, &p);
+    if (AIO.ring_fd < 0) {
         return 0;
     }
 
-    tmp = malloc(sizeof(Uint8) * P.frame_size);
-    if (!tmp) {
-        fprintf(stderr, "Error allocating memory...\n");
-        ret = 0;
-        goto cleany42210;
-    }
-
-    if (!rd(data, P.frame_size * 2)) {
-        ret = 0;
-        goto cleany42210;
+    AIO.sq_len = p.sq_off.array + p.sq_entries * sizeof(Uint32);
+    AIO.cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (AIO.cq_len > AIO.sq_len) {
+            AIO.sq_len = AIO.cq_len;
+        }
+        AIO.cq_len = AIO.sq_len;
     }
-    ten2eight(data, tmp, P.frame_size * 2);
 
-    /* Y  */
-    for (Uint32 i = 0, j = 0; i < P.frame_size; i += 2) {
-        P.raw[i] = tmp[j];
-        j++;
+    AIO.sq_ptr = mmap(NULL, AIO.sq_len, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, AIO.ring_fd, IORING_OFF_SQ_RING);
+    if (AIO.sq_ptr == MAP_FAILED) {
+        goto uring_fail;
     }
-    /* Cb */
-    for (Uint32 i = P.cb_start_pos, j = 0 ; i < P.frame_size; i += 4) {
-        P.raw[i] = tmp[P.wh + j];
-        j++;
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        AIO.cq_ptr = AIO.sq_ptr;
+    } else {
+        AIO.cq_ptr = mmap(NULL, AIO.cq_len, PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_POPULATE, AIO.ring_fd, IORING_OFF_CQ_RING);
+        if (AIO.cq_ptr == MAP_FAILED) {
+            munmap(AIO.sq_ptr, AIO.sq_len);
+            goto uring_fail;
+        }
     }
-    /* Cr */
-    for (Uint32 i = P.cr_start_pos, j = 0; i < P.frame_size; i += 4) {
-        P.raw[i] = tmp[P.wh/2*3 + j];
-        j++;
+
+    AIO.sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    AIO.sqes = mmap(NULL, AIO.sqes_len, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, AIO.ring_fd, IORING_OFF_SQES);
+    if (AIO.sqes == MAP_FAILED) {
+        if (AIO.cq_ptr != AIO.sq_ptr) {
+            munmap(AIO.cq_ptr, AIO.cq_len);
+        }
+        munmap(AIO.sq_ptr, AIO.sq_len);
+        goto uring_fail;
     }
 
-cleany42210:
-    free(tmp);
-    free(data);
+    AIO.sq_head = (Uint32*)(AIO.sq_ptr + p.sq_off.head);
+    AIO.sq_tail = (Uint32*)(AIO.sq_ptr + p.sq_off.tail);
+    AIO.sq_mask = (Uint32*)(AIO.sq_ptr + p.sq_off.ring_mask);
+    AIO.sq_array = (Uint32*)(AIO.sq_ptr + p.sq_off.array);
+    AIO.cq_head = (Uint32*)(AIO.cq_ptr + p.cq_off.head);
+    AIO.cq_tail = (Uint32*)(AIO.cq_ptr + p.cq_off.tail);
+    AIO.cq_mask = (Uint32*)(AIO.cq_ptr + p.cq_off.ring_mask);
+    AIO.cqes = (struct io_uring_cqe*)(AIO.cq_ptr + p.cq_off.cqes);
+
+    /* registered buffers save the per-read page pinning; not fatal
+     * if RLIMIT_MEMLOCK is too small for them */
+    iov.iov_base = AIO.slots;
+    iov.iov_len = (size_t)AIO.depth * AIO.slot_size;
+    AIO.fixed = io_uring_register(AIO.ring_fd, IORING_REGISTER_BUFFERS, &iov, 1) == 0;
 
-    return ret;
+    return 1;
+
+uring_fail:
+    close(AIO.ring_fd);
+    AIO.ring_fd = -1;
+    return 0;
 }
 
-Uint32 read_yv1210(void)
+void uring_exit(void)
 {
-    Uint32 ret = 1;
-    Uint8* data;
+    if (AIO.ring_fd < 0) {
+        return;
+    }
+    munmap(AIO.sqes, AIO.sqes_len);
+    if (AIO.cq_ptr != AIO.sq_ptr) {
+        munmap(AIO.cq_ptr, AIO.cq_len);
+    }
+    munmap(AIO.sq_ptr, AIO.sq_len);
+    close(AIO.ring_fd);
+    AIO.ring_fd = -1;
+}
+#endif
 
-    data = malloc(sizeof(Uint8) * P.y_size * 2);
-    if (!data) {
-        fprintf(stderr, "Error allocating memory...\n");
-        return 0;
+Uint32 aio_open(void)
+{
+    struct stat st;
+    int flags = O_RDONLY;
+
+    AIO.depth = P.aio_depth;
+    AIO.step = 1;
+    if (AIO.depth > AIO_MAX_DEPTH) {
+        AIO.depth = AIO_MAX_DEPTH;
     }
 
-    if (!rd(data, P.y_size * 2)) {
-        ret = 0;
-        goto cleanyv1210;
+    /* O_DIRECT is refused by some file systems (tmpfs), retry without */
+    AIO.fd = open(P.filename, flags | O_DIRECT);
+    if (AIO.fd < 0) {
+        AIO.fd = open(P.filename, flags);
     }
-    ten2eight(data, P.y_data, P.y_size * 2);
+    if (AIO.fd < 0 || fstat(AIO.fd, &st)) {
+        fprintf(stderr, "Error opening %s\n", P.filename);
+        return 0;
+    }
+    AIO.frames = frame_total(0, st.st_size);
 
-    if (!rd(data, P.cb_size * 2)) {
-        ret = 0;
-        goto cleanyv1210;
+    /* room for the frame plus the misalignment of its start */
+    AIO.slot_size = (P.file_frame_size + 2 * AIO_ALIGN - 1) & ~(AIO_ALIGN - 1);
+    if (posix_memalign((void**)&AIO.slots, AIO_ALIGN,
+                       (size_t)AIO.depth * AIO.slot_size)) {
+        fprintf(stderr, "Error allocating memory...\n");
+        close(AIO.fd);
+        return 0;
     }
-    ten2eight(data, P.cb_data, P.cb_size * 2);
 
-    if (!rd(data, P.cr_size * 2)) {
-        ret = 0;
-        goto cleanyv1210;
+    for (Uint32 i = 0; i < AIO.depth; i++) {
+        AIO.state[i] = SLOT_EMPTY;
     }
-    ten2eight(data, P.cr_data, P.cr_size * 2);
 
-cleanyv1210:
-    free(data);
+#ifdef HAVE_IO_URING
+    AIO.uring = uring_init();
+#endif
+    if (!AIO.uring) {
+        fprintf(stderr, "io_uring not available, using pread\n");
+    }
 
-    return ret;
+    AIO.active = 1;
+    AIO.t_last = now();
+    return aio_fill();
 }
 
-Uint32 ten2eight(Uint8* src, Uint8* dst, Uint32 length)
+void aio_close(void)
 {
-    Uint16 x = 0;
+    if (!AIO.active) {
+        return;
+    }
 
-    for (Uint32 i = 0; i < length; i += 2) {
-        x = (src[i+1] << 8) | src[i];
-        x = (x + 2) >> 2;
-        if (x > 255) {
-            x = 255;
+    while (AIO.inflight) {
+        if (!aio_reap(1)) {
+            break;
         }
-        *dst++ = x;
     }
 
-    return 1;
+    if (AIO.busy > 0) {
+        fprintf(stdout, "%s reader: %.1f MB, %.1f MB/s, "
+                "avg queue depth %.2f (max %u)\n",
+                AIO.uring ? "io_uring" : "pread",
+                AIO.bytes / 1e6, AIO.bytes / 1e6 / AIO.busy,
+                AIO.depth_sum / AIO.busy, AIO.max_inflight);
+    }
+
+#ifdef HAVE_IO_URING
+    uring_exit();
+#endif
+    free(AIO.slots);
+    close(AIO.fd);
+    AIO.active = 0;
 }
 
-Uint32 allocate_memory(void)
+/* accumulate busy time and queue depth since the last change of inflight */
+void aio_account(void)
 {
-    P.raw = malloc(sizeof(Uint8) * P.frame_size);
-    P.y_data = malloc(sizeof(Uint8) * P.y_size);
-    P.cb_data = malloc(sizeof(Uint8) * P.cb_size);
-    P.cr_data = malloc(sizeof(Uint8) * P.cr_size);
+    double t = now();
 
-    if (!P.raw || !P.y_data || !P.cb_data || !P.cr_data) {
-        fprintf(stderr, "Error allocating memory...\n");
-        return 0;
+    if (AIO.inflight) {
+        AIO.busy += t - AIO.t_last;
+        AIO.depth_sum += (t - AIO.t_last) * AIO.inflight;
     }
-    return 1;
+    AIO.t_last = t;
 }
 
-void draw_grid422(void)
+Uint32 aio_submit(Uint32 slot, Uint64 frame)
 {
-    if (!P.grid) {
-        return;
-    }
-
-    /* horizontal grid lines */
-    for (Uint32 y = 0; y < P.height; y += 16) {
-        for (Uint32 x = P.grid_start_pos; x < P.width * 2; x += 16) {
-            *(my_overlay->pixels[0] + y * my_overlay->pitches[0] + x) = 0xF0;
-            *(my_overlay->pixels[0] + y * my_overlay->pitches[0] + x + 8) = 0x20;
+    Uint64 offset = frame_offset(0, frame);
+    Uint64 start = offset & ~(Uint64)(AIO_ALIGN - 1);
+    Uint32 length = (offset + P.file_frame_size - start + AIO_ALIGN - 1) & ~(AIO_ALIGN - 1);
+    Uint8* buf = AIO.slots + (size_t)slot * AIO.slot_size;
+
+    AIO.frame[slot] = frame;
+    AIO.skip[slot] = offset - start;
+
+#ifdef HAVE_IO_URING
+    if (AIO.uring) {
+        Uint32 tail = *AIO.sq_tail;
+        Uint32 idx = tail & *AIO.sq_mask;
+        struct io_uring_sqe* sqe = &AIO.sqes[idx];
+
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = AIO.fixed ? IORING_OP_READ_FIXED : IORING_OP_READ;
+        sqe->fd = AIO.fd;
+        sqe->off = start;
+        sqe->addr = (unsigned long)buf;
+        sqe->len = length;
+        sqe->buf_index = 0;
+        sqe->user_data = slot;
+        AIO.sq_array[idx] = idx;
+        __atomic_store_n(AIO.sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+        aio_account();
+        AIO.state[slot] = SLOT_INFLIGHT;
+        AIO.inflight++;
+        if (AIO.inflight > AIO.max_inflight) {
+            AIO.max_inflight = AIO.inflight;
         }
+        return 1;
     }
-    /* vertical grid lines */
-    for (Uint32 x = P.grid_start_pos; x < P.width * 2; x += 32) {
-        for (Uint32 y = 0; y < P.height; y += 8) {
-            *(my_overlay->pixels[0] + y * my_overlay->pitches[0] + x) = 0xF0;
-            *(my_overlay->pixels[0] + (y + 4) * my_overlay->pitches[0] + x) = 0x20;
+#endif
+
+    {
+        ssize_t cnt;
+
+        aio_account();
+        AIO.inflight = 1;
+        AIO.max_inflight = 1;
+        cnt = pread(AIO.fd, buf, length, start);
+        aio_account();
+        AIO.inflight = 0;
+        if (cnt < 0) {
+            perror("pread");
+            AIO.state[slot] = SLOT_EMPTY;
+            return 0;
         }
+        AIO.bytes += cnt;
+        AIO.len[slot] = cnt > AIO.skip[slot] ? cnt - AIO.skip[slot] : 0;
+        AIO.bad[slot] = 0;
+        AIO.state[slot] = SLOT_READY;
     }
+    return 1;
 }
 
-void draw_grid420(void)
+/* collect finished reads, optionally blocking until at least one is done */
+Uint32 aio_reap(Uint32 wait)
 {
-    if (!P.grid) {
-        return;
+#ifdef HAVE_IO_URING
+    Uint32 head;
+    Uint32 submitted = *AIO.sq_tail - *AIO.sq_head;
+
+    if (!AIO.uring) {
+        return 1;
     }
 
-    /* horizontal grid lines */
-    for (Uint32 y = 0; y < P.height; y += 16) {
-        for (Uint32 x = 0; x < P.width; x += 8) {
-            *(my_overlay->pixels[0] + y * my_overlay->pitches[0] + x) = 0xF0;
-            *(my_overlay->pixels[0] + y * my_overlay->pitches[0] + x + 4) = 0x20;
+    head = *AIO.cq_head;
+    if (submitted || (wait && head == __atomic_load_n(AIO.cq_tail, __ATOMIC_ACQUIRE))) {
+        if (io_uring_enter(AIO.ring_fd, submitted,
+                           wait ? 1 : 0, wait ? IORING_ENTER_GETEVENTS : 0) < 0
+            && errno != EINTR) {
+            perror("io_uring_enter");
+            return 0;
         }
     }
-    /* vertical grid lines */
-    for (Uint32 x = 0; x < P.width; x += 16) {
-        for (Uint32 y = 0; y < P.height; y += 8) {
-            *(my_overlay->pixels[0] + y * my_overlay->pitches[0] + x) = 0xF0;
-            *(my_overlay->pixels[0] + (y + 4) * my_overlay->pitches[0] + x) = 0x20;
+
+    aio_account();
+    while (head != __atomic_load_n(AIO.cq_tail, __ATOMIC_ACQUIRE)) {
+        struct io_uring_cqe* cqe = &AIO.cqes[head & *AIO.cq_mask];
+        Uint32 slot = cqe->user_data;
+
+        /* a failed read stays in its slot, so that aio_read() reports
+         * it instead of aio_fill() submitting it again and again */
+        AIO.bad[slot] = cqe->res < 0;
+        if (cqe->res < 0) {
+            fprintf(stderr, "io_uring read: %s\n", strerror(-cqe->res));
+            AIO.len[slot] = 0;
+        } else {
+            AIO.bytes += cqe->res;
+            AIO.len[slot] = (Uint32)cqe->res > AIO.skip[slot] ?
+                cqe->res - AIO.skip[slot] : 0;
         }
+        AIO.state[slot] = SLOT_READY;
+        AIO.inflight--;
+        head++;
     }
+    __atomic_store_n(AIO.cq_head, head, __ATOMIC_RELEASE);
+#else
+    (void)wait;
+#endif
+    return 1;
 }
 
-void luma_only(void)
+/* frames step apart land in consecutive slots */
+Uint32 aio_slot(Uint64 frame)
 {
-    if (!P.y_only) {
-        return;
-    }
+    return frame / (Uint32)abs(AIO.step) % AIO.depth;
+}
 
-    if (FORMAT == YV12 || FORMAT == IYUV || FORMAT == YV1210) {
-        /* Set croma part to 0x80 */
-        for (Uint32 i = 0; i < P.cr_size; i++) my_overlay->pixels[1][i] = 0x80;
-        for (Uint32 i = 0; i < P.cb_size; i++) my_overlay->pixels[2][i] = 0x80;
-        return;
-    }
+/* make sure every frame of the window is either ready or in flight.
+ * pread() would only stall the current frame for ones ahead of it, so
+ * the fallback reads the current frame alone and the slots work as a
+ * cache of the last depth frames read. */
+Uint32 aio_fill(void)
+{
+    Uint32 ahead = AIO.uring ? AIO.depth : 1;
 
-    /* YUY2, UYVY, YVYU */
-    for (Uint32 i = P.cb_start_pos; i < P.frame_size; i += 4) {
-        *(my_overlay->pixels[0] + i) = 0x80;
-    }
-    for (Uint32 i = P.cr_start_pos; i < P.frame_size; i += 4) {
-        *(my_overlay->pixels[0] + i) = 0x80;
+    for (Uint32 i = 0; i < ahead; i++) {
+        Sint64 f = (Sint64)AIO.next + (Sint64)i * AIO.step;
+        Uint32 slot;
+
+        if (f < 0 || (Uint64)f >= AIO.frames) {
+            break;
+        }
+        slot = aio_slot(f);
+        if (AIO.state[slot] == SLOT_INFLIGHT) {
+            continue;
+        }
+        if (AIO.state[slot] == SLOT_READY && AIO.frame[slot] == (Uint64)f) {
+            continue;
+        }
+        if (!aio_submit(slot, f)) {
+            return 0;
+        }
     }
+    return aio_reap(0);
 }
 
-void cb_only(void)
+Uint32 aio_read(Uint8* data, Uint32 size)
 {
-    if (!P.cb_only) {
-        return;
-    }
+    while (size) {
+        Uint32 slot = aio_slot(AIO.next);
+        Uint32 cnt;
 
-    if (FORMAT == YV12 || FORMAT == IYUV || FORMAT == YV1210) {
-        /* Set Luma part and Cr to 0x80 */
-        for (Uint32 i = 0; i < P.y_size; i++) my_overlay->pixels[0][i] = 0x80;
-        for (Uint32 i = 0; i < P.cr_size; i++) my_overlay->pixels[1][i] = 0x80;
-        return;
-    }
+        if (AIO.next >= AIO.frames) {
+            fprintf(stderr, "No more data to read!\n");
+            return 0;
+        }
 
-    /* YUY2, UYVY, YVYU */
-    for (Uint32 i = P.y_start_pos; i < P.frame_size; i += 2) {
-        *(my_overlay->pixels[0] + i) = 0x80;
-    }
-    for (Uint32 i = P.cr_start_pos; i < P.frame_size; i += 4) {
-        *(my_overlay->pixels[0] + i) = 0x80;
+        if (AIO.state[slot] != SLOT_READY || AIO.frame[slot] != AIO.next) {
+            /* slot busy with a stale read or not yet issued */
+            if (AIO.state[slot] == SLOT_INFLIGHT) {
+                if (!aio_reap(1)) {
+                    return 0;
+                }
+            } else if (!aio_fill()) {
+                return 0;
+            }
+            continue;
+        }
+
+        if (AIO.bad[slot]) {
+            fprintf(stderr, "%s: frame %llu could not be read\n", P.filename,
+                    (unsigned long long)AIO.next);
+            return 0;
+        }
+
+        cnt = size;
+        if (cnt > P.file_frame_size - AIO.pos) {
+            cnt = P.file_frame_size - AIO.pos;
+        }
+        if (AIO.pos + cnt > AIO.len[slot]) {
+            fprintf(stderr, "No more data to read!\n");
+            return 0;
+        }
+        memcpy(data, AIO.slots + (size_t)slot * AIO.slot_size +
+               AIO.skip[slot] + AIO.pos, cnt);
+        data += cnt;
+        size -= cnt;
+        AIO.pos += cnt;
+
+        if (AIO.pos == P.file_frame_size) {
+            /* frame consumed, slide the window; the slot keeps the
+             * frame until aio_fill() needs it for a later one. In trick
+             * play the next seek slides it. */
+            AIO.next++;
+            AIO.pos = 0;
+            if (AIO.step == 1 && !aio_fill()) {
+                return 0;
+            }
+        }
     }
+    return 1;
 }
 
-void cr_only(void)
+/* Parse the header of a .yvz container, which like Y4M brings size,
+ * format and frame rate along. Other files are left alone. */
+Uint32 pack_header(char* name)
 {
-    if (!P.cr_only) {
-        return;
+    struct pack_header hdr;
+    struct stat st;
+    ssize_t n;
+    int in;
+
+    in = open(name, O_RDONLY);
+    if (in < 0 || fstat(in, &st)) {
+        fprintf(stderr, "Error opening %s\n", name);
+        if (in >= 0) {
+            close(in);
+        }
+        return 0;
+    }
+    n = pread(in, &hdr, sizeof(hdr), 0);
+    if (n != sizeof(hdr) || memcmp(hdr.magic, PACK_MAGIC, sizeof(hdr.magic))) {
+        close(in);
+        return 1;
     }
 
-    if (FORMAT == YV12 || FORMAT == IYUV || FORMAT == YV1210) {
-        /* Set Luma part and Cb to 0x80 */
-        for (Uint32 i = 0; i < P.y_size; i++) my_overlay->pixels[0][i] = 0x80;
-        for (Uint32 i = 0; i < P.cb_size; i++) my_overlay->pixels[2][i] = 0x80;
-        return;
+    hdr.format[sizeof(hdr.format) - 1] = '\0';
+    if (!parse_format(hdr.format, &FORMAT)) {
+        close(in);
+        return 0;
+    }
+    if (!hdr.index || hdr.chunks < 1 || hdr.chunks > 3 || hdr.index > (Uint64)st.st_size ||
+        hdr.index + ((Uint64)hdr.frames * hdr.chunks + 1) * sizeof(Uint64) > (Uint64)st.st_size) {
+        fprintf(stderr, "%s: incomplete .yvz file\n", name);
+        close(in);
+        return 0;
+    }
+#ifndef HAVE_ZSTD
+    if (hdr.codec == PACK_ZSTD) {
+        fprintf(stderr, "%s: Zstd compressed, build with ZSTD=1\n", name);
+        close(in);
+        return 0;
     }
+#endif
 
-    /* YUY2, UYVY, YVYU */
-    for (Uint32 i = P.y_start_pos; i < P.frame_size; i += 2) {
-        *(my_overlay->pixels[0] + i) = 0x80;
+    PAK.index = malloc(((size_t)hdr.frames * hdr.chunks + 1) * sizeof(Uint64));
+    if (!PAK.index) {
+        fprintf(stderr, "Error allocating memory...\n");
+        close(in);
+        return 0;
     }
-    for (Uint32 i = P.cb_start_pos; i < P.frame_size; i += 4) {
-        *(my_overlay->pixels[0] + i) = 0x80;
+    n = ((Uint64)hdr.frames * hdr.chunks + 1) * sizeof(Uint64);
+    if (pread(in, PAK.index, n, hdr.index) != n) {
+        fprintf(stderr, "%s: incomplete .yvz file\n", name);
+        free(PAK.index);
+        PAK.index = NULL;
+        close(in);
+        return 0;
+    }
+    close(in);
+
+    /* chunks lie in order between the header and the index */
+    for (Uint64 i = 0; i <= (Uint64)hdr.frames * hdr.chunks; i++) {
+        if (PAK.index[i] < (i ? PAK.index[i - 1] : sizeof(hdr)) || PAK.index[i] > hdr.index) {
+            fprintf(stderr, "%s: corrupt .yvz index\n", name);
+            free(PAK.index);
+            PAK.index = NULL;
+            return 0;
+        }
     }
+
+    PAK.packed = 1;
+    PAK.fd = -1;
+    PAK.codec = hdr.codec;
+    PAK.chunks = hdr.chunks;
+    PAK.frames = hdr.frames;
+    P.width = hdr.width;
+    P.height = hdr.height;
+    if (hdr.frame_ms) {
+        P.frame_ms = hdr.frame_ms;
+    }
+    set_overlay_format();
+    return 1;
 }
 
-void draw_420(void)
+/* overlay that shows FORMAT */
+void set_overlay_format(void)
 {
-    memcpy(my_overlay->pixels[0], P.y_data, P.y_size);
-    memcpy(my_overlay->pixels[1], P.cr_data, P.cr_size);
-    memcpy(my_overlay->pixels[2], P.cb_data, P.cb_size);
-    draw_grid420();
-    luma_only();
-    cb_only();
-    cr_only();
-    histogram();
+    switch (FORMAT)
+    {
+        case YV12:
+        case YV1210:
+            P.overlay_format = SDL_YV12_OVERLAY;
+            break;
+        case IYUV:
+            P.overlay_format = SDL_IYUV_OVERLAY;
+            break;
+        case YUY2:
+            P.overlay_format = SDL_YUY2_OVERLAY;
+            break;
+        case UYVY:
+            P.overlay_format = SDL_UYVY_OVERLAY;
+            break;
+        default:
+            /* YVYU, and Y42210 is shown as YVYU */
+            P.overlay_format = SDL_YVYU_OVERLAY;
+            break;
+    }
 }
 
-void draw_422(void)
+/* raw bytes of each chunk of a frame: the frame, or Y, then the two
+ * chroma planes in file order */
+void pack_chunks(Uint32 chunks, Uint32* size)
 {
-    memcpy(my_overlay->pixels[0], P.raw, P.frame_size);
-    draw_grid422();
-    luma_only();
-    cb_only();
-    cr_only();
-    histogram();
+    if (chunks == 1) {
+        size[0] = P.file_frame_size;
+        return;
+    }
+    size[0] = P.y_size * P.sample_bytes;
+    size[1] = P.cb_size * P.sample_bytes;
+    size[2] = P.cr_size * P.sample_bytes;
 }
 
-void usage(char* name)
+/* start the decoder threads, after setup_param() */
+Uint32 pack_open(void)
 {
-    fprintf(stderr, "Usage:\n");
-    fprintf(stderr, "%s filename width height format [diff_filename]\n", name);
+    Uint64 window = (Uint64)PACK_WINDOW_MB << 20;
+
+    PAK.fd = open(P.filename, O_RDONLY);
+    if (PAK.fd < 0) {
+        fprintf(stderr, "Error opening %s\n", P.filename);
+        return 0;
+    }
+    pack_chunks(PAK.chunks, PAK.chunk_size);
+    /* a chunk larger than its raw size is corrupt, pack_decode() fails
+     * it without reading, so it doesn't size the scratch buffers */
+    for (Uint64 i = 0; i < (Uint64)PAK.frames * PAK.chunks; i++) {
+        Uint64 bytes = PAK.index[i + 1] - PAK.index[i];
+
+        if (bytes <= PAK.chunk_size[i % PAK.chunks] && bytes > PAK.max_chunk) {
+            PAK.max_chunk = bytes;
+        }
+    }
+
+    /* two frames per thread in flight, fewer for huge frames */
+    PAK.threads = P.threads ? P.threads : sysconf(_SC_NPROCESSORS_ONLN);
+    if (PAK.threads < 1) {
+        PAK.threads = 1;
+    }
+    if (PAK.threads > MAX_THREADS) {
+        PAK.threads = MAX_THREADS;
+    }
+    PAK.depth = PAK.threads * 2 < PACK_MAX_DEPTH ? PAK.threads * 2 : PACK_MAX_DEPTH;
+    if (PAK.depth < 4) {
+        PAK.depth = 4;
+    }
+    while (PAK.depth > 2 && (Uint64)PAK.depth * P.file_frame_size > window) {
+        PAK.depth--;
+    }
+    /* more threads than free slots would only wait */
+    if (PAK.threads > PAK.depth - 1) {
+        PAK.threads = PAK.depth - 1;
+    }
+
+    PAK.slots = malloc((size_t)PAK.depth * P.file_frame_size);
+    PAK.lock = SDL_CreateMutex();
+    PAK.cond = SDL_CreateCond();
+    if (!PAK.slots || !PAK.lock || !PAK.cond) {
+        fprintf(stderr, "Error allocating memory...\n");
+        return 0;
+    }
+    for (Uint32 i = 0; i < PAK.depth; i++) {
+        PAK.state[i] = SLOT_EMPTY;
+    }
+
+    PAK.active = 1;
+    for (Uint32 i = 0; i < PAK.threads; i++) {
+        PAK.thread[i] = start_thread(pack_thread, "unpack", NULL);
+        if (!PAK.thread[i]) {
+            fprintf(stderr, "Couldn't start decoder thread: %s\n", SDL_GetError());
+            return 0;
+        }
+    }
+    return 1;
 }
 
-void mb_loop(char* str, Uint32 rows, Uint8* data, Uint32 pitch)
+void pack_close(void)
 {
-    printf("%s\n", str);
-    for (Uint32 i = 0; i < rows;i++) {
-        for (Uint32 j = 0; j < 16; j++) {
-            printf("%02X ", data[pitch+i]);
+    if (PAK.lock) {
+        SDL_LockMutex(PAK.lock);
+        PAK.quit = 1;
+        SDL_CondBroadcast(PAK.cond);
+        SDL_UnlockMutex(PAK.lock);
+    }
+    for (Uint32 i = 0; i < PAK.threads; i++) {
+        if (PAK.thread[i]) {
+            SDL_WaitThread(PAK.thread[i], NULL);
         }
-        printf("\n");
     }
+
+    if (PAK.active && PAK.busy > 0) {
+        fprintf(stdout, "yvz reader: %.1f MB read, %.1f MB unpacked, %.1f MB/s per thread\n",
+                PAK.bytes_in / 1e6, PAK.bytes_out / 1e6, PAK.bytes_out / 1e6 / PAK.busy);
+    }
+
+    if (PAK.cond) {
+        SDL_DestroyCond(PAK.cond);
+    }
+    if (PAK.lock) {
+        SDL_DestroyMutex(PAK.lock);
+    }
+    if (PAK.fd >= 0) {
+        close(PAK.fd);
+    }
+    free(PAK.slots);
+    free(PAK.index);
+    PAK.active = 0;
 }
 
-void show_mb(Uint32 mouse_x, Uint32 mouse_y)
+/* one frame of the container into dst, scratch holds a packed chunk */
+Uint32 pack_decode(Uint64 frame, Uint8* dst, Uint8* scratch)
 {
-    /* TODO: bad code */
-    Uint32 MB;
-    Uint32 pitch[5] = {64, 64, 128, 128, 128};
-    Uint32 length[5] = {4, 4, 8, 8, 8};
+    Uint64* chunk = PAK.index + frame * PAK.chunks;
 
-    Uint16 y_pitch, cb_pitch, cr_pitch;
+    for (Uint32 c = 0; c < PAK.chunks; c++) {
+        Uint64 bytes = chunk[c + 1] - chunk[c];
+        Uint32 size = PAK.chunk_size[c];
 
-    if (!P.mb) {
-        return;
+        if (bytes > size || pread(PAK.fd, scratch, bytes, chunk[c]) != (ssize_t)bytes) {
+            return 0;
+        }
+        /* incompressible chunks are stored as they are */
+        if (bytes == size) {
+            memcpy(dst, scratch, size);
+        } else if (!unpack_chunk(PAK.codec, scratch, bytes, dst, size)) {
+            return 0;
+        }
+        dst += size;
+        __atomic_add_fetch(&PAK.bytes_in, bytes, __ATOMIC_RELAXED);
+    }
+    return 1;
+}
+
+/* Decoder thread: decompresses the first frame of the window that is
+ * neither ready nor taken, like aio_fill() does with reads */
+int pack_thread(void* data)
+{
+    Uint8* scratch = malloc(PAK.max_chunk ? PAK.max_chunk : 1);
+
+    (void)data;
+    /* without scratch the frames this thread takes come out bad, so
+     * pack_read() fails instead of waiting for them */
+    if (!scratch) {
+        fprintf(stderr, "Error allocating memory...\n");
     }
 
-    /* which MB are we in? */
-    MB = mouse_x / (16 * P.zoom) +
-        (P.width / 16) *
-        (mouse_y / (16 * P.zoom));
+    SDL_LockMutex(PAK.lock);
+    while (!PAK.quit) {
+        Uint64 f;
+        Uint32 slot = 0;
+        Uint32 ok;
+        double t;
+
+        for (f = PAK.next; f < PAK.next + PAK.depth && f < PAK.frames; f++) {
+            slot = f % PAK.depth;
+            if (PAK.state[slot] == SLOT_INFLIGHT) {
+                continue;
+            }
+            if (PAK.state[slot] == SLOT_READY && PAK.frame[slot] == f) {
+                continue;
+            }
+            break;
+        }
+        if (f >= PAK.next + PAK.depth || f >= PAK.frames) {
+            SDL_CondWait(PAK.cond, PAK.lock);
+            continue;
+        }
 
-    y_pitch = 16 * MB;
-    cb_pitch = pitch[FORMAT] * MB;
-    cr_pitch = pitch[FORMAT] * MB;
-    printf("\nMB #%d\n", MB);
+        PAK.state[slot] = SLOT_INFLIGHT;
+        PAK.frame[slot] = f;
+        SDL_UnlockMutex(PAK.lock);
 
-    mb_loop("= Y =", 16, P.y_data, y_pitch);
-    mb_loop("= Cb =", length[FORMAT], P.cb_data, cb_pitch);
-    mb_loop("= Cr =", length[FORMAT], P.cr_data, cr_pitch);
+        t = now();
+        ok = scratch && pack_decode(f, PAK.slots + (size_t)slot * P.file_frame_size, scratch);
+        t = now() - t;
 
-    printf("\n");
-    fflush(stdout);
+        SDL_LockMutex(PAK.lock);
+        PAK.state[slot] = SLOT_READY;
+        PAK.bad[slot] = !ok;
+        PAK.busy += t;
+        PAK.bytes_out += P.file_frame_size;
+        SDL_CondBroadcast(PAK.cond);
+    }
+    SDL_UnlockMutex(PAK.lock);
+
+    free(scratch);
+    return 0;
 }
 
-Uint32 (*reader[])(void) = {read_yv12, read_iyuv, read_422, read_422, read_422, read_yv1210, read_y42210};
-void (*drawer[])(void) = {draw_420, draw_420, draw_422, draw_422, draw_422, draw_420, draw_422};
+/* render thread: the next frame rd() returns */
+void pack_seek(Uint64 frame)
+{
+    SDL_LockMutex(PAK.lock);
+    PAK.next = frame;
+    PAK.pos = 0;
+    SDL_CondBroadcast(PAK.cond);
+    SDL_UnlockMutex(PAK.lock);
+}
 
-void draw_frame(void)
+Uint32 pack_read(Uint8* data, Uint32 size)
 {
-    SDL_LockYUVOverlay(my_overlay);
-    (*drawer[FORMAT])();
-    set_zoom_rect();
-    video_rect.x = 0;
-    video_rect.y = 0;
-    video_rect.w = P.zoom_width;
-    video_rect.h = P.zoom_height;
-    SDL_UnlockYUVOverlay(my_overlay);
-    SDL_DisplayYUVOverlay(my_overlay, &video_rect);
+    while (size) {
+        Uint32 slot = PAK.next % PAK.depth;
+        Uint32 cnt;
+
+        if (PAK.next >= PAK.frames) {
+            fprintf(stderr, "No more data to read!\n");
+            return 0;
+        }
+
+        SDL_LockMutex(PAK.lock);
+        while (PAK.state[slot] != SLOT_READY || PAK.frame[slot] != PAK.next) {
+            SDL_CondWait(PAK.cond, PAK.lock);
+        }
+        SDL_UnlockMutex(PAK.lock);
+        /* a ready slot of the current frame stays untouched until it
+         * is consumed */
+        if (PAK.bad[slot]) {
+            fprintf(stderr, "%s: frame %llu is corrupt\n", P.filename,
+                    (unsigned long long)PAK.next);
+            return 0;
+        }
+
+        cnt = size;
+        if (cnt > P.file_frame_size - PAK.pos) {
+            cnt = P.file_frame_size - PAK.pos;
+        }
+        memcpy(data, PAK.slots + (size_t)slot * P.file_frame_size + PAK.pos, cnt);
+        data += cnt;
+        size -= cnt;
+        PAK.pos += cnt;
+
+        if (PAK.pos == P.file_frame_size) {
+            /* frame consumed, slide the window */
+            SDL_LockMutex(PAK.lock);
+            PAK.state[slot] = SLOT_EMPTY;
+            PAK.next++;
+            PAK.pos = 0;
+            SDL_CondBroadcast(PAK.cond);
+            SDL_UnlockMutex(PAK.lock);
+        }
+    }
+    return 1;
 }
 
-Uint32 read_frame(void)
+/* slots that still hold frames of the new window are kept, failed
+ * reads are retried */
+Uint32 aio_seek(Uint64 frame)
 {
-    if (!P.diff) {
-        return (*reader[FORMAT])();
-    } else {
-        return diff_mode();
+    for (Uint32 i = 0; i < AIO.depth; i++) {
+        if (AIO.state[i] == SLOT_READY && AIO.bad[i]) {
+            AIO.state[i] = SLOT_EMPTY;
+        }
     }
+    AIO.next = frame;
+    AIO.pos = 0;
+    return aio_fill();
 }
 
-Uint32 diff_mode(void)
+Uint32 read_yv12(void)
 {
-    FILE* fd_tmp;
-    Uint8* y_tmp;
+    if (!rd(P.y_data, P.y_size)) return 0;
+    if (!rd(P.cb_data, P.cb_size)) return 0;
+    if (!rd(P.cr_data, P.cr_size)) return 0;
 
-    /* Perhaps a bit ugly but it seams to work...
-     * 1. read frame from fd
-     * 2. store data away
-     * 3. read frame from P.fd2
-     * 4. calculate diff
-     * 5. place result in P.raw or P.y_data depending on FORMAT
-     * 6. diff works on luma data so clear P.cb_data and P.cr_data
-     * Fiddle with the file descriptors so that we read
-     * from correct file.
-     */
+    return 1;
+}
 
-    if (!(*reader[FORMAT])()) {
-        return 0;
-    }
+Uint32 read_iyuv(void)
+{
+    if (!rd(P.y_data, P.y_size)) return 0;
+    if (!rd(P.cb_data, P.cb_size)) return 0;
+    if (!rd(P.cr_data, P.cr_size)) return 0;
 
-    y_tmp = malloc(sizeof(Uint8) * P.y_size);
+    return 1;
+}
 
-    if (!y_tmp) {
-        fprintf(stderr, "Error allocating memory...\n");
-        return 0;
-    }
+Uint32 read_422(void)
+{
+    Uint8* y = P.y_data;
+    Uint8* cb = P.cb_data;
+    Uint8* cr = P.cr_data;
 
-    for (Uint32 i = 0; i < P.y_size; i++) {
-        y_tmp[i] = P.y_data[i];
-    }
+    if (!rd(P.raw, P.frame_size)) return 0;
 
-    fd_tmp = fd;
-    fd = P.fd2;
+    for (Uint32 i = P.y_start_pos; i < P.frame_size; i += 2) *y++ = P.raw[i];
+    for (Uint32 i = P.cb_start_pos; i < P.frame_size; i += 4) *cb++ = P.raw[i];
+    for (Uint32 i = P.cr_start_pos; i < P.frame_size; i += 4) *cr++ = P.raw[i];
+    return 1;
+}
 
-    if (!(*reader[FORMAT])()) {
-        free(y_tmp);
-        fd = fd_tmp;
-        return 0;
-    }
+/* YV1210 and Y42210 are planar, 16 bit little endian samples; they are
+ * kept as read, display_planes() makes the 8 bit planes when drawing */
+Uint32 read_10bit(void)
+{
+    if (!rd(P.y_in, P.y_size * 2)) return 0;
+    if (!rd(P.cb_in, P.cb_size * 2)) return 0;
+    if (!rd(P.cr_in, P.cr_size * 2)) return 0;
 
-    /* restore file descriptor */
-    fd = fd_tmp;
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    Uint16* planes[3] = {(Uint16*)P.y_in, (Uint16*)P.cb_in, (Uint16*)P.cr_in};
+    Uint32 sizes[3] = {P.y_size, P.cb_size, P.cr_size};
 
-    /* now, P.y_data contains luminance data for fd2 and
-     * y_tmp contains luma data for fd.
-     * Calculate diff and place result where it belongs
-     * Clear croma data */
+    for (Uint32 p = 0; p < 3; p++) {
+        for (Uint32 i = 0; i < sizes[p]; i++) {
+            planes[p][i] = planes[p][i] >> 8 | planes[p][i] << 8;
+        }
+    }
+#endif
+    return 1;
+}
 
-    calc_psnr(y_tmp, P.y_data);
+Uint32 ten2eight(Uint8* src, Uint8* dst, Uint32 length)
+{
+    Uint16 x = 0;
 
-    if (FORMAT == YV12 || FORMAT == IYUV) {
-        for (Uint32 i = 0; i < P.y_size; i++) {
-            P.y_data[i] = 0x80 - (y_tmp[i] - P.y_data[i]);
-        }
-        for (Uint32 i = 0; i < P.cb_size; i++) P.cb_data[i] = 0x80;
-        for (Uint32 i = 0; i < P.cr_size; i++) P.cr_data[i] = 0x80;
-    } else {
-        Uint32 j = 0;
-        for (Uint32 i = P.y_start_pos; i < P.frame_size; i += 2) {
-            P.raw[i] = 0x80 - (y_tmp[j] - P.y_data[j]);
-            j++;
+    for (Uint32 i = 0; i < length; i += 2) {
+        x = (src[i+1] << 8) | src[i];
+        x = (x + 2) >> 2;
+        if (x > 255) {
+            x = 255;
         }
-        for (Uint32 i = P.cb_start_pos; i < P.frame_size; i += 4)  P.raw[i] = 0x80;
-        for (Uint32 i = P.cr_start_pos; i < P.frame_size; i += 4)  P.raw[i] = 0x80;
+        *dst++ = x;
     }
 
-    free(y_tmp);
-
     return 1;
 }
 
-void calc_psnr(Uint8* frame0, Uint8* frame1)
+Uint32 allocate_memory(void)
 {
-    double mse = 0.0;
-    double mse_tmp = 0.0;
-    double psnr = 0.0;
+    P.raw = malloc(sizeof(Uint8) * P.frame_size);
+    P.y_data = malloc(sizeof(Uint8) * P.y_size);
+    P.cb_data = malloc(sizeof(Uint8) * P.cb_size);
+    P.cr_data = malloc(sizeof(Uint8) * P.cr_size);
 
-    for (Uint32 i = 0; i < P.y_size; i++) {
-        mse_tmp = abs(frame0[i] - frame1[i]);
-        mse += mse_tmp * mse_tmp;
+    if (!P.raw || !P.y_data || !P.cb_data || !P.cr_data) {
+        fprintf(stderr, "Error allocating memory...\n");
+        return 0;
     }
 
-    /* division by zero */
-    if (mse == 0) {
-        fprintf(stdout, "PSNR: NaN\n");
-        return;
+    P.y_in = P.y_data;
+    P.cb_in = P.cb_data;
+    P.cr_in = P.cr_data;
+    if (P.sample_bytes == 2) {
+        P.y_in = malloc(P.y_size * 2);
+        P.cb_in = malloc(P.cb_size * 2);
+        P.cr_in = malloc(P.cr_size * 2);
+        if (!P.y_in || !P.cb_in || !P.cr_in) {
+            fprintf(stderr, "Error allocating memory...\n");
+            return 0;
+        }
     }
 
-    mse /= P.y_size;
-
-    psnr = 10.0*log10((256 * 256) / mse);
-
-    fprintf(stdout, "PSNR: %f\n", psnr);
+    /* diff-mode, temporal diff can be switched on at any time */
+    P.y_ref = malloc(P.y_size * P.sample_bytes);
+    P.y_cmp = malloc(P.y_size * P.sample_bytes);
+    P.y_prev = malloc(P.y_size * P.sample_bytes);
+    P.cb_ref = malloc(P.cb_size * P.sample_bytes);
+    P.cr_ref = malloc(P.cr_size * P.sample_bytes);
+    P.mb_sad = malloc(sizeof(Uint32) * P.mb_cols * P.mb_rows);
+    P.mb_sse = malloc(sizeof(Uint32) * P.mb_cols * P.mb_rows);
+
+    if (!P.y_ref || !P.y_cmp || !P.y_prev || !P.cb_ref || !P.cr_ref ||
+        !P.mb_sad || !P.mb_sse) {
+        fprintf(stderr, "Error allocating memory...\n");
+        return 0;
+    }
+    return 1;
 }
 
-void histogram(void)
+void draw_grid422(void)
 {
-    if (!P.hist) {
+    if (!P.grid) {
         return;
     }
 
-    Uint8 y[256] = {0};
-    Uint8 b[256] = {0};
-    Uint8 r[256] = {0};
-
-    for (Uint32 i = 0; i < P.y_size; i++) y[P.y_data[i]]++;
-    for (Uint32 i = 0; i < P.cb_size; i++) b[P.cb_data[i]]++;
-    for (Uint32 i = 0; i < P.cr_size; i++) r[P.cr_data[i]]++;
-
-    fprintf(stdout, "\nY,");
-    for (Uint32 i = 0; i < 256; i++)  fprintf(stdout, "%u,", y[i]);
-    fprintf(stdout, "\nCb,");
-    for (Uint32 i = 0; i < 256; i++)  fprintf(stdout, "%u,", b[i]);
-    fprintf(stdout, "\nCr,");
-    for (Uint32 i = 0; i < 256; i++)  fprintf(stdout, "%u,", r[i]);
-    fprintf(stdout, "\n");
-    fflush(stdout);
+    /* horizontal grid lines */
+    for (Uint32 y = 0; y < P.height; y += 16) {
+        for (Uint32 x = P.grid_start_pos; x < P.width * 2; x += 16) {
+            *(my_overlay->pixels[0] + y * my_overlay->pitches[0] + x) = 0xF0;
+            *(my_overlay->pixels[0] + y * my_overlay->pitches[0] + x + 8) = 0x20;
+        }
+    }
+    /* vertical grid lines */
+    for (Uint32 x = P.grid_start_pos; x < P.width * 2; x += 32) {
+        for (Uint32 y = 0; y < P.height; y += 8) {
+            *(my_overlay->pixels[0] + y * my_overlay->pitches[0] + x) = 0xF0;
+            *(my_overlay->pixels[0] + (y + 4) * my_overlay->pitches[0] + x) = 0x20;
+        }
+    }
 }
 
-void setup_param(void)
+void draw_grid420(void)
 {
-    P.zoom = 1;
+    if (!P.grid) {
+        return;
+    }
+
+    /* horizontal grid lines */
+    for (Uint32 y = 0; y < P.height; y += 16) {
+        for (Uint32 x = 0; x < P.width; x += 8) {
+            *(my_overlay->pixels[0] + y * my_overlay->pitches[0] + x) = 0xF0;
+            *(my_overlay->pixels[0] + y * my_overlay->pitches[0] + x + 4) = 0x20;
+        }
+    }
+    /* vertical grid lines */
+    for (Uint32 x = 0; x < P.width; x += 16) {
+        for (Uint32 y = 0; y < P.height; y += 8) {
+            *(my_overlay->pixels[0] + y * my_overlay->pitches[0] + x) = 0xF0;
+            *(my_overlay->pixels[0] + (y + 4) * my_overlay->pitches[0] + x) = 0x20;
+        }
+    }
+}
+
+void luma_only(void)
+{
+    if (!P.y_only) {
+        return;
+    }
+
+    if (FORMAT == YV12 || FORMAT == IYUV || FORMAT == YV1210) {
+        /* Set croma part to 0x80 */
+        for (Uint32 i = 0; i < P.cr_size; i++) my_overlay->pixels[1][i] = 0x80;
+        for (Uint32 i = 0; i < P.cb_size; i++) my_overlay->pixels[2][i] = 0x80;
+        return;
+    }
+
+    /* YUY2, UYVY, YVYU */
+    for (Uint32 i = P.cb_start_pos; i < P.frame_size; i += 4) {
+        *(my_overlay->pixels[0] + i) = 0x80;
+    }
+    for (Uint32 i = P.cr_start_pos; i < P.frame_size; i += 4) {
+        *(my_overlay->pixels[0] + i) = 0x80;
+    }
+}
+
+void cb_only(void)
+{
+    if (!P.cb_only) {
+        return;
+    }
+
+    if (FORMAT == YV12 || FORMAT == IYUV || FORMAT == YV1210) {
+        /* Set Luma part and Cr to 0x80 */
+        for (Uint32 i = 0; i < P.y_size; i++) my_overlay->pixels[0][i] = 0x80;
+        for (Uint32 i = 0; i < P.cr_size; i++) my_overlay->pixels[1][i] = 0x80;
+        return;
+    }
+
+    /* YUY2, UYVY, YVYU */
+    for (Uint32 i = P.y_start_pos; i < P.frame_size; i += 2) {
+        *(my_overlay->pixels[0] + i) = 0x80;
+    }
+    for (Uint32 i = P.cr_start_pos; i < P.frame_size; i += 4) {
+        *(my_overlay->pixels[0] + i) = 0x80;
+    }
+}
+
+void cr_only(void)
+{
+    if (!P.cr_only) {
+        return;
+    }
+
+    if (FORMAT == YV12 || FORMAT == IYUV || FORMAT == YV1210) {
+        /* Set Luma part and Cb to 0x80 */
+        for (Uint32 i = 0; i < P.y_size; i++) my_overlay->pixels[0][i] = 0x80;
+        for (Uint32 i = 0; i < P.cb_size; i++) my_overlay->pixels[2][i] = 0x80;
+        return;
+    }
+
+    /* YUY2, UYVY, YVYU */
+    for (Uint32 i = P.y_start_pos; i < P.frame_size; i += 2) {
+        *(my_overlay->pixels[0] + i) = 0x80;
+    }
+    for (Uint32 i = P.cb_start_pos; i < P.frame_size; i += 4) {
+        *(my_overlay->pixels[0] + i) = 0x80;
+    }
+}
+
+void draw_420(void)
+{
+    memcpy(my_overlay->pixels[0], P.y_data, P.y_size);
+    memcpy(my_overlay->pixels[1], P.cr_data, P.cr_size);
+    memcpy(my_overlay->pixels[2], P.cb_data, P.cb_size);
+    draw_heatmap();
+    draw_blockiness();
+    draw_grid420();
+    luma_only();
+    cb_only();
+    cr_only();
+    draw_scope();
+    histogram();
+}
+
+void draw_422(void)
+{
+    memcpy(my_overlay->pixels[0], P.raw, P.frame_size);
+    draw_heatmap();
+    draw_blockiness();
+    draw_grid422();
+    luma_only();
+    cb_only();
+    cr_only();
+    draw_scope();
+    histogram();
+}
+
+void usage(char* name)
+{
+    fprintf(stderr, "Usage:\n");
+    fprintf(stderr, "%s [options] filename width height format [diff_filename]\n", name);
+    fprintf(stderr, "%s [options] filename.y4m [diff_filename]\n", name);
+    fprintf(stderr, "%s [options] --batch=manifest\n", name);
+    fprintf(stderr, "%s [options] --playlist=file\n", name);
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "  -a, --aio[=depth]   asynchronous reader, io_uring if available\n");
+    fprintf(stderr, "                      (default depth %d frames)\n", AIO_DEFAULT_DEPTH);
+    fprintf(stderr, "  -s, --scale=mode    built-in scaler: sdl, nearest, bilinear or area\n");
+    fprintf(stderr, "  -z, --zoom=factor   initial (fractional) zoom\n");
+    fprintf(stderr, "      --fit           zoom to fit the desktop\n");
+    fprintf(stderr, "      --bits=mode     10 bpp display: round, mid (bits 8-1), low (bits 7-0)\n");
+    fprintf(stderr, "                      or stretch (luma 0.5-99.5%% to full range)\n");
+    fprintf(stderr, "      --scope=mode    show waveform, parade (RGB) or vector instead of the frame\n");
+    fprintf(stderr, "  -j, --threads=N     worker threads (default: all cores)\n");
+    fprintf(stderr, "      --preload[=MB]  keep the clip, or the A-B loop, in memory\n");
+    fprintf(stderr, "                      (default budget %d MB)\n", PRELOAD_DEFAULT_MB);
+    fprintf(stderr, "  -c, --control=path  accept commands on a Unix socket\n");
+    fprintf(stderr, "  -t, --temporal      show the difference of each frame to the previous one\n");
+    fprintf(stderr, "  -e, --export=name   write frames to name_NNNNNN.png (or .ppm)\n");
+    fprintf(stderr, "      --matrix=M      RGB conversion: 601 (default), 709 or 2020\n");
+    fprintf(stderr, "      --full-range    YCbCr is full range (0-255)\n");
+    fprintf(stderr, "  -o, --output=file   write frames as raw YUV (with --to, --crop, --blank)\n");
+    fprintf(stderr, "      --to=FORMAT     output format, default input format\n");
+    fprintf(stderr, "      --crop=x,y,w,h  crop output\n");
+    fprintf(stderr, "      --blank=y,cb,cr set planes to mid grey in output\n");
+    fprintf(stderr, "      --stats=file    write per frame luma stats, cuts, black and frozen frames as CSV\n");
+    fprintf(stderr, "      --artifacts=file write per frame blockiness and ringing as CSV\n");
+    fprintf(stderr, "      --pack=file     write frames to a .yvz file, packed frame by frame\n");
+    fprintf(stderr, "      --codec=C       lz4 (default) or zstd for --pack\n");
+    fprintf(stderr, "      --pack-planes   pack every plane on its own\n");
+    fprintf(stderr, "      --record=file   record keys and clicks with their timing\n");
+    fprintf(stderr, "      --replay=file   replay a recording at its timing, then quit\n");
+    fprintf(stderr, "      --replay-fast=file replay each input as soon as the last is handled\n");
+    fprintf(stderr, "      --latency=file  write the latency of every input as CSV\n");
+    fprintf(stderr, "      --sat           summed-area tables of every frame for region statistics\n");
+    fprintf(stderr, "      --variance=file write the luma variance of every MB to a .npy file\n");
+    fprintf(stderr, "      --ctu=N         CTU grid for blockiness: 32, 64 (default) or 128\n");
+    fprintf(stderr, "      --batch=file    PSNR of every \"reference test width height format\" line\n");
+    fprintf(stderr, "      --results=file  JSON line per batch job (default stdout)\n");
+    fprintf(stderr, "      --readers=N     batch jobs reading from one device (default %d)\n",
+            BATCH_READERS);
+    fprintf(stderr, "      --playlist=file play \"filename [width height format]\" lines back to back\n");
+    fprintf(stderr, "  -f, --frames=A[:B]  frame range for headless commands (zero based)\n");
+    fprintf(stderr, "  -x, --extract=file  write MB samples of --mbs/--mb-rect to a .npy file\n");
+    fprintf(stderr, "      --mbs=x,y[:x,y] MBs to extract\n");
+    fprintf(stderr, "      --mb-rect=x0,y0,x1,y1  rectangle of MBs to extract (inclusive)\n");
+}
+
+/* data in samples of P.sample_bytes, 10 bpp is printed with 3 digits */
+void mb_loop(char* str, Uint32 rows, Uint32 cols, Uint8* data, Uint32 pitch)
+{
+    printf("%s\n", str);
+    for (Uint32 i = 0; i < rows; i++) {
+        for (Uint32 j = 0; j < cols; j++) {
+            if (P.sample_bytes == 2) {
+                printf("%03X ", ((Uint16*)data)[i * pitch + j]);
+            } else {
+                printf("%02X ", data[i * pitch + j]);
+            }
+        }
+        printf("\n");
+    }
+}
+
+void show_mb(Uint32 mouse_x, Uint32 mouse_y)
+{
+    Uint32 x, y, mb_x, mb_y, MB;
+    Uint32 rows, cols, c_rows, c_pitch;
+    Uint32 chroma_offset;
+
+    if (!P.mb) {
+        return;
+    }
+
+    /* window coordinates -> frame coordinates, valid for any zoom */
+    x = mouse_x * P.width / P.zoom_width;
+    y = mouse_y * P.height / P.zoom_height;
+    if (x >= P.width || y >= P.height) {
+        return;
+    }
+
+    mb_x = x / 16;
+    mb_y = y / 16;
+    MB = mb_y * P.mb_cols + mb_x;
+
+    /* partial MBs at the right and bottom edge */
+    cols = P.width - mb_x * 16 < 16 ? P.width - mb_x * 16 : 16;
+    rows = P.height - mb_y * 16 < 16 ? P.height - mb_y * 16 : 16;
+
+    /* chroma is half width for all formats, half height for 4:2:0 */
+    c_pitch = P.width / 2;
+    if (FORMAT == YV12 || FORMAT == IYUV || FORMAT == YV1210) {
+        c_rows = rows / 2;
+        chroma_offset = mb_y * 8 * c_pitch + mb_x * 8;
+    } else {
+        c_rows = rows;
+        chroma_offset = mb_y * 16 * c_pitch + mb_x * 8;
+    }
+
+    printf("\nMB #%d (%d,%d) at pel %dx%d\n", MB, mb_x, mb_y, mb_x * 16, mb_y * 16);
+
+    if (P.diff || P.temporal) {
+        Uint32 n = rows * cols;
+        double mse = (double)P.mb_sse[MB] / n;
+        double peak = (1 << P.depth) - 1;
+
+        printf("SAD: %u SSE: %u MSE: %f PSNR: ", P.mb_sad[MB], P.mb_sse[MB], mse);
+        if (P.mb_sse[MB] == 0) {
+            printf("NaN\n");
+        } else {
+            printf("%f\n", 10.0 * log10((peak * peak) / mse));
+        }
+        mb_loop(P.temporal ? "= Y previous frame =" : "= Y =", rows, cols,
+                P.y_ref + (mb_y * 16 * P.width + mb_x * 16) * P.sample_bytes, P.width);
+        mb_loop(P.temporal ? "= Y =" : "= Y diff_file =", rows, cols,
+                P.y_cmp + (mb_y * 16 * P.width + mb_x * 16) * P.sample_bytes, P.width);
+    } else {
+        mb_loop("= Y =", rows, cols,
+                P.y_in + (mb_y * 16 * P.width + mb_x * 16) * P.sample_bytes, P.width);
+        mb_loop("= Cb =", c_rows, cols / 2, P.cb_in + chroma_offset * P.sample_bytes, c_pitch);
+        mb_loop("= Cr =", c_rows, cols / 2, P.cr_in + chroma_offset * P.sample_bytes, c_pitch);
+    }
+    if (P.sat) {
+        region_stats(mb_x * 16, mb_y * 16, mb_x * 16 + cols, mb_y * 16 + rows);
+    }
+
+    printf("\n");
+    fflush(stdout);
+}
+
+/* SAD and SSE of a w x h block, w <= 16 */
+void block_sad_sse(Uint8* a, Uint8* b, Uint32 pitch, Uint32 w, Uint32 h,
+                   Uint32* sad, Uint32* sse)
+{
+    Uint32 s = 0;
+    Uint32 e = 0;
+
+#ifdef __SSE2__
+    if (w == 16) {
+        __m128i zero = _mm_setzero_si128();
+        __m128i vsad = zero;
+        __m128i vsse = zero;
+
+        for (Uint32 i = 0; i < h; i++) {
+            __m128i va = _mm_loadu_si128((__m128i*)(a + i * pitch));
+            __m128i vb = _mm_loadu_si128((__m128i*)(b + i * pitch));
+            __m128i lo = _mm_sub_epi16(_mm_unpacklo_epi8(va, zero),
+                                       _mm_unpacklo_epi8(vb, zero));
+            __m128i hi = _mm_sub_epi16(_mm_unpackhi_epi8(va, zero),
+                                       _mm_unpackhi_epi8(vb, zero));
+
+            vsad = _mm_add_epi64(vsad, _mm_sad_epu8(va, vb));
+            vsse = _mm_add_epi32(vsse, _mm_madd_epi16(lo, lo));
+            vsse = _mm_add_epi32(vsse, _mm_madd_epi16(hi, hi));
+        }
+        vsad = _mm_add_epi64(vsad, _mm_srli_si128(vsad, 8));
+        vsse = _mm_add_epi32(vsse, _mm_srli_si128(vsse, 8));
+        vsse = _mm_add_epi32(vsse, _mm_srli_si128(vsse, 4));
+        *sad = _mm_cvtsi128_si32(vsad);
+        *sse = _mm_cvtsi128_si32(vsse);
+        return;
+    }
+#endif
+
+    for (Uint32 i = 0; i < h; i++) {
+        for (Uint32 j = 0; j < w; j++) {
+            int d = a[i * pitch + j] - b[i * pitch + j];
+            s += abs(d);
+            e += d * d;
+        }
+    }
+    *sad = s;
+    *sse = e;
+}
+
+/* SAD and SSE of a w x h block of 10 bit samples, w <= 16 */
+void block_sad_sse16(Uint16* a, Uint16* b, Uint32 pitch, Uint32 w, Uint32 h,
+                     Uint32* sad, Uint32* sse)
+{
+    Uint32 s = 0;
+    Uint32 e = 0;
+
+#ifdef __SSE2__
+    if (w == 16) {
+        __m128i ones = _mm_set1_epi16(1);
+        __m128i vsad = _mm_setzero_si128();
+        __m128i vsse = _mm_setzero_si128();
+
+        for (Uint32 i = 0; i < h; i++) {
+            for (Uint32 j = 0; j < 16; j += 8) {
+                __m128i va = _mm_loadu_si128((__m128i*)(a + i * pitch + j));
+                __m128i vb = _mm_loadu_si128((__m128i*)(b + i * pitch + j));
+                __m128i d = _mm_sub_epi16(va, vb);
+                __m128i ad = _mm_or_si128(_mm_subs_epu16(va, vb), _mm_subs_epu16(vb, va));
+
+                /* |d| <= 1023, pairs of d * d fit 32 bit */
+                vsad = _mm_add_epi32(vsad, _mm_madd_epi16(ad, ones));
+                vsse = _mm_add_epi32(vsse, _mm_madd_epi16(d, d));
+            }
+        }
+        vsad = _mm_add_epi32(vsad, _mm_srli_si128(vsad, 8));
+        vsad = _mm_add_epi32(vsad, _mm_srli_si128(vsad, 4));
+        vsse = _mm_add_epi32(vsse, _mm_srli_si128(vsse, 8));
+        vsse = _mm_add_epi32(vsse, _mm_srli_si128(vsse, 4));
+        *sad = _mm_cvtsi128_si32(vsad);
+        *sse = _mm_cvtsi128_si32(vsse);
+        return;
+    }
+#endif
+
+    for (Uint32 i = 0; i < h; i++) {
+        for (Uint32 j = 0; j < w; j++) {
+            int d = a[i * pitch + j] - b[i * pitch + j];
+            s += abs(d);
+            e += d * d;
+        }
+    }
+    *sad = s;
+    *sse = e;
+}
+
+/* luma SAD/SSE for every MB, aligned with the 16x16 grid */
+void mb_errors(Uint8* frame0, Uint8* frame1)
+{
+    for (Uint32 mb_y = 0; mb_y < P.mb_rows; mb_y++) {
+        Uint32 h = P.height - mb_y * 16 < 16 ? P.height - mb_y * 16 : 16;
+
+        for (Uint32 mb_x = 0; mb_x < P.mb_cols; mb_x++) {
+            Uint32 w = P.width - mb_x * 16 < 16 ? P.width - mb_x * 16 : 16;
+            Uint32 offset = mb_y * 16 * P.width + mb_x * 16;
+            Uint32 MB = mb_y * P.mb_cols + mb_x;
+
+            if (P.sample_bytes == 2) {
+                block_sad_sse16((Uint16*)frame0 + offset, (Uint16*)frame1 + offset,
+                                P.width, w, h, &P.mb_sad[MB], &P.mb_sse[MB]);
+            } else {
+                block_sad_sse(frame0 + offset, frame1 + offset, P.width, w, h,
+                              &P.mb_sad[MB], &P.mb_sse[MB]);
+            }
+        }
+    }
+}
+
+/* Tint each MB by its mean absolute error: untouched blocks stay grey,
+ * errors go from blue-ish to red, saturating at an average of 32 */
+void draw_heatmap(void)
+{
+    if (!(P.diff || P.temporal) || !P.heatmap) {
+        return;
+    }
+
+    for (Uint32 mb_y = 0; mb_y < P.mb_rows; mb_y++) {
+        Uint32 h = P.height - mb_y * 16 < 16 ? P.height - mb_y * 16 : 16;
+
+        for (Uint32 mb_x = 0; mb_x < P.mb_cols; mb_x++) {
+            Uint32 w = P.width - mb_x * 16 < 16 ? P.width - mb_x * 16 : 16;
+            Uint32 MB = mb_y * P.mb_cols + mb_x;
+            Uint32 level = (P.mb_sad[MB] * 8 / (w * h)) >> (P.depth - 8);
+            Uint8 u, v;
+
+            if (level > 255) {
+                level = 255;
+            }
+            if (level == 0) {
+                continue;
+            }
+            u = 0x80 + 0x40 - level / 2;
+            v = 0x80 + level / 2;
+
+            if (FORMAT == YV12 || FORMAT == IYUV || FORMAT == YV1210) {
+                /* overlay planes follow file order: YV12 is Y V U */
+                Uint8* pu = my_overlay->pixels[FORMAT == IYUV ? 1 : 2];
+                Uint8* pv = my_overlay->pixels[FORMAT == IYUV ? 2 : 1];
+                Uint32 pitch = my_overlay->pitches[1];
+
+                for (Uint32 i = mb_y * 8; i < mb_y * 8 + h / 2; i++) {
+                    for (Uint32 j = mb_x * 8; j < mb_x * 8 + w / 2; j++) {
+                        pu[i * pitch + j] = u;
+                        pv[i * pitch + j] = v;
+                    }
+                }
+            } else {
+                Uint8* p = my_overlay->pixels[0];
+                Uint32 pitch = my_overlay->pitches[0];
+
+                for (Uint32 i = mb_y * 16; i < mb_y * 16 + h; i++) {
+                    for (Uint32 j = mb_x * 32; j < mb_x * 32 + w * 2; j += 4) {
+                        p[i * pitch + j + P.cb_start_pos] = u;
+                        p[i * pitch + j + P.cr_start_pos] = v;
+                    }
+                }
+            }
+        }
+    }
+}
+
+Uint32 (*reader[])(void) = {read_yv12, read_iyuv, read_422, read_422, read_422, read_10bit, read_10bit};
+void (*drawer[])(void) = {draw_420, draw_420, draw_422, draw_422, draw_422, draw_420, draw_422};
+
+void draw_frame(void)
+{
+    if (P.no_display) {
+        return;
+    }
+
+    /* the back overlay is free once the UI thread has presented the
+     * previous frame; the frame data itself is already read by now */
+    while (SDL_SemWaitTimeout(R.back_free, 100) == SDL_MUTEX_TIMEDOUT) {
+        if (__atomic_load_n(&R.quit, __ATOMIC_ACQUIRE)) {
+            return;
+        }
+    }
+
+    if (P.artifacts) {
+        frame_artifacts();
+    }
+    display_planes();
+    set_zoom_rect();
+#ifndef USE_SDL2
+    /* an SDL2 texture is already locked by the UI thread */
+    lock_overlay(R.overlay[R.back]);
+#endif
+    if (P.scaler != SCALE_SDL && stage_overlay()) {
+        my_overlay = SC.stage;
+        (*drawer[FORMAT])();
+        scale_frame(R.overlay[R.back]);
+    } else {
+        my_overlay = R.overlay[R.back];
+        (*drawer[FORMAT])();
+    }
+#ifndef USE_SDL2
+    SDL_UnlockYUVOverlay(R.overlay[R.back]);
+#endif
+    post_event(EV_PRESENT, R.overlay[R.back], NULL);
+    R.back ^= 1;
+    SES.drawn++;
+}
+
+/* next frame of the clip from the preload or the file */
+Uint32 fetch_frame(void)
+{
+    Uint32 f = P.next_frame;
+
+    if (PRE.data && f >= PRE.first && f < PRE.first + PRE.count) {
+        Uint8* src = PRE.data + (Uint64)(f - PRE.first) * PRE.frame_bytes;
+        Uint32 sb = P.sample_bytes;
+
+        memcpy(P.y_in, src, P.y_size * sb);
+        src += P.y_size * sb;
+        memcpy(P.cb_in, src, P.cb_size * sb);
+        src += P.cb_size * sb;
+        memcpy(P.cr_in, src, P.cr_size * sb);
+        src += P.cr_size * sb;
+        if (PRE.frame_bytes > (P.y_size + P.cb_size + P.cr_size) * sb) {
+            memcpy(P.raw, src, P.frame_size);
+        }
+        PRE.stale = 1;
+        /* the diff file is read next, from frame f */
+        if (P.diff && fseeko(P.fd2, frame_offset(1, f), SEEK_SET)) {
+            perror("fseeko");
+            return 0;
+        }
+        if (P.sat) {
+            sat_frame(P.y_in, P.cb_in, P.cr_in);
+        }
+        return 1;
+    }
+
+    /* Y4M frames are not back to back, FRAME headers in between */
+    if ((PRE.stale || P.index[0].offset || P.index[1].offset) && !seek_frame(f)) {
+        return 0;
+    }
+    if (!(*reader[FORMAT])()) {
+        return 0;
+    }
+    /* of the input, before diff-mode reads the diff file into the planes */
+    if (P.sat) {
+        sat_frame(P.y_in, P.cb_in, P.cr_in);
+    }
+    return 1;
+}
+
+void preload_free(void)
+{
+    if (PRE.data) {
+        munmap(PRE.data, PRE.bytes);
+    }
+    PRE.data = NULL;
+    PRE.count = 0;
+}
+
+/* Read frames first..last into locked memory, huge pages if the system
+ * has them reserved, transparent huge pages otherwise */
+Uint32 preload(Uint32 first, Uint32 last)
+{
+    /* 8 bpp packed formats keep the interleaved frame as well */
+    Uint32 sb = P.sample_bytes;
+    Uint32 packed = sb == 1 && !(FORMAT == YV12 || FORMAT == IYUV);
+    Uint32 frame_bytes = (P.y_size + P.cb_size + P.cr_size) * sb + (packed ? P.frame_size : 0);
+    Uint32 count = last - first + 1;
+    Uint64 bytes = (Uint64)count * frame_bytes;
+    Uint64 huge = 2 << 20;
+    Uint32 next = P.next_frame;
+    Uint8* data;
+    double t;
+
+    if (bytes > (Uint64)P.preload_mb << 20) {
+        fprintf(stderr, "Preloading frames %u-%u needs %.0f MB, budget is %u MB\n",
+                first, last, bytes / 1048576.0, P.preload_mb);
+        return 0;
+    }
+
+    preload_free();
+    PRE.stale = 0;
+    bytes = (bytes + huge - 1) / huge * huge;
+    data = mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (data == MAP_FAILED) {
+        data = mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (data == MAP_FAILED) {
+            fprintf(stderr, "Error allocating memory...\n");
+            return 0;
+        }
+        madvise(data, bytes, MADV_HUGEPAGE);
+    }
+    if (mlock(data, bytes)) {
+        fprintf(stderr, "Could not lock preload memory (%s), continuing unlocked\n",
+                strerror(errno));
+    }
+
+    t = now();
+    for (Uint32 i = 0; i < count; i++) {
+        Uint8* dst = data + (Uint64)i * frame_bytes;
+
+        if ((i == 0 || P.index[0].offset) && !seek_frame(first + i)) {
+            munmap(data, bytes);
+            return 0;
+        }
+        if (!(*reader[FORMAT])()) {
+            munmap(data, bytes);
+            return 0;
+        }
+        memcpy(dst, P.y_in, P.y_size * sb);
+        dst += P.y_size * sb;
+        memcpy(dst, P.cb_in, P.cb_size * sb);
+        dst += P.cb_size * sb;
+        memcpy(dst, P.cr_in, P.cr_size * sb);
+        dst += P.cr_size * sb;
+        if (packed) {
+            memcpy(dst, P.raw, P.frame_size);
+        }
+    }
+    t = now() - t;
+
+    PRE.data = data;
+    PRE.bytes = bytes;
+    PRE.first = first;
+    PRE.count = count;
+    PRE.frame_bytes = frame_bytes;
+    PRE.stale = 1;
+    P.next_frame = next;
+
+    fprintf(stdout, "Preloaded frames %u-%u (%.1f MB) in %.2f s\n", first, last,
+            (double)count * frame_bytes / 1048576.0, t);
+    fflush(stdout);
+    return 1;
+}
+
+/* '[' and ']': A and B marker at the current frame */
+void set_marker(Uint32 b)
+{
+    if (!R.frame) {
+        return;
+    }
+    if (b) {
+        P.mark_b = R.frame;
+    } else {
+        P.mark_a = R.frame;
+    }
+    fprintf(stdout, "Marker %c at frame %u\n", b ? 'B' : 'A', R.frame - 1);
+    fflush(stdout);
+}
+
+/* 'l': loop A-B (or the clip), preloading the range if allowed */
+void toggle_loop(void)
+{
+    Uint32 a, b;
+
+    P.loop = ~P.loop;
+    if (!P.loop) {
+        return;
+    }
+
+    a = P.mark_a ? P.mark_a - 1 : 0;
+    b = P.mark_b ? P.mark_b - 1 : P.num_frames - 1;
+    if (a > b) {
+        Uint32 tmp = a;
+        a = b;
+        b = tmp;
+    }
+    P.loop_a = a;
+    P.loop_b = b;
+
+    if (P.preload_mb && (a < PRE.first || b >= PRE.first + PRE.count || !PRE.data)) {
+        preload(a, b);
+        /* the display buffers were used for loading */
+        if (R.frame && seek_frame(R.frame - 1)) {
+            read_frame();
+        }
+    }
+}
+
+/* wrap a play target into the loop, or leave it alone. Playback that
+ * starts outside runs into the loop first, it wraps only at the end it
+ * plays towards. */
+Sint64 loop_target(Sint64 target)
+{
+    if (!P.loop) {
+        return target;
+    }
+    if (P.speed >= 0 && target > P.loop_b) {
+        return P.loop_a;
+    }
+    if (P.speed < 0 && target < P.loop_a) {
+        return P.loop_b;
+    }
+    return target;
+}
+
+Uint32 read_frame(void)
+{
+    Uint32 ret;
+
+    if (P.temporal) {
+        ret = temporal_mode();
+    } else if (!P.diff) {
+        ret = fetch_frame();
+    } else {
+        ret = diff_mode();
+    }
+    if (ret) {
+        P.next_frame++;
+    }
+    return ret;
+}
+
+/* display frame (zero based), used for trick play and slaves */
+Uint32 goto_frame(Uint32 frame)
+{
+    if (frame >= P.num_frames) {
+        return 0;
+    }
+    if (!seek_frame(frame) || !read_frame()) {
+        return 0;
+    }
+    draw_frame();
+    return 1;
+}
+
+Uint32 diff_mode(void)
+{
+    FILE* fd_tmp;
+
+    /* Perhaps a bit ugly but it seams to work...
+     * 1. read frame from fd
+     * 2. store data away
+     * 3. read frame from P.fd2
+     * 4. calculate diff
+     * 5. place result in P.raw or P.y_data depending on FORMAT
+     * 6. diff works on luma data so clear P.cb_data and P.cr_data
+     * Fiddle with the file descriptors so that we read
+     * from correct file.
+     */
+
+    if (!fetch_frame()) {
+        return 0;
+    }
+
+    memcpy(P.y_ref, P.y_in, P.y_size * P.sample_bytes);
+    memcpy(P.cb_ref, P.cb_in, P.cb_size * P.sample_bytes);
+    memcpy(P.cr_ref, P.cr_in, P.cr_size * P.sample_bytes);
+
+    fd_tmp = fd;
+    fd = P.fd2;
+
+    if (!(*reader[FORMAT])()) {
+        fd = fd_tmp;
+        return 0;
+    }
+
+    /* restore file descriptor */
+    fd = fd_tmp;
+
+    /* now, P.y_in contains luminance data for fd2 and
+     * P.y_ref contains luma data for fd.
+     * Calculate diff and place result where it belongs
+     * Clear croma data */
+
+    memcpy(P.y_cmp, P.y_in, P.y_size * P.sample_bytes);
+    calc_psnr(P.y_ref, P.y_cmp);
+    show_diff();
+
+    return 1;
+}
+
+/* Frame N against N-1 of the same clip. The luma of the last frame read
+ * stays in P.y_prev, so playback reads every frame once; only after a
+ * seek is N-1 read again. */
+Uint32 temporal_mode(void)
+{
+    Uint32 cur = P.next_frame;
+    Uint64 sad = 0;
+
+    if (cur > 0 && P.prev_frame != cur) {
+        if (!seek_frame(cur - 1) || !fetch_frame()) {
+            return 0;
+        }
+        memcpy(P.y_prev, P.y_in, P.y_size * P.sample_bytes);
+        P.next_frame = cur;
+    }
+
+    if (!fetch_frame()) {
+        P.prev_frame = 0;
+        return 0;
+    }
+
+    /* the first frame has nothing before it, compare it to itself */
+    memcpy(P.y_ref, cur > 0 ? P.y_prev : P.y_in, P.y_size * P.sample_bytes);
+    memcpy(P.y_cmp, P.y_in, P.y_size * P.sample_bytes);
+    memcpy(P.y_prev, P.y_in, P.y_size * P.sample_bytes);
+    memcpy(P.cb_ref, P.cb_in, P.cb_size * P.sample_bytes);
+    memcpy(P.cr_ref, P.cr_in, P.cr_size * P.sample_bytes);
+    P.prev_frame = cur + 1;
+
+    show_diff();
+
+    for (Uint32 i = 0; i < P.mb_cols * P.mb_rows; i++) {
+        sad += P.mb_sad[i];
+    }
+    fprintf(stdout, "Frame %u motion energy: %.3f\n", cur, (double)sad / P.y_size);
+    return 1;
+}
+
+/* 0x80 - (ref - cmp), wrapping like the scalar version always did */
+void diff_luma(Uint8* ref, Uint8* cmp, Uint8* dst, Uint32 n)
+{
+    Uint32 i = 0;
+
+#ifdef __SSE2__
+    __m128i mid = _mm_set1_epi8((char)0x80);
+
+    for (; i + 16 <= n; i += 16) {
+        __m128i a = _mm_loadu_si128((__m128i*)(ref + i));
+        __m128i b = _mm_loadu_si128((__m128i*)(cmp + i));
+
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_add_epi8(_mm_sub_epi8(b, a), mid));
+    }
+#endif
+
+    for (; i < n; i++) {
+        dst[i] = 0x80 - (ref[i] - cmp[i]);
+    }
+}
+
+/* 0x80 + (cmp - ref) for 10 bit samples, saturated instead of wrapped
+ * since native differences easily leave the 8 bit range */
+void diff_luma16(Uint16* ref, Uint16* cmp, Uint8* dst, Uint32 n)
+{
+    Uint32 i = 0;
+
+#ifdef __SSE2__
+    __m128i mid = _mm_set1_epi16(0x80);
+
+    for (; i + 16 <= n; i += 16) {
+        __m128i d0 = _mm_sub_epi16(_mm_loadu_si128((__m128i*)(cmp + i)),
+                                   _mm_loadu_si128((__m128i*)(ref + i)));
+        __m128i d1 = _mm_sub_epi16(_mm_loadu_si128((__m128i*)(cmp + i + 8)),
+                                   _mm_loadu_si128((__m128i*)(ref + i + 8)));
+
+        _mm_storeu_si128((__m128i*)(dst + i),
+                         _mm_packus_epi16(_mm_add_epi16(d0, mid), _mm_add_epi16(d1, mid)));
+    }
+#endif
+
+    for (; i < n; i++) {
+        int d = 0x80 + cmp[i] - ref[i];
+        dst[i] = d < 0 ? 0 : d > 255 ? 255 : d;
+    }
+}
+
+/* diff of P.y_ref and P.y_cmp to the display buffers, grey chroma */
+void show_diff(void)
+{
+    mb_errors(P.y_ref, P.y_cmp);
+    if (P.sample_bytes == 2) {
+        diff_luma16((Uint16*)P.y_ref, (Uint16*)P.y_cmp, P.y_data, P.y_size);
+    } else {
+        diff_luma(P.y_ref, P.y_cmp, P.y_data, P.y_size);
+    }
+
+    if (FORMAT == YV12 || FORMAT == IYUV || FORMAT == YV1210) {
+        for (Uint32 i = 0; i < P.cb_size; i++) P.cb_data[i] = 0x80;
+        for (Uint32 i = 0; i < P.cr_size; i++) P.cr_data[i] = 0x80;
+    } else {
+        Uint32 j = 0;
+        for (Uint32 i = P.y_start_pos; i < P.frame_size; i += 2) {
+            P.raw[i] = P.y_data[j];
+            j++;
+        }
+        for (Uint32 i = P.cb_start_pos; i < P.frame_size; i += 4)  P.raw[i] = 0x80;
+        for (Uint32 i = P.cr_start_pos; i < P.frame_size; i += 4)  P.raw[i] = 0x80;
+        for (Uint32 i = 0; i < P.cb_size; i++) P.cb_data[i] = 0x80;
+        for (Uint32 i = 0; i < P.cr_size; i++) P.cr_data[i] = 0x80;
+    }
+}
+
+void calc_psnr(Uint8* frame0, Uint8* frame1)
+{
+    double psnr = luma_psnr(frame0, frame1);
+
+    /* division by zero */
+    if (isinf(psnr)) {
+        fprintf(stdout, "PSNR: NaN\n");
+        return;
+    }
+
+    fprintf(stdout, "PSNR: %f\n", psnr);
+}
+
+/* sum of squared differences of two 10 bit planes */
+Uint64 plane_sse16(Uint16* a, Uint16* b, Uint32 n)
+{
+    Uint64 sse = 0;
+    Uint32 i = 0;
+
+#ifdef __SSE2__
+    while (i + 8 <= n) {
+        __m128i acc = _mm_setzero_si128();
+        Uint32 lanes[4];
+
+        /* a lane gains at most 2 * 1023^2 per step, flush to 64 bit
+         * well before it can overflow */
+        for (Uint32 k = 0; k < 512 && i + 8 <= n; k++, i += 8) {
+            __m128i d = _mm_sub_epi16(_mm_loadu_si128((__m128i*)(a + i)),
+                                      _mm_loadu_si128((__m128i*)(b + i)));
+            acc = _mm_add_epi32(acc, _mm_madd_epi16(d, d));
+        }
+        _mm_storeu_si128((__m128i*)lanes, acc);
+        sse += (Uint64)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    }
+#endif
+
+    for (; i < n; i++) {
+        int d = a[i] - b[i];
+        sse += d * d;
+    }
+    return sse;
+}
+
+/* INFINITY for identical frames */
+double luma_psnr(Uint8* frame0, Uint8* frame1)
+{
+    double mse = 0.0;
+    double mse_tmp = 0.0;
+
+    /* peak 2^depth - 1, as in show_mb() and sse_psnr() */
+    if (P.sample_bytes == 2) {
+        double peak = (1 << P.depth) - 1;
+
+        mse = plane_sse16((Uint16*)frame0, (Uint16*)frame1, P.y_size);
+        if (mse == 0) {
+            return INFINITY;
+        }
+        return 10.0 * log10(peak * peak / (mse / P.y_size));
+    }
+
+    for (Uint32 i = 0; i < P.y_size; i++) {
+        mse_tmp = abs(frame0[i] - frame1[i]);
+        mse += mse_tmp * mse_tmp;
+    }
+
+    if (mse == 0) {
+        return INFINITY;
+    }
+
+    mse /= P.y_size;
+
+    return 10.0*log10((255 * 255) / mse);
+}
+
+void histogram(void)
+{
+    if (!P.hist) {
+        return;
+    }
+
+    Uint32 y[1024];
+    Uint32 b[1024];
+    Uint32 r[1024];
+    Uint32 bins = 256;
+
+    /* 10 bpp counts the samples as read, diffs are 8 bit */
+    if (P.depth > 8 && !P.diff && !P.temporal) {
+        bins = 1 << P.depth;
+        plane_histogram16((Uint16*)P.y_in, P.y_size, y);
+        plane_histogram16((Uint16*)P.cb_in, P.cb_size, b);
+        plane_histogram16((Uint16*)P.cr_in, P.cr_size, r);
+    } else {
+        plane_histogram(P.y_data, P.y_size, y);
+        plane_histogram(P.cb_data, P.cb_size, b);
+        plane_histogram(P.cr_data, P.cr_size, r);
+    }
+
+    fprintf(stdout, "\nY,");
+    for (Uint32 i = 0; i < bins; i++)  fprintf(stdout, "%u,", y[i]);
+    fprintf(stdout, "\nCb,");
+    for (Uint32 i = 0; i < bins; i++)  fprintf(stdout, "%u,", b[i]);
+    fprintf(stdout, "\nCr,");
+    for (Uint32 i = 0; i < bins; i++)  fprintf(stdout, "%u,", r[i]);
+    fprintf(stdout, "\n");
+    fflush(stdout);
+}
+
+void plane_histogram(Uint8* data, Uint32 size, Uint32* counts)
+{
+    memset(counts, 0, sizeof(Uint32) * 256);
+    for (Uint32 i = 0; i < size; i++) {
+        counts[data[i]]++;
+    }
+}
+
+/* 1024 bins, out of range samples land in the last one. Runs of equal
+ * samples are common, four tables keep the increments independent */
+void plane_histogram16(Uint16* data, Uint32 size, Uint32* counts)
+{
+    Uint32 sub[4][1024] = {{0}};
+    Uint32 i = 0;
+
+    for (; i + 4 <= size; i += 4) {
+        sub[0][data[i] > 1023 ? 1023 : data[i]]++;
+        sub[1][data[i + 1] > 1023 ? 1023 : data[i + 1]]++;
+        sub[2][data[i + 2] > 1023 ? 1023 : data[i + 2]]++;
+        sub[3][data[i + 3] > 1023 ? 1023 : data[i + 3]]++;
+    }
+    for (; i < size; i++) {
+        sub[0][data[i] > 1023 ? 1023 : data[i]]++;
+    }
+    for (Uint32 j = 0; j < 1024; j++) {
+        counts[j] = sub[0][j] + sub[1][j] + sub[2][j] + sub[3][j];
+    }
+}
+
+/* 10 bit sample to displayed 8 bit, see BITS_* */
+void bits_lut(Uint8* lut, Uint32 mode)
+{
+    for (Uint32 x = 0; x < 1024; x++) {
+        switch (mode)
+        {
+            case BITS_MID:
+                lut[x] = (x >> 1) & 0xFF;
+                break;
+            case BITS_LOW:
+                lut[x] = x & 0xFF;
+                break;
+            default:
+                /* same as ten2eight() */
+                lut[x] = (x + 2) >> 2 > 255 ? 255 : (x + 2) >> 2;
+                break;
+        }
+    }
+}
+
+/* luma range between the 0.5 and 99.5 percentile spread over 0..255 */
+void stretch_lut(Uint8* lut)
+{
+    Uint32 counts[1024];
+    Uint32 cut = P.y_size / 200;
+    Uint32 lo = 0;
+    Uint32 hi = 1023;
+    Uint32 sum = 0;
+
+    plane_histogram16((Uint16*)P.y_in, P.y_size, counts);
+    for (sum = 0; lo < 1023 && sum + counts[lo] <= cut; lo++) {
+        sum += counts[lo];
+    }
+    for (sum = 0; hi > lo && sum + counts[hi] <= cut; hi--) {
+        sum += counts[hi];
+    }
+    if (hi == lo) {
+        hi = lo + 1;
+    }
+
+    for (Uint32 x = 0; x < 1024; x++) {
+        if (x <= lo) {
+            lut[x] = 0;
+        } else if (x >= hi) {
+            lut[x] = 255;
+        } else {
+            lut[x] = ((x - lo) * 255 + (hi - lo) / 2) / (hi - lo);
+        }
+    }
+}
+
+void to_display(Uint16* src, Uint8* dst, Uint32 n, Uint8* lut)
+{
+    for (Uint32 i = 0; i < n; i++) {
+        dst[i] = lut[src[i] > 1023 ? 1023 : src[i]];
+    }
+}
+
+/* 8 bit planes (and YVYU for Y42210) of the 10 bit frame for drawing.
+ * Diff-mode and temporal diff write their own 8 bit result */
+void display_planes(void)
+{
+    Uint8 lut[1024];
+    Uint8 luma[1024];
+
+    if (P.depth == 8 || P.diff || P.temporal) {
+        return;
+    }
+
+    bits_lut(lut, P.bits == BITS_STRETCH ? BITS_ROUND : P.bits);
+    if (P.bits == BITS_STRETCH) {
+        stretch_lut(luma);
+    } else {
+        memcpy(luma, lut, sizeof(luma));
+    }
+    to_display((Uint16*)P.y_in, P.y_data, P.y_size, luma);
+    to_display((Uint16*)P.cb_in, P.cb_data, P.cb_size, lut);
+    to_display((Uint16*)P.cr_in, P.cr_data, P.cr_size, lut);
+
+    if (FORMAT == Y42210) {
+        for (Uint32 i = P.y_start_pos, j = 0; i < P.frame_size; i += 2) {
+            P.raw[i] = P.y_data[j++];
+        }
+        for (Uint32 i = P.cb_start_pos, j = 0; i < P.frame_size; i += 4) {
+            P.raw[i] = P.cb_data[j++];
+        }
+        for (Uint32 i = P.cr_start_pos, j = 0; i < P.frame_size; i += 4) {
+            P.raw[i] = P.cr_data[j++];
+        }
+    }
+}
+
+Uint32 scope_alloc(void)
+{
+    Uint32 workers = POOL.count > 1 ? POOL.count : 1;
+    Uint32 vs = P.depth > 8 ? 512 : 256;
+
+    if (SCOPE.y) {
+        return 1;
+    }
+
+    SCOPE.bins = malloc(sizeof(Uint32) * P.wh);
+    SCOPE.vbins = malloc(sizeof(Uint32) * vs * vs * workers);
+    SCOPE.vshade = malloc(vs * vs);
+    SCOPE.cb = malloc(P.wh / 2);
+    SCOPE.cr = malloc(P.wh / 2);
+    SCOPE.rgb = malloc((size_t)P.width * 3 * workers);
+    SCOPE.col = malloc(sizeof(Uint16) * P.width);
+    SCOPE.y = malloc(P.wh);
+    if (!SCOPE.bins || !SCOPE.vbins || !SCOPE.vshade || !SCOPE.cb || !SCOPE.cr ||
+        !SCOPE.rgb || !SCOPE.col || !SCOPE.y) {
+        fprintf(stderr, "Error allocating memory...\n");
+        free(SCOPE.bins);
+        free(SCOPE.vbins);
+        free(SCOPE.vshade);
+        free(SCOPE.cb);
+        free(SCOPE.cr);
+        free(SCOPE.rgb);
+        free(SCOPE.col);
+        free(SCOPE.y);
+        memset(&SCOPE, 0, sizeof(SCOPE));
+        return 0;
+    }
+    return 1;
+}
+
+/* waveform row of every sample value, max at the top */
+void scope_rows(Uint32 max, Uint32 height)
+{
+    SCOPE.max = max;
+    for (Uint32 v = 0; v < 1024; v++) {
+        SCOPE.row[v] = v > max ? 0 : (max - v) * (height - 1) / max;
+    }
+}
+
+/* Counts to luma: 16 where empty, 40..235 otherwise. avg is the count
+ * a typical lit bin gets, it is shown at a quarter of the range */
+void scope_shade(Uint32* counts, Uint8* dst, Uint32 n, Uint32 avg)
+{
+    Uint32 gain = 195 * 256 / (4 * avg);
+    Uint32 i = 0;
+
+    if (gain == 0) {
+        gain = 1;
+    }
+
+#ifdef __SSE2__
+    __m128i zero = _mm_setzero_si128();
+    __m128i g = _mm_set1_epi32(gain);
+    __m128i top = _mm_set1_epi16(195);
+    __m128i base = _mm_set1_epi16(40);
+    __m128i empty = _mm_set1_epi16(16);
+
+    for (; i + 8 <= n; i += 8) {
+        /* counts saturate at 32767, (count, 0) * (gain, 0) in pmaddwd */
+        __m128i c = _mm_packs_epi32(_mm_loadu_si128((__m128i*)(counts + i)),
+                                    _mm_loadu_si128((__m128i*)(counts + i + 4)));
+        __m128i lo = _mm_srli_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(c, zero), g), 8);
+        __m128i hi = _mm_srli_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(c, zero), g), 8);
+        __m128i v = _mm_add_epi16(_mm_min_epi16(_mm_packs_epi32(lo, hi), top), base);
+        __m128i none = _mm_cmpeq_epi16(c, zero);
+
+        v = _mm_or_si128(_mm_and_si128(none, empty), _mm_andnot_si128(none, v));
+        _mm_storel_epi64((__m128i*)(dst + i), _mm_packus_epi16(v, v));
+    }
+#endif
+
+    for (; i < n; i++) {
+        Uint32 c = counts[i] > 32767 ? 32767 : counts[i];
+        Uint32 v = c * gain >> 8;
+
+        dst[i] = c ? 40 + (v > 195 ? 195 : v) : 16;
+    }
+}
+
+/* Binning on all workers. The waveforms split the output columns, so
+ * no two workers count into the same bin, and go down the frame in
+ * strips of SCOPE_STRIP columns to keep the bins touched in cache. The
+ * vectorscope splits the samples and every worker counts into its own
+ * table, merged after */
+void scope_job(void* arg, Uint32 index, Uint32 count)
+{
+    Uint32 w = P.width;
+    Uint32 h = P.height;
+    Uint32 planar = FORMAT == YV12 || FORMAT == IYUV || FORMAT == YV1210;
+    /* YV12 keeps Cr first, so cb_data holds Cr there */
+    Uint32 swap = FORMAT == YV12 || FORMAT == YV1210;
+    Uint32 native = P.depth > 8 && !P.diff && !P.temporal;
+    Uint32 vs = SCOPE.vsize;
+
+    (void)arg;
+
+    if (SCOPE.phase == SCOPE_MERGE) {
+        Uint32 i0 = vs * vs / count * index;
+        Uint32 i1 = index == count - 1 ? vs * vs : vs * vs / count * (index + 1);
+
+        for (Uint32 t = 1; t < SCOPE.tables; t++) {
+            Uint32* src = SCOPE.vbins + t * vs * vs;
+
+            for (Uint32 i = i0; i < i1; i++) {
+                SCOPE.vbins[i] += src[i];
+            }
+        }
+        return;
+    }
+
+    if (P.scope == SCOPE_VECTOR) {
+        Uint32* table = SCOPE.vbins + index * vs * vs;
+        Uint32 i0 = (Uint64)P.cb_size * index / count;
+        Uint32 i1 = (Uint64)P.cb_size * (index + 1) / count;
+
+        memset(table, 0, sizeof(Uint32) * vs * vs);
+        if (native) {
+            Uint16* cb = (Uint16*)(swap ? P.cr_in : P.cb_in);
+            Uint16* cr = (Uint16*)(swap ? P.cb_in : P.cr_in);
+            Uint32 shift = P.depth - 9;
+
+            for (Uint32 i = i0; i < i1; i++) {
+                Uint32 u = cb[i] > 1023 ? 1023 : cb[i];
+                Uint32 v = cr[i] > 1023 ? 1023 : cr[i];
+
+                table[(v >> shift) * vs + (u >> shift)]++;
+            }
+        } else {
+            Uint8* cb = swap ? P.cr_data : P.cb_data;
+            Uint8* cr = swap ? P.cb_data : P.cr_data;
+
+            for (Uint32 i = i0; i < i1; i++) {
+                table[cr[i] * vs + cb[i]]++;
+            }
+        }
+    } else if (P.scope == SCOPE_PARADE) {
+        Uint32 pw = w / 3;
+        Uint32 o0 = pw * index / count;
+        Uint32 o1 = pw * (index + 1) / count;
+        /* source columns x with x * pw / w in [o0, o1) */
+        Uint8* rgb = SCOPE.rgb + index * w * 3;
+        Uint8* cb = swap ? P.cr_data : P.cb_data;
+        Uint8* cr = swap ? P.cb_data : P.cr_data;
+
+        for (Uint32 y = 0; y < h; y++) {
+            for (Uint32 c = 0; c < 3; c++) {
+                memset(SCOPE.bins + y * w + c * pw + o0, 0, sizeof(Uint32) * (o1 - o0));
+            }
+            if (index == count - 1) {
+                memset(SCOPE.bins + y * w + 3 * pw, 0, sizeof(Uint32) * (w - 3 * pw));
+            }
+        }
+        for (Uint32 s0 = o0; s0 < o1; s0 += SCOPE_STRIP) {
+            Uint32 s1 = s0 + SCOPE_STRIP < o1 ? s0 + SCOPE_STRIP : o1;
+            Uint32 sx0 = (s0 * w + pw - 1) / pw;
+            Uint32 sx1 = (s1 * w + pw - 1) / pw;
+            Uint32 sxa = sx0 & ~1u;
+
+            for (Uint32 y = 0; y < h && sx0 < sx1; y++) {
+                Uint32 crow = planar ? y / 2 : y;
+
+                yuv2rgb_row(P.y_data + y * w + sxa, cb + crow * (w / 2) + sxa / 2,
+                            cr + crow * (w / 2) + sxa / 2, rgb, sx1 - sxa, SCOPE.coef);
+                for (Uint32 x = sx0; x < sx1; x++) {
+                    Uint32 o = SCOPE.col[x];
+                    Uint8* px = rgb + (x - sxa) * 3;
+
+                    SCOPE.bins[SCOPE.row[px[0]] * w + o]++;
+                    SCOPE.bins[SCOPE.row[px[1]] * w + pw + o]++;
+                    SCOPE.bins[SCOPE.row[px[2]] * w + 2 * pw + o]++;
+                }
+            }
+        }
+    } else {
+        Uint32 x0 = w * index / count;
+        Uint32 x1 = w * (index + 1) / count;
+
+        for (Uint32 y = 0; y < h; y++) {
+            memset(SCOPE.bins + y * w + x0, 0, sizeof(Uint32) * (x1 - x0));
+        }
+        for (Uint32 s0 = x0; s0 < x1; s0 += SCOPE_STRIP) {
+            Uint32 s1 = s0 + SCOPE_STRIP < x1 ? s0 + SCOPE_STRIP : x1;
+
+            for (Uint32 y = 0; y < h; y++) {
+                if (native) {
+                    Uint16* src = (Uint16*)P.y_in + y * w;
+
+                    for (Uint32 x = s0; x < s1; x++) {
+                        SCOPE.bins[SCOPE.row[src[x] > 1023 ? 1023 : src[x]] * w + x]++;
+                    }
+                } else {
+                    Uint8* src = P.y_data + y * w;
+
+                    for (Uint32 x = s0; x < s1; x++) {
+                        SCOPE.bins[SCOPE.row[src[x]] * w + x]++;
+                    }
+                }
+            }
+        }
+    }
+}
+
+/* legal range on the waveforms, axes and 75% bar targets on the
+ * vectorscope; drawn only where there is no trace */
+void scope_graticule(void)
+{
+    Uint32 w = P.width;
+    Uint32 side = P.width < P.height ? P.width : P.height;
+    Uint32 left = (P.width - side) / 2;
+    Uint32 top = (P.height - side) / 2;
+
+    if (P.scope != SCOPE_VECTOR) {
+        Uint32 shift = SCOPE.max > 255 ? P.depth - 8 : 0;
+        Uint32 rows[2] = {SCOPE.row[16 << shift], SCOPE.row[235 << shift]};
+
+        for (Uint32 i = 0; i < 2; i++) {
+            for (Uint32 x = 0; x < w; x += 2) {
+                if (SCOPE.y[rows[i] * w + x] == 16) {
+                    SCOPE.y[rows[i] * w + x] = 0x50;
+                }
+            }
+        }
+        return;
+    }
+
+    for (Uint32 i = 0; i < side; i += 2) {
+        Uint32 pos[2] = {(top + side / 2) * w + left + i, (top + i) * w + left + side / 2};
+
+        for (Uint32 j = 0; j < 2; j++) {
+            if (SCOPE.y[pos[j]] == 16) {
+                SCOPE.y[pos[j]] = 0x50;
+            }
+        }
+    }
+
+    {
+        const double kr[3] = {0.299, 0.2126, 0.2627};
+        const double kb[3] = {0.114, 0.0722, 0.0593};
+        /* R, Yl, G, Cy, B, Mg */
+        const double bars[6][3] = {{1, 0, 0}, {1, 1, 0}, {0, 1, 0},
+                                   {0, 1, 1}, {0, 0, 1}, {1, 0, 1}};
+        double r = kr[P.matrix];
+        double b = kb[P.matrix];
+        double cs = P.full_range ? 255.0 : 224.0;
+
+        for (Uint32 i = 0; i < 6; i++) {
+            double y = 0.75 * (r * bars[i][0] + (1 - r - b) * bars[i][1] + b * bars[i][2]);
+            double u = 128 + cs * (0.75 * bars[i][2] - y) / (2 * (1 - b));
+            double v = 128 + cs * (0.75 * bars[i][0] - y) / (2 * (1 - r));
+            Sint32 cx = left + lrint(u) * side / 256;
+            Sint32 cy = top + (255 - lrint(v)) * side / 256;
+
+            /* 5x5 box outline */
+            for (Sint32 dy = -2; dy <= 2; dy++) {
+                for (Sint32 dx = -2; dx <= 2; dx++) {
+                    Sint32 x = cx + dx;
+                    Sint32 yy = cy + dy;
+
+                    if ((abs(dx) != 2 && abs(dy) != 2) || x < 0 || yy < 0 ||
+                        x >= (Sint32)P.width || yy >= (Sint32)P.height) {
+                        continue;
+                    }
+                    if (SCOPE.y[yy * w + x] == 16) {
+                        SCOPE.y[yy * w + x] = 0xA0;
+                    }
+                }
+            }
+        }
+    }
+}
+
+/* shaded picture of the current scope in SCOPE.y, .cb and .cr */
+Uint32 make_scope(void)
+{
+    Uint32 w = P.width;
+    Uint32 h = P.height;
+    Uint32 native = P.depth > 8 && !P.diff && !P.temporal;
+
+    if (!scope_alloc()) {
+        return 0;
+    }
+    memset(SCOPE.cb, 0x80, P.wh / 2);
+    memset(SCOPE.cr, 0x80, P.wh / 2);
+    SCOPE.phase = SCOPE_BIN;
+    SCOPE.tables = POOL.count > 1 ? POOL.count : 1;
+
+    if (P.scope == SCOPE_VECTOR) {
+        Uint32 vs = native ? 512 : 256;
+        Uint32 side = w < h ? w : h;
+        Uint32 left = (w - side) / 2;
+        Uint32 top = (h - side) / 2;
+
+        SCOPE.vsize = vs;
+        pool_run(scope_job, NULL);
+        SCOPE.phase = SCOPE_MERGE;
+        pool_run(scope_job, NULL);
+        /* as if the samples covered a quarter of the bins */
+        scope_shade(SCOPE.vbins, SCOPE.vshade, vs * vs, P.cb_size * 4 / (vs * vs) + 1);
+
+        memset(SCOPE.y, 16, P.wh);
+        for (Uint32 x = 0; x < side; x++) {
+            SCOPE.col[x] = x * vs / side;
+        }
+        for (Uint32 y = 0; y < side; y++) {
+            Uint32 cr = vs - 1 - y * vs / side;
+
+            for (Uint32 x = 0; x < side; x++) {
+                Uint32 cb = SCOPE.col[x];
+                Uint32 pos = (top + y) * w + left + x;
+
+                SCOPE.y[pos] = SCOPE.vshade[cr * vs + cb];
+                /* trace in its own colour */
+                if (SCOPE.y[pos] > 16 && !((left + x) & 1)) {
+                    SCOPE.cb[pos / 2] = cb * 256 / vs;
+                    SCOPE.cr[pos / 2] = cr * 256 / vs;
+                }
+            }
+        }
+    } else if (P.scope == SCOPE_PARADE && w >= 6) {
+        Uint32 pw = w / 3;
+        const Uint8 tint[3][2] = {{90, 240}, {54, 34}, {240, 110}};
+
+        scope_rows(255, h);
+        rgb_coefficients(SCOPE.coef);
+        for (Uint32 x = 0; x < w; x++) {
+            SCOPE.col[x] = x * pw / w;
+        }
+        pool_run(scope_job, NULL);
+        scope_shade(SCOPE.bins, SCOPE.y, P.wh, (w + pw - 1) / pw);
+
+        for (Uint32 y = 0; y < h; y++) {
+            for (Uint32 x = 0; x < 3 * pw; x += 2) {
+                Uint32 c = x / pw;
+
+                if (SCOPE.y[y * w + x] > 16) {
+                    SCOPE.cb[(y * w + x) / 2] = tint[c][0];
+                    SCOPE.cr[(y * w + x) / 2] = tint[c][1];
+                }
+            }
+        }
+    } else {
+        scope_rows(native ? (1u << P.depth) - 1 : 255, h);
+        pool_run(scope_job, NULL);
+        scope_shade(SCOPE.bins, SCOPE.y, P.wh, 1);
+    }
+
+    scope_graticule();
+    return 1;
+}
+
+/* the scope in place of the frame */
+void draw_scope(void)
+{
+    Uint32 w = P.width;
+
+    if (!P.scope || !make_scope()) {
+        return;
+    }
+
+    if (FORMAT == YV12 || FORMAT == IYUV || FORMAT == YV1210) {
+        /* overlay planes follow file order: YV12 is Y V U */
+        Uint8* pu = my_overlay->pixels[FORMAT == IYUV ? 1 : 2];
+        Uint8* pv = my_overlay->pixels[FORMAT == IYUV ? 2 : 1];
+
+        for (Uint32 y = 0; y < P.height; y++) {
+            memcpy(my_overlay->pixels[0] + y * my_overlay->pitches[0], SCOPE.y + y * w, w);
+        }
+        for (Uint32 y = 0; y < P.height / 2; y++) {
+            memcpy(pu + y * my_overlay->pitches[1], SCOPE.cb + y * w, w / 2);
+            memcpy(pv + y * my_overlay->pitches[1], SCOPE.cr + y * w, w / 2);
+        }
+        return;
+    }
+
+    for (Uint32 y = 0; y < P.height; y++) {
+        Uint8* row = my_overlay->pixels[0] + y * my_overlay->pitches[0];
+
+        for (Uint32 x = 0; x < w; x++) {
+            row[P.y_start_pos + 2 * x] = SCOPE.y[y * w + x];
+        }
+        for (Uint32 x = 0; x < w / 2; x++) {
+            row[P.cb_start_pos + 4 * x] = SCOPE.cb[y * (w / 2) + x];
+            row[P.cr_start_pos + 4 * x] = SCOPE.cr[y * (w / 2) + x];
+        }
+    }
+}
+
+Uint32 pool_start(Uint32 count)
+{
+    if (count > MAX_THREADS) {
+        count = MAX_THREADS;
+    }
+    POOL.count = 1;
+    POOL.done = SDL_CreateSemaphore(0);
+    if (!POOL.done) {
+        return 0;
+    }
+
+    for (Uint32 i = 1; i < count; i++) {
+        POOL.go[i] = SDL_CreateSemaphore(0);
+        POOL.thread[i] = start_thread(pool_worker, "pool", (void*)(intptr_t)i);
+        if (!POOL.go[i] || !POOL.thread[i]) {
+            fprintf(stderr, "Couldn't start worker: %s\n", SDL_GetError());
+            break;
+        }
+        POOL.count++;
+    }
+    return 1;
+}
+
+void pool_stop(void)
+{
+    POOL.quit = 1;
+    for (Uint32 i = 1; i < POOL.count; i++) {
+        SDL_SemPost(POOL.go[i]);
+        SDL_WaitThread(POOL.thread[i], NULL);
+        SDL_DestroySemaphore(POOL.go[i]);
+    }
+    if (POOL.done) {
+        SDL_DestroySemaphore(POOL.done);
+    }
+    memset(&POOL, 0, sizeof(POOL));
+}
+
+/* run job on all workers and wait for them, one caller at a time */
+void pool_run(void (*job)(void* arg, Uint32 index, Uint32 count), void* arg)
+{
+    if (POOL.count <= 1) {
+        job(arg, 0, 1);
+        return;
+    }
+
+    POOL.job = job;
+    POOL.arg = arg;
+    for (Uint32 i = 1; i < POOL.count; i++) {
+        SDL_SemPost(POOL.go[i]);
+    }
+    job(arg, 0, POOL.count);
+    for (Uint32 i = 1; i < POOL.count; i++) {
+        SDL_SemWait(POOL.done);
+    }
+}
+
+int pool_worker(void* data)
+{
+    Uint32 index = (intptr_t)data;
+
+    for (;;) {
+        SDL_SemWait(POOL.go[index]);
+        if (POOL.quit) {
+            break;
+        }
+        POOL.job(POOL.arg, index, POOL.count);
+        SDL_SemPost(POOL.done);
+    }
+    return 0;
+}
+
+/* sample centres map onto each other, so integer zoom-in repeats each
+ * source pel exactly zoom times - keeps MB inspection pixel accurate */
+void scale_nearest(struct scale_plane* sp, Uint32 y0, Uint32 y1)
+{
+    Uint32* xs = sp->xs;
+    Uint32 prev = ~0u;
+
+    for (Uint32 y = y0; y < y1; y++) {
+        Uint32 sy = (Uint64)(2 * y + 1) * sp->src_h / (2 * sp->dst_h);
+        Uint8* src = sp->src + sy * sp->src_pitch;
+        Uint8* dst = sp->dst + y * sp->dst_pitch;
+
+        if (sy == prev) {
+            memcpy(dst, dst - sp->dst_pitch, sp->dst_w);
+            continue;
+        }
+        for (Uint32 x = 0; x < sp->dst_w; x++) {
+            dst[x] = src[xs[x]];
+        }
+        prev = sy;
+    }
+}
+
+/* vertical blend of two source rows in SIMD into 8.8 fixed point,
+ * then a horizontal blend from precomputed taps */
+void scale_bilinear(struct scale_plane* sp, Uint32 y0, Uint32 y1, Uint16* row)
+{
+    Uint32* xs = sp->xs;
+    Uint16* fx = sp->fx;
+
+    for (Uint32 y = y0; y < y1; y++) {
+        Sint64 pos = (Sint64)(2 * y + 1) * sp->src_h * 128 / sp->dst_h - 128;
+        Uint32 sy, fy, i = 0;
+        Uint8* a;
+        Uint8* b;
+        Uint8* dst = sp->dst + y * sp->dst_pitch;
+
+        if (pos < 0) {
+            pos = 0;
+        }
+        sy = pos >> 8;
+        fy = pos & 0xFF;
+        if (sy >= sp->src_h - 1) {
+            sy = sp->src_h - 1;
+            fy = 0;
+        }
+        a = sp->src + sy * sp->src_pitch;
+        b = fy ? a + sp->src_pitch : a;
+
+#ifdef __SSE2__
+        {
+            __m128i zero = _mm_setzero_si128();
+            __m128i wa = _mm_set1_epi16(256 - fy);
+            __m128i wb = _mm_set1_epi16(fy);
+
+            for (; i + 16 <= sp->src_w; i += 16) {
+                __m128i va = _mm_loadu_si128((__m128i*)(a + i));
+                __m128i vb = _mm_loadu_si128((__m128i*)(b + i));
+                __m128i lo = _mm_add_epi16(
+                        _mm_mullo_epi16(_mm_unpacklo_epi8(va, zero), wa),
+                        _mm_mullo_epi16(_mm_unpacklo_epi8(vb, zero), wb));
+                __m128i hi = _mm_add_epi16(
+                        _mm_mullo_epi16(_mm_unpackhi_epi8(va, zero), wa),
+                        _mm_mullo_epi16(_mm_unpackhi_epi8(vb, zero), wb));
+
+                _mm_storeu_si128((__m128i*)(row + i), lo);
+                _mm_storeu_si128((__m128i*)(row + i + 8), hi);
+            }
+        }
+#endif
+        for (; i < sp->src_w; i++) {
+            row[i] = a[i] * (256 - fy) + b[i] * fy;
+        }
+
+        for (Uint32 x = 0; x < sp->dst_w; x++) {
+            Uint32 x1 = fx[x] ? xs[x] + 1 : xs[x];
+
+            dst[x] = (row[xs[x]] * (256 - fx[x]) + row[x1] * fx[x] + 32768) >> 16;
+        }
+    }
+}
+
+/* box filter for downscaling: SIMD sum of the covered source rows,
+ * then a prefix sum so every output pel is a difference of two */
+void scale_area(struct scale_plane* sp, Uint32 y0, Uint32 y1, Uint32* acc)
+{
+    Uint32* sum = acc + sp->src_w + 16;
+    Uint32* xs = sp->xs;
+
+    for (Uint32 y = y0; y < y1; y++) {
+        Uint32 sy0 = (Uint64)y * sp->src_h / sp->dst_h;
+        Uint32 sy1 = (Uint64)(y + 1) * sp->src_h / sp->dst_h;
+        Uint8* dst = sp->dst + y * sp->dst_pitch;
+
+        if (sy1 <= sy0) {
+            sy1 = sy0 + 1;
+        }
+        memset(acc, 0, sizeof(Uint32) * sp->src_w);
+
+        for (Uint32 sy = sy0; sy < sy1; sy++) {
+            Uint8* src = sp->src + sy * sp->src_pitch;
+            Uint32 i = 0;
+
+#ifdef __SSE2__
+            __m128i zero = _mm_setzero_si128();
+
+            for (; i + 16 <= sp->src_w; i += 16) {
+                __m128i v = _mm_loadu_si128((__m128i*)(src + i));
+                __m128i lo = _mm_unpacklo_epi8(v, zero);
+                __m128i hi = _mm_unpackhi_epi8(v, zero);
+                __m128i* d = (__m128i*)(acc + i);
+
+                _mm_storeu_si128(d, _mm_add_epi32(_mm_loadu_si128(d),
+                                 _mm_unpacklo_epi16(lo, zero)));
+                _mm_storeu_si128(d + 1, _mm_add_epi32(_mm_loadu_si128(d + 1),
+                                 _mm_unpackhi_epi16(lo, zero)));
+                _mm_storeu_si128(d + 2, _mm_add_epi32(_mm_loadu_si128(d + 2),
+                                 _mm_unpacklo_epi16(hi, zero)));
+                _mm_storeu_si128(d + 3, _mm_add_epi32(_mm_loadu_si128(d + 3),
+                                 _mm_unpackhi_epi16(hi, zero)));
+            }
+#endif
+            for (; i < sp->src_w; i++) {
+                acc[i] += src[i];
+            }
+        }
+
+        sum[0] = 0;
+        for (Uint32 i = 0; i < sp->src_w; i++) {
+            sum[i + 1] = sum[i] + acc[i];
+        }
+
+        for (Uint32 x = 0; x < sp->dst_w; x++) {
+            Uint32 sx0 = xs[x];
+            Uint32 sx1 = xs[x + 1] > sx0 ? xs[x + 1] : sx0 + 1;
+            Uint32 n = (sx1 - sx0) * (sy1 - sy0);
+
+            dst[x] = (sum[sx1] - sum[sx0] + n / 2) / n;
+        }
+    }
+}
+
+/* worker: band of output rows of every plane */
+void scale_job(void* arg, Uint32 index, Uint32 count)
+{
+    struct scale_plane* plane = arg;
+    Uint32* scratch = SC.scratch + (Uint64)index * SC.scratch_stride;
+
+    for (Uint32 p = 0; p < 3; p++) {
+        struct scale_plane* sp = &plane[p];
+        Uint32 y0 = sp->dst_h * index / count;
+        Uint32 y1 = sp->dst_h * (index + 1) / count;
+
+        if (sp->mode == SCALE_AREA) {
+            scale_area(sp, y0, y1, scratch);
+        } else if (sp->mode == SCALE_NEAREST) {
+            scale_nearest(sp, y0, y1);
+        } else {
+            scale_bilinear(sp, y0, y1, (Uint16*)scratch);
+        }
+    }
+}
+
+/* tap tables of each plane, rebuilt only when the scaler or a width
+ * changes, and a row buffer per worker */
+Uint32 scale_taps(void)
+{
+    Uint32 workers = POOL.count > 1 ? POOL.count : 1;
+    /* area: source row sums and their prefix sum, bilinear uses less */
+    Uint32 stride = (2 * SC.plane[0].src_w + 33 + 15) & ~15u;
+
+    if (SC.scratch_size < (Uint64)stride * workers) {
+        free(SC.scratch);
+        SC.scratch = malloc(sizeof(Uint32) * stride * workers);
+        if (!SC.scratch) {
+            SC.scratch_size = 0;
+            fprintf(stderr, "Error allocating memory...\n");
+            return 0;
+        }
+        SC.scratch_size = (Uint64)stride * workers;
+    }
+    SC.scratch_stride = stride;
+
+    for (Uint32 p = 0; p < 3; p++) {
+        struct scale_plane* sp = &SC.plane[p];
+
+        if (sp->xs && sp->tap_mode == sp->mode && sp->tap_src_w == sp->src_w &&
+            sp->tap_dst_w == sp->dst_w) {
+            continue;
+        }
+        free(sp->xs);
+        free(sp->fx);
+        sp->xs = malloc(sizeof(Uint32) * (sp->dst_w + 1));
+        sp->fx = malloc(sizeof(Uint16) * sp->dst_w);
+        if (!sp->xs || !sp->fx) {
+            free(sp->xs);
+            free(sp->fx);
+            sp->xs = NULL;
+            sp->fx = NULL;
+            fprintf(stderr, "Error allocating memory...\n");
+            return 0;
+        }
+
+        for (Uint32 x = 0; x < sp->dst_w; x++) {
+            if (sp->mode == SCALE_AREA) {
+                sp->xs[x] = (Uint64)x * sp->src_w / sp->dst_w;
+            } else if (sp->mode == SCALE_NEAREST) {
+                sp->xs[x] = (Uint64)(2 * x + 1) * sp->src_w / (2 * sp->dst_w);
+            } else {
+                Sint64 pos = (Sint64)(2 * x + 1) * sp->src_w * 128 / sp->dst_w - 128;
+
+                if (pos < 0) {
+                    pos = 0;
+                }
+                sp->xs[x] = pos >> 8;
+                sp->fx[x] = pos & 0xFF;
+                if (sp->xs[x] >= sp->src_w - 1) {
+                    sp->xs[x] = sp->src_w - 1;
+                    sp->fx[x] = 0;
+                }
+            }
+        }
+        /* the right edge of the last box */
+        sp->xs[sp->dst_w] = sp->src_w;
+        sp->tap_mode = sp->mode;
+        sp->tap_src_w = sp->src_w;
+        sp->tap_dst_w = sp->dst_w;
+    }
+    return 1;
+}
+
+/* worker: split (interleave == 0) or merge packed 4:2:2 rows */
+void packed_job(void* arg, Uint32 index, Uint32 count)
+{
+    SDL_Overlay* o = arg;
+    Uint32 w = o->w;
+    Uint32 h = o->h;
+    Uint8* planes = SC.interleave ? SC.dst_planes : SC.src_planes;
+    Uint8* y = planes;
+    Uint8* cb = planes + w * h;
+    Uint8* cr = cb + w / 2 * h;
+
+    for (Uint32 row = h * index / count; row < h * (index + 1) / count; row++) {
+        Uint8* px = o->pixels[0] + row * o->pitches[0];
+
+        for (Uint32 x = 0; x < w / 2; x++) {
+            if (SC.interleave) {
+                px[4 * x + P.y_start_pos] = y[row * w + 2 * x];
+                px[4 * x + P.y_start_pos + 2] = y[row * w + 2 * x + 1];
+                px[4 * x + P.cb_start_pos] = cb[row * (w / 2) + x];
+                px[4 * x + P.cr_start_pos] = cr[row * (w / 2) + x];
+            } else {
+                y[row * w + 2 * x] = px[4 * x + P.y_start_pos];
+                y[row * w + 2 * x + 1] = px[4 * x + P.y_start_pos + 2];
+                cb[row * (w / 2) + x] = px[4 * x + P.cb_start_pos];
+                cr[row * (w / 2) + x] = px[4 * x + P.cr_start_pos];
+            }
+        }
+    }
+}
+
+/* the stage has the layout draw_420/draw_422 expect at source size */
+SDL_Overlay* stage_overlay(void)
+{
+    Uint32 planar = FORMAT == YV12 || FORMAT == IYUV || FORMAT == YV1210;
+
+    if (SC.stage) {
+        return SC.stage;
+    }
+
+    SC.stage = calloc(1, sizeof(SDL_Overlay));
+    SC.src_planes = malloc(P.y_size + P.cb_size + P.cr_size);
+    if (!SC.stage || !SC.src_planes) {
+        fprintf(stderr, "Error allocating memory...\n");
+        return NULL;
+    }
+    SC.stage->format = P.overlay_format;
+    SC.stage->w = P.width;
+    SC.stage->h = P.height;
+    SC.stage->pitches = SC.stage_pitch;
+    SC.stage->pixels = SC.stage_pixels;
+
+    if (planar) {
+        SC.stage->planes = 3;
+        SC.stage_pitch[0] = P.width;
+        SC.stage_pitch[1] = SC.stage_pitch[2] = P.width / 2;
+        SC.stage_pixels[0] = SC.src_planes;
+        SC.stage_pixels[1] = SC.src_planes + P.y_size;
+        SC.stage_pixels[2] = SC.src_planes + P.y_size + P.cr_size;
+    } else {
+        SC.stage->planes = 1;
+        SC.stage_pitch[0] = P.width * 2;
+        SC.stage_pixels[0] = malloc(P.frame_size);
+        if (!SC.stage_pixels[0]) {
+            fprintf(stderr, "Error allocating memory...\n");
+            return NULL;
+        }
+    }
+    return SC.stage;
+}
+
+/* resample the stage into dst, which has the zoomed size */
+Uint32 scale_frame(SDL_Overlay* dst)
+{
+    Uint32 planar = FORMAT == YV12 || FORMAT == IYUV || FORMAT == YV1210;
+    Uint32 dw = dst->w;
+    Uint32 dh = dst->h;
+    Uint32 ch = planar ? P.height / 2 : P.height;
+    Uint32 dch = planar ? dh / 2 : dh;
+
+    if (!planar) {
+        if (SC.dst_size < dw * dh * 2) {
+            free(SC.dst_planes);
+            SC.dst_planes = malloc(dw * dh * 2);
+            if (!SC.dst_planes) {
+                SC.dst_size = 0;
+                fprintf(stderr, "Error allocating memory...\n");
+                return 0;
+            }
+            SC.dst_size = dw * dh * 2;
+        }
+        SC.interleave = 0;
+        pool_run(packed_job, SC.stage);
+    }
+
+    for (Uint32 p = 0; p < 3; p++) {
+        struct scale_plane* sp = &SC.plane[p];
+
+        sp->src_w = p ? P.width / 2 : P.width;
+        sp->src_h = p ? ch : P.height;
+        sp->dst_w = p ? dw / 2 : dw;
+        sp->dst_h = p ? dch : dh;
+        if (planar) {
+            sp->src = SC.stage->pixels[p];
+            sp->src_pitch = SC.stage->pitches[p];
+            sp->dst = dst->pixels[p];
+            sp->dst_pitch = dst->pitches[p];
+        } else {
+            sp->src = SC.src_planes + (p ? P.wh + (p - 1) * P.wh / 2 : 0);
+            sp->src_pitch = sp->src_w;
+            sp->dst = SC.dst_planes + (p ? dw * dh + (p - 1) * dw / 2 * dh : 0);
+            sp->dst_pitch = sp->dst_w;
+        }
+        /* area average is only defined for downscaling */
+        if (P.scaler == SCALE_AREA && sp->dst_w <= sp->src_w && sp->dst_h <= sp->src_h) {
+            sp->mode = SCALE_AREA;
+        } else {
+            sp->mode = P.scaler == SCALE_NEAREST ? SCALE_NEAREST : SCALE_BILINEAR;
+        }
+    }
+    if (!scale_taps()) {
+        return 0;
+    }
+    pool_run(scale_job, SC.plane);
+
+    if (!planar) {
+        SC.interleave = 1;
+        pool_run(packed_job, dst);
+    }
+    return 1;
+}
+
+#ifdef USE_SDL2
+/* UI thread: window of w x h, also the logical size of the renderer so
+ * the picture is letterboxed when the user resizes the window and mouse
+ * coordinates stay in zoomed frame units */
+Uint32 video_mode(Uint32 w, Uint32 h)
+{
+    if (!window) {
+        window = SDL_CreateWindow("yv", SDL_WINDOWPOS_UNDEFINED,
+                                  SDL_WINDOWPOS_UNDEFINED, w, h,
+                                  SDL_WINDOW_RESIZABLE);
+        if (!window) {
+            return 0;
+        }
+        /* present on vblank if the driver can, any renderer otherwise
+         * (software renderer, dummy video driver) */
+        renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_PRESENTVSYNC);
+        if (!renderer) {
+            renderer = SDL_CreateRenderer(window, -1, 0);
+        }
+        if (!renderer) {
+            return 0;
+        }
+    } else {
+        SDL_SetWindowSize(window, w, h);
+    }
+    return SDL_RenderSetLogicalSize(renderer, w, h) == 0;
+}
+
+void video_caption(const char* caption)
+{
+    SDL_SetWindowTitle(window, caption);
+}
+
+SDL_Thread* start_thread(int (*fn)(void*), const char* name, void* data)
+{
+    return SDL_CreateThread(fn, name, data);
+}
+
+/* UI thread: map the texture, the locked memory has the plane layout
+ * of the matching SDL 1.2 overlay */
+Uint32 lock_overlay(SDL_Overlay* o)
+{
+    void* pixels;
+    int pitch;
+
+    if (SDL_LockTexture(o->texture, NULL, &pixels, &pitch) < 0) {
+        fprintf(stderr, "Couldn't lock texture: %s\n", SDL_GetError());
+        return 0;
+    }
+    o->plane[0] = pixels;
+    o->pitch[0] = pitch;
+    if (o->planes == 3) {
+        o->pitch[1] = o->pitch[2] = pitch / 2;
+        o->plane[1] = o->plane[0] + pitch * o->h;
+        o->plane[2] = o->plane[1] + pitch / 2 * (o->h / 2);
+    }
+    return 1;
+}
+
+SDL_Overlay* new_overlay(Uint32 w, Uint32 h)
+{
+    SDL_Overlay* o = calloc(1, sizeof(SDL_Overlay));
+
+    if (!o) {
+        fprintf(stderr, "Error allocating memory...\n");
+        return NULL;
+    }
+    o->format = P.overlay_format;
+    o->w = w;
+    o->h = h;
+    o->planes = o->format == SDL_YV12_OVERLAY || o->format == SDL_IYUV_OVERLAY ? 3 : 1;
+    o->pitches = o->pitch;
+    o->pixels = o->plane;
+    o->texture = SDL_CreateTexture(renderer, o->format,
+                                   SDL_TEXTUREACCESS_STREAMING, w, h);
+    if (!o->texture || !lock_overlay(o)) {
+        free_overlay(o);
+        return NULL;
+    }
+    return o;
+}
+
+void free_overlay(SDL_Overlay* o)
+{
+    if (o->texture) {
+        SDL_DestroyTexture(o->texture);
+    }
+    free(o);
+}
+
+/* UI thread: upload a freshly drawn texture, show it and lock it again
+ * for the render thread. RenderPresent waits for vblank with vsync, the
+ * render thread keeps drawing the other texture meanwhile */
+void present_overlay(SDL_Overlay* o, Uint32 upload)
+{
+    if (upload) {
+        SDL_UnlockTexture(o->texture);
+    }
+    SDL_RenderClear(renderer);
+    SDL_RenderCopy(renderer, o->texture, NULL, &video_rect);
+    SDL_RenderPresent(renderer);
+    if (upload) {
+        lock_overlay(o);
+    }
+}
+#else
+Uint32 video_mode(Uint32 w, Uint32 h)
+{
+    screen = SDL_SetVideoMode(w, h, P.bpp, P.vflags);
+    return screen != NULL;
+}
+
+void video_caption(const char* caption)
+{
+    SDL_WM_SetCaption(caption, NULL);
+}
+
+SDL_Thread* start_thread(int (*fn)(void*), const char* name, void* data)
+{
+    (void)name;
+    return SDL_CreateThread(fn, data);
+}
+
+/* SDL 1.2 overlays are locked by the render thread in draw_frame */
+Uint32 lock_overlay(SDL_Overlay* o)
+{
+    return SDL_LockYUVOverlay(o) == 0;
+}
+
+SDL_Overlay* new_overlay(Uint32 w, Uint32 h)
+{
+    return SDL_CreateYUVOverlay(w, h, P.overlay_format, screen);
+}
+
+void free_overlay(SDL_Overlay* o)
+{
+    SDL_FreeYUVOverlay(o);
+}
+
+void present_overlay(SDL_Overlay* o, Uint32 upload)
+{
+    (void)upload;
+    SDL_DisplayYUVOverlay(o, &video_rect);
+}
+#endif
+
+/* UI thread: front and back overlay, see struct render_state */
+Uint32 create_overlays(Uint32 w, Uint32 h)
+{
+    for (Uint32 i = 0; i < 2; i++) {
+        if (R.overlay[i]) {
+            free_overlay(R.overlay[i]);
+        }
+        R.overlay[i] = new_overlay(w, h);
+        if (!R.overlay[i]) {
+            fprintf(stderr, "Couldn't create overlay\n");
+            return 0;
+        }
+    }
+    my_overlay = R.overlay[R.back];
+    return 1;
+}
+
+void setup_param(void)
+{
+    P.zoom = 1;
+    if (!P.ctu) {
+        P.ctu = CTU_DEFAULT;
+    }
+    if (!P.codec) {
+        P.codec = PACK_LZ4;
+    }
     P.wh = P.width * P.height;
+    set_zoom_rect();
+    P.mb_cols = (P.width + 15) / 16;
+    P.mb_rows = (P.height + 15) / 16;
+
+    if (FORMAT == YV12 || FORMAT == IYUV) {
+        P.frame_size = P.wh * 3 / 2;
+        P.y_size = P.wh;
+        P.cb_size = P.wh / 4;
+        P.cr_size = P.wh / 4;
+    } else if (FORMAT == YUY2 || FORMAT == UYVY || FORMAT == YVYU || FORMAT == Y42210) {
+        P.grid_start_pos = 0;
+        P.frame_size = P.wh * 2;
+        P.y_size = P.wh;
+        P.cb_size = P.wh / 2;
+        P.cr_size = P.wh / 2;
+    } else if (FORMAT == YV1210) {
+        /* SDL cannot natively display this format; let's fake it
+         * and pretend it's YV12 */
+        P.frame_size = P.wh * 3 / 2;
+        P.y_size = P.wh;
+        P.cb_size = P.wh / 4;
+        P.cr_size = P.wh / 4;
+    }
+
+    /* 10 bpp formats are stored as 16 bit little endian samples */
+    P.file_frame_size = P.frame_size;
+    P.depth = 8;
+    P.sample_bytes = 1;
+    if (FORMAT == YV1210 || FORMAT == Y42210) {
+        P.file_frame_size = P.frame_size * 2;
+        P.depth = 10;
+        P.sample_bytes = 2;
+    } else {
+        /* --bits has nothing to choose from */
+        P.bits = BITS_ROUND;
+    }
+
+    if (FORMAT == YUY2) {
+        /* Y U Y V
+         * 0 1 2 3 */
+        P.y_start_pos = 0;
+        P.cb_start_pos = 1;
+        P.cr_start_pos = 3;
+    } else if (FORMAT == UYVY) {
+        /* U Y V Y
+         * 0 1 2 3 */
+        P.y_start_pos = 1;
+        P.grid_start_pos = 1;
+        P.cb_start_pos = 0;
+        P.cr_start_pos = 2;
+    } else if (FORMAT == YVYU || FORMAT == Y42210)  {
+        /* Y V Y U
+         * 0 1 2 3 */
+        P.y_start_pos = 0;
+        P.cb_start_pos = 3;
+        P.cr_start_pos = 1;
+    }
+}
+
+void check_input(void)
+{
+    off_t file_size;
+
+    /* Frame Size is an even multipe of 16x16? */
+    if (P.width % 16 != 0) {
+        fprintf(stderr, "WIDTH not multiple of 16, check input...\n");
+    }
+    if (P.height % 16 != 0) {
+        fprintf(stderr, "HEIGHT not multiple of 16, check input...\n");
+    }
+
+    /* Even number of frames? */
+    fseeko(fd, 0, SEEK_END);
+    file_size = ftello(fd);
+    fseeko(fd, 0, SEEK_SET);
+
+    P.num_frames = frame_total(0, file_size);
+    if (!P.index[0].offset && !PAK.packed && file_size % P.file_frame_size != 0) {
+        Uint32 w, h, format;
+
+        fprintf(stderr, "#FRAMES not an integer, check input...\n");
+        if (probe_geometry(P.filename, &w, &h, &format, 0)) {
+            fprintf(stderr, "%s looks like %u %u %s\n", P.filename, w, h, format_names[format]);
+        }
+    }
+}
+
+/* where frame (zero based) of the input (file 0) or diff file (1) starts */
+Uint64 frame_offset(Uint32 file, Uint64 frame)
+{
+    struct frame_index* ix = &P.index[file];
+
+    if (!ix->offset) {
+        return frame * P.file_frame_size;
+    }
+    return frame < ix->count ? ix->offset[frame] : ix->size;
+}
+
+/* complete frames in a file of size bytes */
+Uint32 frame_total(Uint32 file, Uint64 size)
+{
+    if (!file && PAK.packed) {
+        return PAK.frames;
+    }
+    return P.index[file].offset ? P.index[file].count : size / P.file_frame_size;
+}
+
+/* Size, chroma format and, if given, frame rate from the stream header
+ * of a YUV4MPEG2 file. header is its length, 0 for raw files. */
+Uint32 y4m_parse(char* name, Uint64* header, Uint32* width, Uint32* height,
+                 Uint32* format, Uint32* frame_ms)
+{
+    char line[Y4M_MAX_HEADER + 1];
+    char* save = NULL;
+    char* end;
+    Uint32 w = 0, h = 0, chroma = IYUV;
+    Uint32 num = 0, den = 0;
+    ssize_t n;
+    int in;
+
+    in = open(name, O_RDONLY);
+    if (in < 0) {
+        fprintf(stderr, "Error opening %s\n", name);
+        return 0;
+    }
+    n = pread(in, line, Y4M_MAX_HEADER, 0);
+    close(in);
+    if (n < (ssize_t)strlen(Y4M_MAGIC) || memcmp(line, Y4M_MAGIC, strlen(Y4M_MAGIC))) {
+        *header = 0;
+        return 1;
+    }
+    line[n] = '\0';
+    end = strchr(line, '\n');
+    if (!end) {
+        fprintf(stderr, "%s: Y4M stream header too long\n", name);
+        return 0;
+    }
+    *end = '\0';
+
+    for (char* tag = strtok_r(line + strlen(Y4M_MAGIC), " ", &save); tag;
+         tag = strtok_r(NULL, " ", &save)) {
+        switch (tag[0])
+        {
+            case 'W':
+                w = atoi(tag + 1);
+                break;
+            case 'H':
+                h = atoi(tag + 1);
+                break;
+            case 'F':
+                sscanf(tag + 1, "%u:%u", &num, &den);
+                break;
+            case 'C':
+                /* 4:2:0 is Y, Cb, Cr, i.e. IYUV, whatever the chroma siting */
+                if (!strcmp(tag + 1, "420") || !strcmp(tag + 1, "420jpeg") ||
+                    !strcmp(tag + 1, "420paldv") || !strcmp(tag + 1, "420mpeg2")) {
+                    chroma = IYUV;
+                } else if (!strcmp(tag + 1, "422p10")) {
+                    chroma = Y42210;
+                } else {
+                    fprintf(stderr, "%s: Y4M chroma %s is not supported "
+                            "(4:2:0 8 bit and 4:2:2 10 bit only)\n", name, tag + 1);
+                    return 0;
+                }
+                break;
+            default:
+                /* interlacing, aspect ratio and extensions don't matter */
+                break;
+        }
+    }
+    if (!w || !h) {
+        fprintf(stderr, "%s: Y4M stream header without size\n", name);
+        return 0;
+    }
+
+    *header = end - line + 1;
+    *width = w;
+    *height = h;
+    *format = chroma;
+    if (num && den) {
+        *frame_ms = (1000 * (Uint64)den + num / 2) / num;
+        if (!*frame_ms) {
+            *frame_ms = 1;
+        }
+    }
+    return 1;
+}
+
+/* Parse the stream header of a YUV4MPEG2 file. The input (file 0) takes
+ * size, chroma format and frame rate from it, a diff file has to match.
+ * Raw files are left alone. */
+Uint32 y4m_header(Uint32 file, char* name)
+{
+    Uint64 header = 0;
+    Uint32 w, h, format;
+    Uint32 frame_ms = 0;
+
+    if (!y4m_parse(name, &header, &w, &h, &format, &frame_ms)) {
+        return 0;
+    }
+    if (!header) {
+        return 1;
+    }
+    P.index[file].header = header;
+
+    if (file) {
+        if (w != P.width || h != P.height || format != FORMAT) {
+            fprintf(stderr, "%s: size or format differs from %s\n", name, P.filename);
+            return 0;
+        }
+        return 1;
+    }
+    P.width = w;
+    P.height = h;
+    FORMAT = format;
+    P.overlay_format = format == IYUV ? SDL_IYUV_OVERLAY : SDL_YVYU_OVERLAY;
+    if (frame_ms) {
+        P.frame_ms = frame_ms;
+    }
+    return 1;
+}
+
+/* cached index of a file that is still the same size and age */
+Uint32 load_index(struct frame_index* ix, char* path, struct stat* st, Uint32 frame_bytes)
+{
+    struct index_file hdr;
+    FILE* fp = fopen(path, "rb");
+    Uint32 ret = 0;
+
+    if (!fp) {
+        return 0;
+    }
+    if (fread(&hdr, sizeof(hdr), 1, fp) == 1 &&
+        !memcmp(hdr.magic, INDEX_MAGIC, sizeof(hdr.magic)) &&
+        hdr.size == (Uint64)st->st_size && hdr.mtime_sec == st->st_mtim.tv_sec &&
+        hdr.mtime_nsec == st->st_mtim.tv_nsec && hdr.frame_bytes == frame_bytes) {
+        ix->offset = malloc(((size_t)hdr.count + 1) * sizeof(Uint64));
+        ret = ix->offset && fread(ix->offset, sizeof(Uint64), hdr.count, fp) == hdr.count;
+        /* frames in order, each after the stream header and whole */
+        for (Uint32 i = 0; ret && i < hdr.count; i++) {
+            ret = ix->offset[i] >= (i ? ix->offset[i - 1] + frame_bytes : ix->header) &&
+                  ix->offset[i] + frame_bytes <= (Uint64)st->st_size;
+        }
+        if (ret) {
+            ix->count = hdr.count;
+        } else {
+            free(ix->offset);
+            ix->offset = NULL;
+        }
+    }
+    fclose(fp);
+    return ret;
+}
+
+/* written next to the clip, a read only directory just costs a rescan */
+void save_index(struct frame_index* ix, char* path, struct stat* st, Uint32 frame_bytes)
+{
+    struct index_file hdr;
+    char tmp[PATH_MAX];
+    FILE* fp;
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, INDEX_MAGIC, sizeof(hdr.magic));
+    hdr.size = st->st_size;
+    hdr.mtime_sec = st->st_mtim.tv_sec;
+    hdr.mtime_nsec = st->st_mtim.tv_nsec;
+    hdr.frame_bytes = frame_bytes;
+    hdr.count = ix->count;
+
+    snprintf(tmp, sizeof(tmp), "%s.%d", path, (int)getpid());
+    fp = fopen(tmp, "wb");
+    if (!fp) {
+        fprintf(stderr, "Could not write frame index %s\n", path);
+        return;
+    }
+    if (fwrite(&hdr, sizeof(hdr), 1, fp) != 1 ||
+        fwrite(ix->offset, sizeof(Uint64), ix->count, fp) != ix->count) {
+        fclose(fp);
+        unlink(tmp);
+        fprintf(stderr, "Could not write frame index %s\n", path);
+        return;
+    }
+    /* rename so a concurrent reader never sees half an index */
+    if (fclose(fp) || rename(tmp, path)) {
+        unlink(tmp);
+        fprintf(stderr, "Could not write frame index %s\n", path);
+    }
+}
+
+/* input (file 0) or diff file (1) */
+Uint32 build_index(Uint32 file, char* name)
+{
+    return index_frames(&P.index[file], name, P.file_frame_size);
+}
+
+/* Locate every frame of a Y4M file, from <file>.idx when it is current,
+ * else by walking the FRAME headers (one small read per frame) */
+Uint32 index_frames(struct frame_index* ix, char* name, Uint32 frame_bytes)
+{
+    char path[PATH_MAX];
+    char buf[256];
+    struct stat st;
+    Uint32 room = 0;
+    Uint64 pos;
+    int in;
+
+    if (!ix->header) {
+        return 1;
+    }
+    in = open(name, O_RDONLY);
+    if (in < 0 || fstat(in, &st)) {
+        fprintf(stderr, "Error opening %s\n", name);
+        if (in >= 0) {
+            close(in);
+        }
+        return 0;
+    }
+    ix->size = st.st_size;
+    snprintf(path, sizeof(path), "%s.idx", name);
+    if (load_index(ix, path, &st, frame_bytes)) {
+        close(in);
+        return 1;
+    }
+
+    for (pos = ix->header; pos < ix->size; ) {
+        ssize_t n = pread(in, buf, sizeof(buf), pos);
+        char* nl = n > 0 ? memchr(buf, '\n', n) : NULL;
+        Uint64 data;
+
+        if (n < 6 || memcmp(buf, "FRAME", 5) || !nl) {
+            fprintf(stderr, "%s: no FRAME header at byte %llu\n", name,
+                    (unsigned long long)pos);
+            break;
+        }
+        data = pos + (nl - buf) + 1;
+        if (data + frame_bytes > ix->size) {
+            fprintf(stderr, "#FRAMES not an integer, check input...\n");
+            break;
+        }
+        if (ix->count == room) {
+            Uint64* grown;
+
+            room = room ? room * 2 : 1024;
+            grown = realloc(ix->offset, (size_t)room * sizeof(Uint64));
+            if (!grown) {
+                fprintf(stderr, "Error allocating memory...\n");
+                close(in);
+                return 0;
+            }
+            ix->offset = grown;
+        }
+        ix->offset[ix->count++] = data;
+        pos = data + frame_bytes;
+    }
+    close(in);
+
+    if (!ix->offset) {
+        /* not a single frame, still treat the file as Y4M */
+        ix->offset = malloc(sizeof(Uint64));
+        if (!ix->offset) {
+            fprintf(stderr, "Error allocating memory...\n");
+            return 0;
+        }
+    }
+    save_index(ix, path, &st, frame_bytes);
+    return 1;
+}
+
+Uint8* map_input(char* filename, Uint64* size)
+{
+    struct stat st;
+    Uint8* data;
+    int in;
+
+    in = open(filename, O_RDONLY);
+    if (in < 0 || fstat(in, &st)) {
+        fprintf(stderr, "Error opening %s\n", filename);
+        if (in >= 0) {
+            close(in);
+        }
+        return NULL;
+    }
+
+    *size = st.st_size;
+    data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, in, 0);
+    close(in);
+    if (data == MAP_FAILED) {
+        perror("mmap");
+        return NULL;
+    }
+    madvise(data, st.st_size, MADV_SEQUENTIAL);
+
+    return data;
+}
+
+/* "A" or "A:B", zero based and inclusive */
+Uint32 parse_range(char* arg)
+{
+    char* end;
+
+    P.first_frame = strtoul(arg, &end, 10);
+    P.last_frame = P.first_frame;
+    if (*end == ':') {
+        P.last_frame = strtoul(end + 1, &end, 10);
+    }
+    if (*end != '\0' || P.last_frame < P.first_frame) {
+        fprintf(stderr, "Bad frame range '%s'\n", arg);
+        return 0;
+    }
+    P.range_set = 1;
+    return 1;
+}
+
+/* "x,y,w,h" in luma samples */
+Uint32 parse_crop(char* arg)
+{
+    int n;
+
+    if (sscanf(arg, "%u,%u,%u,%u%n", &P.crop[0], &P.crop[1], &P.crop[2],
+               &P.crop[3], &n) != 4 || arg[n] != '\0' || !P.crop[2] || !P.crop[3]) {
+        fprintf(stderr, "Bad crop '%s'\n", arg);
+        return 0;
+    }
+    return 1;
+}
+
+/* "y,cb,cr" in any combination */
+Uint32 parse_blank(char* arg)
+{
+    const char* names[3] = {"y", "cb", "cr"};
+    char* tok;
+
+    for (tok = strtok(arg, ","); tok; tok = strtok(NULL, ",")) {
+        Uint32 p;
+
+        for (p = 0; p < 3 && strcmp(tok, names[p]); p++);
+        if (p == 3) {
+            fprintf(stderr, "Bad plane '%s', use y, cb or cr\n", tok);
+            return 0;
+        }
+        P.blank |= 1 << p;
+    }
+    return 1;
+}
+
+/* "x,y:x,y:..." or, for rect, "x0,y0,x1,y1" */
+Uint32 parse_mb_list(char* arg, Uint32 rect)
+{
+    Uint32 x0, y0, x1, y1;
+    Uint32* tmp;
+    int n;
+
+    if (rect) {
+        if (sscanf(arg, "%u,%u,%u,%u%n", &x0, &y0, &x1, &y1, &n) != 4 ||
+            arg[n] != '\0' || x1 < x0 || y1 < y0) {
+            fprintf(stderr, "Bad MB rectangle '%s'\n", arg);
+            return 0;
+        }
+        tmp = realloc(P.mb_list, sizeof(Uint32) * 2 *
+                      (P.mb_count + (x1 - x0 + 1) * (y1 - y0 + 1)));
+        if (!tmp) {
+            fprintf(stderr, "Error allocating memory...\n");
+            return 0;
+        }
+        P.mb_list = tmp;
+        for (Uint32 y = y0; y <= y1; y++) {
+            for (Uint32 x = x0; x <= x1; x++) {
+                P.mb_list[P.mb_count * 2] = x;
+                P.mb_list[P.mb_count * 2 + 1] = y;
+                P.mb_count++;
+            }
+        }
+        return 1;
+    }
+
+    while (*arg) {
+        if (sscanf(arg, "%u,%u%n", &x0, &y0, &n) != 2 ||
+            (arg[n] != '\0' && arg[n] != ':')) {
+            fprintf(stderr, "Bad MB list '%s'\n", arg);
+            return 0;
+        }
+        tmp = realloc(P.mb_list, sizeof(Uint32) * 2 * (P.mb_count + 1));
+        if (!tmp) {
+            fprintf(stderr, "Error allocating memory...\n");
+            return 0;
+        }
+        P.mb_list = tmp;
+        P.mb_list[P.mb_count * 2] = x0;
+        P.mb_list[P.mb_count * 2 + 1] = y0;
+        P.mb_count++;
+        arg += n + (arg[n] == ':');
+    }
+    return 1;
+}
+
+/* Where Y, Cb and Cr samples live inside one frame on disk, in samples
+ * (not bytes): start offset, row pitch, plane size and distance between
+ * two horizontally adjacent samples. */
+void plane_layout(Uint32* offset, Uint32* pitch, Uint32* width, Uint32* height,
+                  Uint32* step)
+{
+    format_layout(FORMAT, P.width, P.height, offset, pitch, width, height, step);
+}
+
+/* plane_layout() for any format and size */
+void format_layout(Uint32 format, Uint32 w, Uint32 h, Uint32* offset,
+                   Uint32* pitch, Uint32* width, Uint32* height, Uint32* step)
+{
+    /* Y, Cb, Cr position within a YUY2, UYVY and YVYU macro pixel */
+    const Uint32 packed[3][3] = {{0, 1, 3}, {1, 0, 2}, {0, 3, 1}};
+    Uint32 wh = w * h;
+
+    width[0] = w;
+    height[0] = h;
+    width[1] = width[2] = w / 2;
+
+    if (format == YV12 || format == IYUV || format == YV1210) {
+        height[1] = height[2] = h / 2;
+        pitch[0] = w;
+        pitch[1] = pitch[2] = w / 2;
+        step[0] = step[1] = step[2] = 1;
+        offset[0] = 0;
+        /* YV12 stores Cr before Cb */
+        offset[1] = format == IYUV ? wh : wh + wh / 4;
+        offset[2] = format == IYUV ? wh + wh / 4 : wh;
+    } else if (format == Y42210) {
+        height[1] = height[2] = h;
+        pitch[0] = w;
+        pitch[1] = pitch[2] = w / 2;
+        step[0] = step[1] = step[2] = 1;
+        offset[0] = 0;
+        offset[1] = wh;
+        offset[2] = wh + wh / 2;
+    } else {
+        /* packed YUY2, UYVY, YVYU */
+        height[1] = height[2] = h;
+        pitch[0] = pitch[1] = pitch[2] = w * 2;
+        step[0] = 2;
+        step[1] = step[2] = 4;
+        for (Uint32 p = 0; p < 3; p++) {
+            offset[p] = packed[format - YUY2][p];
+        }
+    }
+}
+
+/* bytes of one frame on disk */
+Uint64 format_frame_size(Uint32 format, Uint32 w, Uint32 h)
+{
+    Uint64 size = (Uint64)w * h;
+
+    size = (format == YV12 || format == IYUV || format == YV1210) ?
+           size * 3 / 2 : size * 2;
+    return (format == YV1210 || format == Y42210) ? size * 2 : size;
+}
+
+/* exact name, as given on the command line */
+Uint32 parse_format(char* arg, Uint32* format)
+{
+    for (Uint32 i = 0; i < sizeof(format_names) / sizeof(format_names[0]); i++) {
+        if (!strcmp(arg, format_names[i])) {
+            *format = i;
+            return 1;
+        }
+    }
+    fprintf(stderr, "The format option '%s' is not recognized\n", arg);
+    return 0;
+}
+
+/* absolute difference of vertically and horizontally neighbouring
+ * samples, summed over up to PROBE_ROWS row pairs of a plane in 8 bit
+ * units; -1 if a 16 bit sample has more than 10 bits */
+double probe_plane(const Uint8* base, Uint32 width, Uint32 height, Uint32 pitch,
+                   Uint32 step, Uint32 bytes, Uint64* samples)
+{
+    Uint32 pairs = height - 1 < PROBE_ROWS ? height - 1 : PROBE_ROWS;
+    Uint64 sum = 0;
+
+    for (Uint32 k = 0; k < pairs; k++) {
+        const Uint8* a = base + (Uint64)k * (height - 1) / pairs * pitch;
+        const Uint8* b = a + pitch;
+        Uint32 x = 0;
+
+        if (bytes == 2) {
+            const Uint16* a16 = (const Uint16*)a;
+            const Uint16* b16 = (const Uint16*)b;
+
+            for (; x < width; x++) {
+                if (a16[x] > 1023 || b16[x] > 1023) {
+                    return -1;
+                }
+                sum += abs(a16[x] - b16[x]);
+                sum += x + 1 < width ? abs(a16[x] - a16[x + 1]) : 0;
+            }
+            continue;
+        }
+#ifdef __SSE2__
+        if (step == 1) {
+            __m128i acc = _mm_setzero_si128();
+
+            for (; x + 17 <= width; x += 16) {
+                __m128i va = _mm_loadu_si128((__m128i*)(a + x));
+
+                acc = _mm_add_epi64(acc, _mm_sad_epu8(va, _mm_loadu_si128((__m128i*)(b + x))));
+                acc = _mm_add_epi64(acc, _mm_sad_epu8(va, _mm_loadu_si128((__m128i*)(a + x + 1))));
+            }
+            sum += (Uint64)_mm_cvtsi128_si32(acc) +
+                   _mm_cvtsi128_si32(_mm_unpackhi_epi64(acc, acc));
+        }
+#endif
+        for (; x < width; x++) {
+            sum += abs(a[x * step] - b[x * step]);
+            sum += x + 1 < width ? abs(a[x * step] - a[(x + 1) * step]) : 0;
+        }
+    }
+    *samples += (Uint64)pairs * (2 * width - 1);
+    return bytes == 2 ? sum / 4.0 : sum;
+}
+
+/* neighbour differences of the first frame read as w x h format, low
+ * for the real geometry; -1 if it can't be. The luma of the second
+ * frame, if there is one, shows a wrong frame size. */
+double probe_score(const Uint8* data, Uint64 size, Uint32 w, Uint32 h, Uint32 format)
+{
+    Uint32 offset[4], pitch[4], width[4], height[4], step[4];
+    Uint32 bytes = (format == YV1210 || format == Y42210) ? 2 : 1;
+    Uint64 frame = format_frame_size(format, w, h);
+    Uint32 planes = size >= 2 * frame ? 4 : 3;
+    Uint64 samples = 0;
+    double score = 0;
+
+    format_layout(format, w, h, offset, pitch, width, height, step);
+    offset[3] = offset[0];
+    pitch[3] = pitch[0];
+    width[3] = width[0];
+    height[3] = height[0];
+    step[3] = step[0];
+    for (Uint32 p = 0; p < planes; p++) {
+        double s = probe_plane(data + (p == 3 ? frame : 0) + offset[p] * bytes, width[p],
+                               height[p], pitch[p] * bytes, step[p], bytes, &samples);
+
+        if (s < 0) {
+            return -1;
+        }
+        score += s;
+    }
+    return samples ? score / samples : -1;
+}
+
+/* WxH and names like cif or 1080p in the file name, sizes go to hint[] */
+Uint32 probe_hints(char* name, Uint32* hint, Uint32 max, Uint32* format, Uint32* ten_bit)
+{
+    char* base = strrchr(name, '/') ? strrchr(name, '/') + 1 : name;
+    char* text = strdup(base);
+    char* save = NULL;
+    Uint32 n = 0;
+
+    *format = ~0u;
+    *ten_bit = 0;
+    if (!text) {
+        return 0;
+    }
+    for (char* c = text; *c; c++) {
+        *c = tolower((unsigned char)*c);
+    }
+
+    for (char* tok = strtok_r(text, "_-. +", &save); tok; tok = strtok_r(NULL, "_-. +", &save)) {
+        Uint32 w, h;
+        char end;
+
+        if (sscanf(tok, "%ux%u%c", &w, &h, &end) == 2 && n + 2 <= max) {
+            hint[n++] = w;
+            hint[n++] = h;
+            continue;
+        }
+        for (Uint32 i = 0; i < sizeof(probe_sizes) / sizeof(probe_sizes[0]); i++) {
+            if (probe_sizes[i].name && !strcmp(tok, probe_sizes[i].name) && n + 2 <= max) {
+                hint[n++] = probe_sizes[i].width;
+                hint[n++] = probe_sizes[i].height;
+            }
+        }
+        for (Uint32 i = 0; i < sizeof(format_names) / sizeof(format_names[0]); i++) {
+            if (!strcasecmp(tok, format_names[i])) {
+                *format = i;
+            }
+        }
+        if (!strcmp(tok, "i420") || !strcmp(tok, "yuv420p")) {
+            *format = IYUV;
+        } else if (!strcmp(tok, "yuyv")) {
+            *format = YUY2;
+        } else if (!strcmp(tok, "10bit") || !strcmp(tok, "10b")) {
+            *ten_bit = 1;
+        }
+    }
+    free(text);
+    return n / 2;
+}
+
+/* Guess size and format of a raw clip: every known or hinted size and
+ * every format whose frame size divides the file is scored on the first
+ * frame. Sizes and formats named in the file name are preferred. */
+Uint32 probe_geometry(char* name, Uint32* width, Uint32* height, Uint32* format, Uint32 report)
+{
+    Uint32 hint[2 * PROBE_HINTS];
+    Uint32 hints, hint_format, ten_bit;
+    Uint32 sizes = sizeof(probe_sizes) / sizeof(probe_sizes[0]);
+    Uint32 formats = sizeof(format_names) / sizeof(format_names[0]);
+    struct probe_candidate* cand;
+    struct probe_candidate* best = NULL;
+    struct probe_candidate* next = NULL;
+    Uint32 count = 0;
+    Uint64 size;
+    Uint8* data;
+    double t = now();
+
+    data = map_input(name, &size);
+    if (!data) {
+        return 0;
+    }
+    hints = probe_hints(name, hint, 2 * PROBE_HINTS, &hint_format, &ten_bit);
+    cand = malloc(sizeof(*cand) * (hints + sizes) * formats);
+    if (!cand) {
+        fprintf(stderr, "Error allocating memory...\n");
+        munmap(data, size);
+        return 0;
+    }
+
+    for (Uint32 s = 0; s < hints + sizes; s++) {
+        Uint32 w = s < hints ? hint[2 * s] : probe_sizes[s - hints].width;
+        Uint32 h = s < hints ? hint[2 * s + 1] : probe_sizes[s - hints].height;
+
+        Uint32 seen = 0;
+
+        /* 1080p and 1080i, or a hint that is also in the table */
+        for (Uint32 k = 0; k < s; k++) {
+            seen |= w == (k < hints ? hint[2 * k] : probe_sizes[k - hints].width) &&
+                    h == (k < hints ? hint[2 * k + 1] : probe_sizes[k - hints].height);
+        }
+        if (seen || w < 2 || h < 2 || w % 2 || h % 2) {
+            continue;
+        }
+        for (Uint32 f = 0; f < formats; f++) {
+            struct probe_candidate* c = &cand[count];
+            Uint64 frame = format_frame_size(f, w, h);
+
+            if (size < frame || size % frame) {
+                continue;
+            }
+            c->width = w;
+            c->height = h;
+            c->format = f;
+            /* a hinted size beats a hinted format, the score decides
+             * between equal ranks */
+            c->rank = (s < hints) * 4 + (f == hint_format) * 2 +
+                      (ten_bit && (f == YV1210 || f == Y42210));
+            c->score = probe_score(data, size, w, h, f);
+            count++;
+        }
+    }
+    munmap(data, size);
+
+    /* YV12 and IYUV (or YUY2 and YVYU) score the same, the planes are
+     * only swapped; IYUV is I420, by far the more common */
+    for (Uint32 i = 0; i < count; i++) {
+        struct probe_candidate* c = &cand[i];
+
+        if (c->score >= 0 && (!best || c->rank > best->rank ||
+                              (c->rank == best->rank && (c->score < best->score ||
+                                                         (c->score == best->score && c->format == IYUV))))) {
+            best = c;
+        }
+    }
+    /* runner-up with another size or frame layout (IYUV is YV12 and
+     * YVYU is YUY2 with the chroma swapped) */
+    for (Uint32 i = 0; best && i < count; i++) {
+        struct probe_candidate* c = &cand[i];
+        Uint32 same = c->width == best->width && c->height == best->height &&
+                      (c->format == best->format ||
+                       ((c->format == YV12 || c->format == IYUV) &&
+                        (best->format == YV12 || best->format == IYUV)) ||
+                       ((c->format == YUY2 || c->format == YVYU) &&
+                        (best->format == YUY2 || best->format == YVYU)));
+
+        if (c->score >= 0 && !same && (!next || c->rank > next->rank ||
+                                       (c->rank == next->rank && c->score < next->score))) {
+            next = c;
+        }
+    }
+    t = now() - t;
+
+    if (!best) {
+        if (report) {
+            fprintf(stderr, "%s: no known size and format fits %llu bytes, "
+                    "width, height and format needed\n", name, (unsigned long long)size);
+        }
+        free(cand);
+        return 0;
+    }
+    if (report) {
+        fprintf(stdout, "%s: probed %ux%u %s (score %.2f", name, best->width, best->height,
+                format_names[best->format], best->score);
+        if (best->format != hint_format &&
+            (best->format == YV12 || best->format == IYUV ||
+             best->format == YUY2 || best->format == YVYU)) {
+            fprintf(stdout, ", Cb/Cr order guessed");
+        }
+        if (next) {
+            fprintf(stdout, ", next %ux%u %s %.2f", next->width, next->height,
+                    format_names[next->format], next->score);
+        }
+        fprintf(stdout, ") from %u candidates in %.1f ms\n", count, t * 1000);
+    }
+    *width = best->width;
+    *height = best->height;
+    *format = best->format;
+    free(cand);
+    return 1;
+}
+
+/* Headless: write the Y, Cb and Cr samples of the selected MBs for every
+ * frame in range to a NumPy .npy file of shape (frames, mbs, samples).
+ * 10 bpp formats keep their full precision as little endian uint16.
+ * Samples outside the frame (partial MBs) are zero. */
+Uint32 extract_mb(void)
+{
+    Uint32 offset[3], pitch[3], width[3], height[3], step[3];
+    Uint32 mb_w[3], mb_h[3];
+    Uint32 bytes = (FORMAT == YV1210 || FORMAT == Y42210) ? 2 : 1;
+    Uint32 samples, frames;
+    Uint64 size, record;
+    Uint8* data;
+    Uint8* out;
+    FILE* fp;
+    char header[256];
+    int len;
+    Uint32 ret = 1;
+
+    if (!P.mb_count) {
+        fprintf(stderr, "No MBs given, use --mbs or --mb-rect\n");
+        return 0;
+    }
+
+    plane_layout(offset, pitch, width, height, step);
+    for (Uint32 p = 0; p < 3; p++) {
+        mb_w[p] = 16 * width[p] / P.width;
+        mb_h[p] = 16 * height[p] / P.height;
+    }
+    samples = mb_w[0] * mb_h[0] + mb_w[1] * mb_h[1] + mb_w[2] * mb_h[2];
+
+    for (Uint32 i = 0; i < P.mb_count; i++) {
+        if (P.mb_list[i * 2] >= P.mb_cols || P.mb_list[i * 2 + 1] >= P.mb_rows) {
+            fprintf(stderr, "MB %u,%u outside of frame\n",
+                    P.mb_list[i * 2], P.mb_list[i * 2 + 1]);
+            return 0;
+        }
+    }
+
+    data = map_input(P.filename, &size);
+    if (!data) {
+        return 0;
+    }
+
+    frames = frame_total(0, size);
+    if (!P.range_set) {
+        P.first_frame = 0;
+        P.last_frame = frames ? frames - 1 : 0;
+    }
+    if (P.last_frame >= frames) {
+        fprintf(stderr, "Frame range outside of file (%u frames)\n", frames);
+        munmap(data, size);
+        return 0;
+    }
+    frames = P.last_frame - P.first_frame + 1;
+
+    record = (Uint64)P.mb_count * samples * bytes;
+    out = calloc(record, 1);
+    fp = fopen(P.extract, "wb");
+    if (!out || !fp) {
+        fprintf(stderr, "Error opening %s\n", P.extract);
+        ret = 0;
+        goto extract_cleanup;
+    }
+
+    /* .npy v1.0: magic, header length, python dict padded to 64 bytes */
+    len = snprintf(header + 10, sizeof(header) - 10,
+                   "{'descr': '%s', 'fortran_order': False, 'shape': (%u, %u, %u), }",
+                   bytes == 2 ? "<u2" : "|u1", frames, P.mb_count, samples);
+    while ((10 + len + 1) % 64) {
+        header[10 + len++] = ' ';
+    }
+    header[10 + len++] = '\n';
+    memcpy(header, "\x93NUMPY\x01\x00", 8);
+    header[8] = len & 0xFF;
+    header[9] = len >> 8;
+    fwrite(header, 1, 10 + len, fp);
+
+    for (Uint32 f = P.first_frame; f <= P.last_frame; f++) {
+        Uint8* frame = data + frame_offset(0, f);
+        Uint8* dst = out;
+
+        for (Uint32 i = 0; i < P.mb_count; i++) {
+            for (Uint32 p = 0; p < 3; p++) {
+                Uint32 x0 = P.mb_list[i * 2] * mb_w[p];
+                Uint32 y0 = P.mb_list[i * 2 + 1] * mb_h[p];
+
+                for (Uint32 y = y0; y < y0 + mb_h[p]; y++) {
+                    for (Uint32 x = x0; x < x0 + mb_w[p]; x++) {
+                        if (y < height[p] && x < width[p]) {
+                            Uint8* src = frame + (Uint64)(offset[p] + y * pitch[p] +
+                                                          x * step[p]) * bytes;
+                            dst[0] = src[0];
+                            if (bytes == 2) {
+                                dst[1] = src[1];
+                            }
+                        } else {
+                            dst[0] = 0;
+                            if (bytes == 2) {
+                                dst[1] = 0;
+                            }
+                        }
+                        dst += bytes;
+                    }
+                }
+            }
+        }
+
+        if (fwrite(out, 1, record, fp) != record) {
+            perror("fwrite");
+            ret = 0;
+            break;
+        }
+    }
+
+    if (ret) {
+        fprintf(stdout, "%u frames x %u MBs x %u samples written to %s\n",
+                frames, P.mb_count, samples, P.extract);
+    }
+
+extract_cleanup:
+    if (fp) {
+        fclose(fp);
+    }
+    free(out);
+    munmap(data, size);
+    return ret;
+}
+
+/* 2.13 fixed point: luma offset, luma scale, Cr->R, Cb->G, Cr->G, Cb->B */
+void rgb_coefficients(Sint32* coef)
+{
+    const double kr[3] = {0.299, 0.2126, 0.2627};
+    const double kb[3] = {0.114, 0.0722, 0.0593};
+    double r = kr[P.matrix];
+    double b = kb[P.matrix];
+    double g = 1.0 - r - b;
+    double ys = P.full_range ? 1.0 : 255.0 / 219.0;
+    double cs = P.full_range ? 1.0 : 255.0 / 224.0;
+
+    coef[0] = P.full_range ? 0 : 16;
+    coef[1] = lrint(ys * 8192);
+    coef[2] = lrint(2 * (1 - r) * cs * 8192);
+    coef[3] = lrint(2 * b * (1 - b) / g * cs * 8192);
+    coef[4] = lrint(2 * r * (1 - r) / g * cs * 8192);
+    coef[5] = lrint(2 * (1 - b) * cs * 8192);
+}
+
+/* one row, cb and cr are horizontally subsampled by two */
+void yuv2rgb_row(Uint8* y, Uint8* cb, Uint8* cr, Uint8* rgb, Uint32 width,
+                 Sint32* coef)
+{
+    Uint8 r[16];
+    Uint8 g[16];
+    Uint8 b[16];
+    Uint32 x = 0;
+
+#ifdef __SSE2__
+    __m128i zero = _mm_setzero_si128();
+    __m128i yoff = _mm_set1_epi16(coef[0]);
+    __m128i coff = _mm_set1_epi16(128);
+    __m128i round = _mm_set1_epi32(1 << 12);
+    /* pairs for pmaddwd: (y, cr) -> R, (y, cb) -> G and B, (cr, 0) -> G;
+     * interleaved rather than shifted, -coef[3] << 16 would be undefined */
+    __m128i k_y = _mm_set1_epi16(coef[1]);
+    __m128i k_r = _mm_unpacklo_epi16(k_y, _mm_set1_epi16(coef[2]));
+    __m128i k_g = _mm_unpacklo_epi16(k_y, _mm_set1_epi16(-coef[3]));
+    __m128i k_gv = _mm_unpacklo_epi16(_mm_set1_epi16(-coef[4]), zero);
+    __m128i k_b = _mm_unpacklo_epi16(k_y, _mm_set1_epi16(coef[5]));
+
+    for (; x + 16 <= width; x += 16) {
+        __m128i vy = _mm_loadu_si128((__m128i*)(y + x));
+        __m128i c8 = _mm_loadl_epi64((__m128i*)(cb + x / 2));
+        __m128i r8 = _mm_loadl_epi64((__m128i*)(cr + x / 2));
+        __m128i vr[2], vg[2], vb[2];
+
+        /* duplicate each chroma sample for its two luma samples */
+        c8 = _mm_unpacklo_epi8(c8, c8);
+        r8 = _mm_unpacklo_epi8(r8, r8);
+
+        for (Uint32 h = 0; h < 2; h++) {
+            __m128i y16 = _mm_sub_epi16(h ? _mm_unpackhi_epi8(vy, zero) :
+                                        _mm_unpacklo_epi8(vy, zero), yoff);
+            __m128i u16 = _mm_sub_epi16(h ? _mm_unpackhi_epi8(c8, zero) :
+                                        _mm_unpacklo_epi8(c8, zero), coff);
+            __m128i v16 = _mm_sub_epi16(h ? _mm_unpackhi_epi8(r8, zero) :
+                                        _mm_unpacklo_epi8(r8, zero), coff);
+            __m128i yv_lo = _mm_unpacklo_epi16(y16, v16);
+            __m128i yv_hi = _mm_unpackhi_epi16(y16, v16);
+            __m128i yu_lo = _mm_unpacklo_epi16(y16, u16);
+            __m128i yu_hi = _mm_unpackhi_epi16(y16, u16);
+            __m128i v_lo = _mm_unpacklo_epi16(v16, zero);
+            __m128i v_hi = _mm_unpackhi_epi16(v16, zero);
+            __m128i lo, hi;
+
+            lo = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(yv_lo, k_r), round), 13);
+            hi = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(yv_hi, k_r), round), 13);
+            vr[h] = _mm_packs_epi32(lo, hi);
+
+            lo = _mm_add_epi32(_mm_madd_epi16(yu_lo, k_g), _mm_madd_epi16(v_lo, k_gv));
+            hi = _mm_add_epi32(_mm_madd_epi16(yu_hi, k_g), _mm_madd_epi16(v_hi, k_gv));
+            lo = _mm_srai_epi32(_mm_add_epi32(lo, round), 13);
+            hi = _mm_srai_epi32(_mm_add_epi32(hi, round), 13);
+            vg[h] = _mm_packs_epi32(lo, hi);
+
+            lo = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(yu_lo, k_b), round), 13);
+            hi = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(yu_hi, k_b), round), 13);
+            vb[h] = _mm_packs_epi32(lo, hi);
+        }
+        _mm_storeu_si128((__m128i*)r, _mm_packus_epi16(vr[0], vr[1]));
+        _mm_storeu_si128((__m128i*)g, _mm_packus_epi16(vg[0], vg[1]));
+        _mm_storeu_si128((__m128i*)b, _mm_packus_epi16(vb[0], vb[1]));
+
+        for (Uint32 i = 0; i < 16; i++) {
+            rgb[3 * (x + i)] = r[i];
+            rgb[3 * (x + i) + 1] = g[i];
+            rgb[3 * (x + i) + 2] = b[i];
+        }
+    }
+#else
+    (void)r;
+    (void)g;
+    (void)b;
+#endif
+
+    for (; x < width; x++) {
+        Sint32 l = (y[x] - coef[0]) * coef[1];
+        Sint32 u = cb[x / 2] - 128;
+        Sint32 v = cr[x / 2] - 128;
+        Sint32 c[3];
+
+        c[0] = (l + coef[2] * v + (1 << 12)) >> 13;
+        c[1] = (l - coef[3] * u - coef[4] * v + (1 << 12)) >> 13;
+        c[2] = (l + coef[5] * u + (1 << 12)) >> 13;
+        for (Uint32 i = 0; i < 3; i++) {
+            rgb[3 * x + i] = c[i] < 0 ? 0 : c[i] > 255 ? 255 : c[i];
+        }
+    }
+}
+
+/* whole frame from planar Y, Cb, Cr (4:2:0 or 4:2:2 as per FORMAT) */
+void yuv2rgb(Uint8* y, Uint8* cb, Uint8* cr, Uint8* rgb, Sint32* coef)
+{
+    Uint32 planar = FORMAT == YV12 || FORMAT == IYUV || FORMAT == YV1210;
+    Uint32 cw = P.width / 2;
+
+    for (Uint32 row = 0; row < P.height; row++) {
+        Uint32 crow = planar ? row / 2 : row;
+
+        yuv2rgb_row(y + row * P.width, cb + crow * cw, cr + crow * cw,
+                    rgb + row * P.width * 3, P.width, coef);
+    }
+}
+
+/* one frame from memory (e.g. mapped file) to 8 bit planes in Y, Cb, Cr
+ * order; 10 bpp is rounded like ten2eight(), NULL planes are skipped */
+void decode_frame(Uint8* frame, Uint8* y, Uint8* cb, Uint8* cr)
+{
+    Uint32 offset[3], pitch[3], width[3], height[3], step[3];
+    Uint8* dst[3] = {y, cb, cr};
+
+    plane_layout(offset, pitch, width, height, step);
+
+    for (Uint32 p = 0; p < 3; p++) {
+        Uint8* d = dst[p];
+
+        for (Uint32 row = 0; d && row < height[p]; row++) {
+            Uint32 start = offset[p] + row * pitch[p];
+
+            if (FORMAT == YV1210 || FORMAT == Y42210) {
+                ten2eight(frame + start * 2, d, width[p] * 2);
+            } else if (step[p] == 1) {
+                memcpy(d, frame + start, width[p]);
+            } else {
+                for (Uint32 x = 0; x < width[p]; x++) {
+                    d[x] = frame[start + x * step[p]];
+                }
+            }
+            d += width[p];
+        }
+    }
+}
+
+Uint32 write_ppm(char* name, Uint8* rgb, Uint32 width, Uint32 height)
+{
+    FILE* fp = fopen(name, "wb");
+    Uint32 ret = 1;
+
+    if (!fp) {
+        fprintf(stderr, "Error opening %s\n", name);
+        return 0;
+    }
+    fprintf(fp, "P6\n%u %u\n255\n", width, height);
+    if (fwrite(rgb, 3, width * height, fp) != width * height) {
+        perror("fwrite");
+        ret = 0;
+    }
+    fclose(fp);
+    return ret;
+}
+
+/* Minimal PNG: 8 bit RGB, filter none, deflate stored blocks. Bigger
+ * than it could be but exact, fast and needs no zlib. */
+Uint32 write_png(char* name, Uint8* rgb, Uint32 width, Uint32 height)
+{
+    static Uint32 crc_table[256];
+    Uint32 row = width * 3 + 1;
+    Uint64 raw = (Uint64)row * height;
+    Uint64 blocks = (raw + 65534) / 65535;
+    Uint64 idat = 2 + blocks * 5 + raw + 4;
+    Uint32 crc, a = 1, b = 0;
+    Uint64 left = raw;
+    Uint32 in_block = 0;
+    Uint8 hdr[32];
+    FILE* fp;
+
+    if (idat > 0x7FFFFFFF) {
+        fprintf(stderr, "Frame too large for PNG\n");
+        return 0;
+    }
+
+    if (!crc_table[1]) {
+        for (Uint32 n = 0; n < 256; n++) {
+            Uint32 c = n;
+            for (Uint32 k = 0; k < 8; k++) {
+                c = c & 1 ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+            }
+            crc_table[n] = c;
+        }
+    }
+
+#define PNG_PUT32(p, v) do { (p)[0] = (v) >> 24; (p)[1] = (v) >> 16; \
+                             (p)[2] = (v) >> 8; (p)[3] = (v); } while (0)
+#define PNG_CRC(c, p, n) do { for (Uint32 k_ = 0; k_ < (n); k_++) \
+        c = crc_table[(c ^ (p)[k_]) & 0xFF] ^ (c >> 8); } while (0)
+
+    fp = fopen(name, "wb");
+    if (!fp) {
+        fprintf(stderr, "Error opening %s\n", name);
+        return 0;
+    }
+    fwrite("\x89PNG\r\n\x1a\n", 1, 8, fp);
+
+    /* IHDR */
+    PNG_PUT32(hdr, 13);
+    memcpy(hdr + 4, "IHDR", 4);
+    PNG_PUT32(hdr + 8, width);
+    PNG_PUT32(hdr + 12, height);
+    hdr[16] = 8;        /* bit depth */
+    hdr[17] = 2;        /* RGB */
+    hdr[18] = hdr[19] = hdr[20] = 0;
+    crc = 0xFFFFFFFF;
+    PNG_CRC(crc, hdr + 4, 17);
+    PNG_PUT32(hdr + 21, crc ^ 0xFFFFFFFF);
+    fwrite(hdr, 1, 25, fp);
+
+    /* IDAT: zlib header, stored blocks, adler32 */
+    PNG_PUT32(hdr, (Uint32)idat);
+    memcpy(hdr + 4, "IDAT", 4);
+    hdr[8] = 0x78;
+    hdr[9] = 0x01;
+    crc = 0xFFFFFFFF;
+    PNG_CRC(crc, hdr + 4, 6);
+    fwrite(hdr, 1, 10, fp);
+
+    for (Uint32 y = 0; y < height; y++) {
+        Uint8 filter = 0;
+
+        for (Uint32 pos = 0; pos < row; ) {
+            Uint8* src = pos ? rgb + (Uint64)y * width * 3 + pos - 1 : &filter;
+            Uint32 n = pos ? row - pos : 1;
+
+            if (!in_block) {
+                in_block = left > 65535 ? 65535 : left;
+                hdr[0] = left == in_block;      /* BFINAL, stored */
+                hdr[1] = in_block & 0xFF;
+                hdr[2] = in_block >> 8;
+                hdr[3] = ~in_block & 0xFF;
+                hdr[4] = (~in_block >> 8) & 0xFF;
+                PNG_CRC(crc, hdr, 5);
+                fwrite(hdr, 1, 5, fp);
+                left -= in_block;
+            }
+            if (n > in_block) {
+                n = in_block;
+            }
+            PNG_CRC(crc, src, n);
+            for (Uint32 k = 0; k < n; k++) {
+                a = (a + src[k]) % 65521;
+                b = (b + a) % 65521;
+            }
+            fwrite(src, 1, n, fp);
+            in_block -= n;
+            pos += n;
+        }
+    }
+
+    PNG_PUT32(hdr, (b << 16) | a);
+    PNG_CRC(crc, hdr, 4);
+    PNG_PUT32(hdr + 4, crc ^ 0xFFFFFFFF);
+    fwrite(hdr, 1, 8, fp);
+
+    /* IEND */
+    PNG_PUT32(hdr, 0);
+    memcpy(hdr + 4, "IEND\xae\x42\x60\x82", 8);
+    fwrite(hdr, 1, 12, fp);
+
+#undef PNG_PUT32
+#undef PNG_CRC
+
+    if (fclose(fp)) {
+        perror("fclose");
+        return 0;
+    }
+    return 1;
+}
+
+/* .png or .ppm by extension */
+Uint32 write_image(char* name, Uint8* rgb, Uint32 width, Uint32 height)
+{
+    Uint32 len = strlen(name);
+
+    if (len > 4 && !strcmp(name + len - 4, ".png")) {
+        return write_png(name, rgb, width, height);
+    }
+    return write_ppm(name, rgb, width, height);
+}
+
+/* "dir/out.png" + 12 -> "dir/out_000012.png" */
+void image_name(char* dst, Uint32 bytes, char* pattern, Uint32 frame)
+{
+    char* dot = strrchr(pattern, '.');
+    char* slash = strrchr(pattern, '/');
+    int stem = (dot && (!slash || dot > slash)) ? dot - pattern : (int)strlen(pattern);
+
+    snprintf(dst, bytes, "%.*s_%06u%s", stem, pattern, frame,
+             pattern + stem);
+}
+
+/* 'p': current frame as <clip>_NNNNNN.png in the working directory */
+Uint32 dump_frame(void)
+{
+    Sint32 coef[6];
+    char name[512];
+    char* base = strrchr(P.filename, '/');
+    Uint8* rgb;
+    Uint32 ret;
+
+    rgb = malloc((size_t)P.wh * 3);
+    if (!rgb) {
+        fprintf(stderr, "Error allocating memory...\n");
+        return 0;
+    }
+
+    rgb_coefficients(coef);
+    /* YV12 keeps Cr first, so cb_data holds Cr there */
+    if (FORMAT == YV12 || FORMAT == YV1210) {
+        yuv2rgb(P.y_data, P.cr_data, P.cb_data, rgb, coef);
+    } else {
+        yuv2rgb(P.y_data, P.cb_data, P.cr_data, rgb, coef);
+    }
+
+    base = base ? base + 1 : P.filename;
+    snprintf(name, sizeof(name), "%.*s_%06u.png",
+             strrchr(base, '.') ? (int)(strrchr(base, '.') - base) : (int)strlen(base),
+             base, R.frame - 1);
+    ret = write_png(name, rgb, P.width, P.height);
+    if (ret) {
+        printf("Wrote %s\n", name);
+        fflush(stdout);
+    }
+    free(rgb);
+    return ret;
+}
+
+struct export_state {
+    Uint8* data;              /* mapped input */
+    Uint32 failed;
+};
+
+/* worker: every count'th frame of the range, own buffers */
+void export_job(void* arg, Uint32 index, Uint32 count)
+{
+    struct export_state* ex = arg;
+    Uint8* planes = malloc(P.y_size + P.cb_size + P.cr_size);
+    Uint8* rgb = malloc((size_t)P.wh * 3);
+    Sint32 coef[6];
+    char name[512];
+
+    if (!planes || !rgb) {
+        fprintf(stderr, "Error allocating memory...\n");
+        ex->failed = 1;
+        goto export_cleanup;
+    }
+    rgb_coefficients(coef);
+
+    for (Uint32 f = P.first_frame + index; f <= P.last_frame; f += count) {
+        decode_frame(ex->data + frame_offset(0, f), planes,
+                     planes + P.y_size, planes + P.y_size + P.cb_size);
+        yuv2rgb(planes, planes + P.y_size, planes + P.y_size + P.cb_size, rgb, coef);
+        image_name(name, sizeof(name), P.export, f);
+        if (!write_image(name, rgb, P.width, P.height)) {
+            ex->failed = 1;
+            break;
+        }
+    }
+
+export_cleanup:
+    free(rgb);
+    free(planes);
+}
+
+/* headless: frame range to PPM/PNG, frames spread over the pool */
+Uint32 export_frames(void)
+{
+    struct export_state ex;
+    Uint64 size;
+    Uint32 frames;
+    double t;
+
+    ex.failed = 0;
+    ex.data = map_input(P.filename, &size);
+    if (!ex.data) {
+        return 0;
+    }
+
+    frames = frame_total(0, size);
+    if (!P.range_set) {
+        P.first_frame = 0;
+        P.last_frame = frames ? frames - 1 : 0;
+    }
+    if (P.last_frame >= frames) {
+        fprintf(stderr, "Frame range outside of file (%u frames)\n", frames);
+        munmap(ex.data, size);
+        return 0;
+    }
+
+    t = now();
+    pool_run(export_job, &ex);
+    t = now() - t;
+
+    if (!ex.failed) {
+        frames = P.last_frame - P.first_frame + 1;
+        fprintf(stdout, "%u frames exported in %.2f s (%.1f fps, %u threads)\n",
+                frames, t, frames / t, POOL.count);
+    }
+    munmap(ex.data, size);
+    return !ex.failed;
+}
+
+/* Transcoding goes through a 10 bit 4:2:2 intermediate, lossless for
+ * every supported format: 8 bit samples are shifted up, 4:2:0 chroma
+ * rows are doubled (and averaged back on the way down). */
+struct convert_state {
+    Uint8* data;              /* mapped input */
+    Uint8* diff;              /* mapped diff file or NULL */
+    Uint8* out;               /* batch of output frames */
+    Uint32 first;             /* frame number of first frame in batch */
+    Uint32 frames;            /* frames in batch */
+    Uint64 out_size;          /* bytes per output frame */
+    Uint32 failed;
+};
+
+/* one frame of FORMAT to intermediate planes */
+void load_frame(Uint8* frame, Uint16* y, Uint16* cb, Uint16* cr)
+{
+    Uint32 offset[3], pitch[3], width[3], height[3], step[3];
+    Uint32 wide = FORMAT == YV1210 || FORMAT == Y42210;
+    Uint16* dst[3] = {y, cb, cr};
+
+    plane_layout(offset, pitch, width, height, step);
+
+    for (Uint32 p = 0; p < 3; p++) {
+        /* 4:2:0 chroma rows are stored twice */
+        Uint32 repeat = p && height[p] != P.height ? 2 : 1;
+
+        for (Uint32 row = 0; row < P.height; row++) {
+            Uint16* d = dst[p] + row * width[p];
+            Uint8* src = frame + (offset[p] + row / repeat * pitch[p]) * (wide + 1);
+
+            if (wide) {
+                for (Uint32 x = 0; x < width[p]; x++, src += 2) {
+                    d[x] = src[0] | (src[1] << 8);
+                }
+            } else {
+                for (Uint32 x = 0; x < width[p]; x++, src += step[p]) {
+                    d[x] = *src << 2;
+                }
+            }
+        }
+    }
+}
+
+/* intermediate planes to one frame of P.out_format, cropped */
+void store_frame(Uint16* planes, Uint8* out)
+{
+    Uint32 offset[3], pitch[3], width[3], height[3], step[3];
+    Uint32 wide = P.out_format == YV1210 || P.out_format == Y42210;
+    Uint16* src[3] = {planes, planes + P.wh, planes + P.wh + P.wh / 2};
+
+    format_layout(P.out_format, P.crop[2], P.crop[3], offset, pitch, width,
+                  height, step);
+
+    for (Uint32 p = 0; p < 3; p++) {
+        Uint32 half = p ? 2 : 1;
+        Uint32 sw = P.width / half;
+        Uint32 sub = height[p] != P.crop[3];
+
+        for (Uint32 row = 0; row < height[p]; row++) {
+            Uint32 sy = P.crop[1] + (row << sub);
+            Uint16* s0 = src[p] + sy * sw + P.crop[0] / half;
+            Uint16* s1 = sub ? s0 + sw : s0;
+            Uint8* d = out + (offset[p] + row * pitch[p]) * (wide + 1);
+            Uint32 blank = P.blank & (1 << p);
+
+            if (wide) {
+                for (Uint32 x = 0; x < width[p]; x++, d += 2) {
+                    Uint32 v = blank ? 512 : (s0[x] + s1[x] + 1) >> 1;
+
+                    d[0] = v & 0xFF;
+                    d[1] = v >> 8;
+                }
+            } else if (blank) {
+                for (Uint32 x = 0; x < width[p]; x++, d += step[p]) {
+                    *d = 0x80;
+                }
+            } else {
+                for (Uint32 x = 0; x < width[p]; x++, d += step[p]) {
+                    Uint32 v = (((s0[x] + s1[x] + 1) >> 1) + 2) >> 2;
+
+                    *d = v > 255 ? 255 : v;
+                }
+            }
+        }
+    }
+}
+
+/* worker: every count'th frame of the batch */
+void convert_job(void* arg, Uint32 index, Uint32 count)
+{
+    struct convert_state* cv = arg;
+    Uint32 samples = P.wh * 2;
+    Uint16* planes = malloc(sizeof(Uint16) * samples * (cv->diff ? 2 : 1));
+
+    if (!planes) {
+        fprintf(stderr, "Error allocating memory...\n");
+        cv->failed = 1;
+        return;
+    }
+
+    for (Uint32 f = index; f < cv->frames; f += count) {
+        load_frame(cv->data + frame_offset(0, cv->first + f), planes, planes + P.wh, planes + P.wh + P.wh / 2);
+        if (cv->diff) {
+            Uint16* cmp = planes + samples;
+
+            /* same result as diff_mode(): 8 bit luma difference around
+             * 0x80, wrapping, and grey chroma */
+            load_frame(cv->diff + frame_offset(1, cv->first + f), cmp, cmp + P.wh, cmp + P.wh + P.wh / 2);
+            for (Uint32 i = 0; i < P.wh; i++) {
+                Uint8 d = 0x80 - (((planes[i] + 2) >> 2) - ((cmp[i] + 2) >> 2));
+                planes[i] = d << 2;
+            }
+            for (Uint32 i = P.wh; i < samples; i++) {
+                planes[i] = 512;
+            }
+        }
+        store_frame(planes, cv->out + f * cv->out_size);
+    }
+    free(planes);
+}
+
+/* unchanged frames: let the kernel copy, else write from the mapping */
+Uint32 copy_frames(int in, int out, Uint64 offset, Uint64 length, Uint8* data)
+{
+    loff_t off = offset;
+
+    while (length) {
+        ssize_t n = copy_file_range(in, &off, out, NULL, length, 0);
+
+        if (n <= 0) {
+            break;
+        }
+        length -= n;
+    }
+
+    offset = off;
+    while (length) {
+        ssize_t n = write(out, data + offset, length > (1 << 24) ? 1 << 24 : length);
+
+        if (n < 0) {
+            perror("write");
+            return 0;
+        }
+        offset += n;
+        length -= n;
+    }
+    return 1;
+}
+
+/* Headless: frame range to a raw file, optionally converted to another
+ * format, cropped, with planes blanked or as diff against the diff file */
+Uint32 write_frames(void)
+{
+    struct convert_state cv;
+    Uint64 size, diff_size = 0, batch;
+    Uint32 frames;
+    Uint32 ret = 1;
+    double t;
+    int in = -1;
+    int out = -1;
+
+    memset(&cv, 0, sizeof(cv));
+    if (!P.out_format_set) {
+        P.out_format = FORMAT;
+    }
+    if (!P.crop[2]) {
+        P.crop[2] = P.width;
+        P.crop[3] = P.height;
+    }
+    if (P.crop[0] + P.crop[2] > P.width || P.crop[1] + P.crop[3] > P.height ||
+        (P.crop[0] | P.crop[2]) & 1 ||
+        ((P.out_format == YV12 || P.out_format == IYUV || P.out_format == YV1210) &&
+         (P.crop[1] | P.crop[3]) & 1)) {
+        fprintf(stderr, "Crop must be inside the frame and aligned to the chroma grid\n");
+        return 0;
+    }
+
+    cv.data = map_input(P.filename, &size);
+    if (!cv.data) {
+        return 0;
+    }
+    frames = frame_total(0, size);
+    if (P.diff) {
+        cv.diff = map_input(P.fname_diff, &diff_size);
+        if (!cv.diff) {
+            ret = 0;
+            goto write_cleanup;
+        }
+        if (frame_total(1, diff_size) < frames) {
+            frames = frame_total(1, diff_size);
+        }
+    }
+    if (!P.range_set) {
+        P.first_frame = 0;
+        P.last_frame = frames ? frames - 1 : 0;
+    }
+    if (!frames || P.last_frame >= frames) {
+        fprintf(stderr, "Frame range outside of file (%u frames)\n", frames);
+        ret = 0;
+        goto write_cleanup;
+    }
+    frames = P.last_frame - P.first_frame + 1;
+
+    out = open(P.output, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (out < 0) {
+        fprintf(stderr, "Error opening %s\n", P.output);
+        ret = 0;
+        goto write_cleanup;
+    }
+
+    t = now();
+    cv.out_size = format_frame_size(P.out_format, P.crop[2], P.crop[3]);
+    if (P.out_format == FORMAT && P.crop[2] == P.width && P.crop[3] == P.height &&
+        !P.blank && !P.diff && !P.index[0].offset) {
+        in = open(P.filename, O_RDONLY);
+        ret = in >= 0 && copy_frames(in, out, (Uint64)P.first_frame * P.file_frame_size,
+                                     (Uint64)frames * P.file_frame_size, cv.data);
+    } else {
+        /* batches of at least 16 MB, one write each */
+        batch = ((1 << 24) + cv.out_size - 1) / cv.out_size;
+        if (batch < POOL.count) {
+            batch = POOL.count;
+        }
+        if (batch > frames) {
+            batch = frames;
+        }
+        cv.out = malloc(batch * cv.out_size);
+        if (!cv.out) {
+            fprintf(stderr, "Error allocating memory...\n");
+            ret = 0;
+            goto write_cleanup;
+        }
+        for (cv.first = P.first_frame; cv.first <= P.last_frame && ret;
+             cv.first += cv.frames) {
+            Uint64 left;
+            Uint8* src = cv.out;
+
+            cv.frames = P.last_frame - cv.first + 1 < batch ?
+                        P.last_frame - cv.first + 1 : batch;
+            pool_run(convert_job, &cv);
+            if (cv.failed) {
+                ret = 0;
+                break;
+            }
+            for (left = cv.frames * cv.out_size; left; ) {
+                ssize_t n = write(out, src, left);
+
+                if (n < 0) {
+                    perror("write");
+                    ret = 0;
+                    break;
+                }
+                src += n;
+                left -= n;
+            }
+        }
+    }
+    t = now() - t;
+
+    if (ret) {
+        fprintf(stdout, "%u frames (%.1f MB) written to %s in %.2f s (%.1f MB/s)\n",
+                frames, frames * cv.out_size / 1e6, P.output, t,
+                frames * cv.out_size / 1e6 / t);
+    }
+
+write_cleanup:
+    if (out >= 0 && close(out)) {
+        perror("close");
+        ret = 0;
+    }
+    if (in >= 0) {
+        close(in);
+    }
+    free(cv.out);
+    if (cv.diff) {
+        munmap(cv.diff, diff_size);
+    }
+    munmap(cv.data, size);
+    return ret;
+}
+
+/* sum, sum of squares and, if prev is given, SAD of n luma samples */
+void luma_stats(Uint8* cur, Uint8* prev, Uint32 n, Uint64* sum, Uint64* sq,
+                Uint64* sad)
+{
+    Uint64 s = 0;
+    Uint64 q = 0;
+    Uint64 d = 0;
+    Uint32 i = 0;
+
+#ifdef __SSE2__
+    __m128i zero = _mm_setzero_si128();
+    __m128i vs = zero;
+    __m128i vd = zero;
+    Uint32 lane[4];
+    Uint64 wide[2];
+
+    while (n - i >= 16) {
+        /* 32 bit square sums would overflow, flush every 4096 vectors */
+        Uint32 end = n - i > 16 * 4096 ? i + 16 * 4096 : i + ((n - i) & ~15u);
+        __m128i vq = zero;
+
+        for (; i < end; i += 16) {
+            __m128i v = _mm_loadu_si128((__m128i*)(cur + i));
+            __m128i lo = _mm_unpacklo_epi8(v, zero);
+            __m128i hi = _mm_unpackhi_epi8(v, zero);
+
+            vs = _mm_add_epi64(vs, _mm_sad_epu8(v, zero));
+            vq = _mm_add_epi32(vq, _mm_madd_epi16(lo, lo));
+            vq = _mm_add_epi32(vq, _mm_madd_epi16(hi, hi));
+            if (prev) {
+                vd = _mm_add_epi64(vd, _mm_sad_epu8(v, _mm_loadu_si128((__m128i*)(prev + i))));
+            }
+        }
+        _mm_storeu_si128((__m128i*)lane, vq);
+        q += (Uint64)lane[0] + lane[1] + lane[2] + lane[3];
+    }
+    /* the sums pass 2^32 on large frames, keep all 64 bits of each lane */
+    _mm_storeu_si128((__m128i*)wide, vs);
+    s = wide[0] + wide[1];
+    _mm_storeu_si128((__m128i*)wide, vd);
+    d = wide[0] + wide[1];
+#endif
+
+    for (; i < n; i++) {
+        s += cur[i];
+        q += cur[i] * cur[i];
+        if (prev) {
+            d += abs(cur[i] - prev[i]);
+        }
+    }
+    *sum = s;
+    *sq = q;
+    *sad = d;
+}
+
+struct analyse_state {
+    Uint8* data;              /* mapped input */
+    Uint32 first;
+    Uint32 count;
+    Uint32 failed;
+};
+
+/* worker: one contiguous chunk of frames, so only the first frame of the
+ * chunk needs its predecessor decoded twice */
+void analyse_job(void* arg, Uint32 index, Uint32 count)
+{
+    struct analyse_state* an = arg;
+    Uint32 start = (Uint64)an->count * index / count;
+    Uint32 end = (Uint64)an->count * (index + 1) / count;
+    Uint8* cur = malloc(P.wh);
+    Uint8* prev = malloc(P.wh);
+
+    if (!cur || !prev) {
+        fprintf(stderr, "Error allocating memory...\n");
+        an->failed = 1;
+        goto analyse_cleanup;
+    }
+
+    for (Uint32 i = start; i < end; i++) {
+        Uint32 f = an->first + i;
+        struct frame_stats* st = &P.stats[i];
+        Uint64 sum, sq, sad;
+        Uint8* tmp;
+
+        if (i == start && f > 0) {
+            decode_frame(an->data + frame_offset(0, f - 1), prev, NULL, NULL);
+        }
+        decode_frame(an->data + frame_offset(0, f), cur, NULL, NULL);
+        luma_stats(cur, f > 0 ? prev : NULL, P.wh, &sum, &sq, &sad);
+
+        st->mean = (double)sum / P.wh;
+        st->variance = (double)sq / P.wh - st->mean * st->mean;
+        st->sad = (double)sad / P.wh;
+        st->flags = 0;
+
+        tmp = prev;
+        prev = cur;
+        cur = tmp;
+    }
+
+analyse_cleanup:
+    free(prev);
+    free(cur);
+}
+
+/* luma statistics of frames first..last spread over the pool, then
+ * flag cuts, black and frozen frames */
+Uint32 analyse_clip(Uint32 first, Uint32 last)
+{
+    struct analyse_state an;
+    struct frame_stats* st;
+    Uint32 cuts = 0, black = 0, frozen = 0;
+    Uint64 size;
+    double t;
+
+    if (PAK.packed) {
+        fprintf(stderr, "%s: clip analysis reads raw or Y4M input\n", P.filename);
+        return 0;
+    }
+    an.data = map_input(P.filename, &size);
+    if (!an.data) {
+        return 0;
+    }
+    an.first = first;
+    an.count = last - first + 1;
+    an.failed = 0;
+
+    free(P.stats);
+    P.stats = malloc(sizeof(struct frame_stats) * an.count);
+    if (!P.stats) {
+        fprintf(stderr, "Error allocating memory...\n");
+        munmap(an.data, size);
+        return 0;
+    }
+
+    t = now();
+    pool_run(analyse_job, &an);
+    t = now() - t;
+    munmap(an.data, size);
+    if (an.failed) {
+        free(P.stats);
+        P.stats = NULL;
+        return 0;
+    }
+    P.stats_first = first;
+    P.stats_count = an.count;
+
+    for (Uint32 i = 0; i < an.count; i++) {
+        double recent = 0;
+        Uint32 n = 0;
+
+        st = &P.stats[i];
+        if (st->mean <= BLACK_LEVEL && st->variance <= BLACK_VARIANCE) {
+            st->flags |= STAT_BLACK;
+            black++;
+        }
+        if (first + i == 0) {
+            continue;
+        }
+        if (st->sad <= FROZEN_SAD) {
+            st->flags |= STAT_FROZEN;
+            frozen++;
+        }
+        /* earlier cuts would hide a cut shortly after them */
+        for (Uint32 j = i > CUT_WINDOW ? i - CUT_WINDOW : 0; j < i; j++) {
+            if (!(P.stats[j].flags & STAT_CUT)) {
+                recent += P.stats[j].sad;
+                n++;
+            }
+        }
+        if (st->sad >= CUT_SAD && (!n || st->sad >= CUT_RATIO * recent / n)) {
+            st->flags |= STAT_CUT;
+            cuts++;
+        }
+    }
+
+    fprintf(stdout, "%u frames analysed in %.2f s (%.1f fps): %u cuts, %u black, %u frozen\n",
+            an.count, t, an.count / t, cuts, black, frozen);
+    return 1;
+}
+
+/* headless: timeline of the frame range as CSV */
+Uint32 write_stats(void)
+{
+    struct stat st;
+    Uint32 frames;
+    FILE* fp;
+
+    if (stat(P.filename, &st)) {
+        fprintf(stderr, "Error opening %s\n", P.filename);
+        return 0;
+    }
+    frames = frame_total(0, st.st_size);
+    if (!P.range_set) {
+        P.first_frame = 0;
+        P.last_frame = frames ? frames - 1 : 0;
+    }
+    if (!frames || P.last_frame >= frames) {
+        fprintf(stderr, "Frame range outside of file (%u frames)\n", frames);
+        return 0;
+    }
+    if (!analyse_clip(P.first_frame, P.last_frame)) {
+        return 0;
+    }
+
+    fp = fopen(P.stats_file, "w");
+    if (!fp) {
+        fprintf(stderr, "Error opening %s\n", P.stats_file);
+        return 0;
+    }
+    fprintf(fp, "frame,mean,variance,sad,cut,black,frozen\n");
+    for (Uint32 i = 0; i < P.stats_count; i++) {
+        struct frame_stats* st = &P.stats[i];
+
+        fprintf(fp, "%u,%.3f,%.3f,%.3f,%d,%d,%d\n", P.stats_first + i,
+                st->mean, st->variance, st->sad, !!(st->flags & STAT_CUT),
+                !!(st->flags & STAT_BLACK), !!(st->flags & STAT_FROZEN));
+    }
+    if (fclose(fp)) {
+        perror("fclose");
+        return 0;
+    }
+    return 1;
+}
+
+/* 'n': jump to the next cut, black or frozen frame, the first press
+ * analyses the whole clip */
+void next_event(void)
+{
+    Uint32 cur = R.frame ? R.frame - 1 : 0;
+
+    if (!P.num_frames) {
+        return;
+    }
+    if (!P.stats && !analyse_clip(0, P.num_frames - 1)) {
+        return;
+    }
+
+    for (Uint32 i = 0; i < P.stats_count; i++) {
+        Uint32 f = P.stats_first + i;
+        Uint32 flags = P.stats[i].flags;
+
+        if ((R.frame && f <= cur) || !flags) {
+            continue;
+        }
+        /* a run of frozen or black frames only counts once */
+        if (!(flags & STAT_CUT) && i && (P.stats[i - 1].flags & flags)) {
+            continue;
+        }
+        if (goto_frame(f)) {
+            R.frame = f + 1;
+            send_message(GOTO, R.frame - 1);
+            fprintf(stdout, "Frame %u:%s%s%s\n", f,
+                    flags & STAT_CUT ? " cut" : "",
+                    flags & STAT_BLACK ? " black" : "",
+                    flags & STAT_FROZEN ? " frozen" : "");
+            fflush(stdout);
+        }
+        return;
+    }
+    fprintf(stdout, "No more cuts or anomalies\n");
+    fflush(stdout);
+}
+
+/* Gradients of rows y0..y1 (y0 a multiple of 8) of an 8 bit luma plane:
+ * |dx| summed per column into colsum, |dy| per row into rowsum, and per
+ * 8x8 block the sums behind the blockiness overlay and ringing. pad is
+ * scratch of width + 1 bytes, so that x - 1 can be loaded at x = 0 */
+void block_rows(Uint8* luma, Uint32 y0, Uint32 y1, Uint8* pad, Uint32* colsum,
+                Uint32* rowsum, struct block_sums* blocks)
+{
+    Uint32 w = P.width;
+    Uint32 bw = (w + 7) / 8;
+
+    for (Uint32 y = y0; y < y1; y++) {
+        Uint8* cur = luma + y * w;
+        Uint8* up = y ? cur - w : cur;
+        struct block_sums* brow = blocks + (y / 8) * bw;
+        /* the first row of a frame has no block above it */
+        Uint32 top = y % 8 == 0 && y > 0;
+        Uint32 rs = 0;
+        Uint32 x = 0;
+
+        pad[0] = cur[0];
+        memcpy(pad + 1, cur, w);
+
+#ifdef __SSE2__
+        __m128i zero = _mm_setzero_si128();
+        __m128i one = _mm_set1_epi8(1);
+        __m128i strong = _mm_set1_epi8((char)EDGE_STRONG);
+        __m128i smooth_max = _mm_set1_epi8(EDGE_SMOOTH - 1);
+
+        for (; x + 16 <= w; x += 16) {
+            __m128i c = _mm_loadu_si128((__m128i*)(cur + x));
+            __m128i l = _mm_loadu_si128((__m128i*)(pad + x));
+            __m128i u = _mm_loadu_si128((__m128i*)(up + x));
+            __m128i dx = _mm_or_si128(_mm_subs_epu8(c, l), _mm_subs_epu8(l, c));
+            __m128i dy = _mm_or_si128(_mm_subs_epu8(c, u), _mm_subs_epu8(u, c));
+            __m128i g = _mm_adds_epu8(dx, dy);
+            __m128i edge = _mm_cmpeq_epi8(_mm_max_epu8(g, strong), g);
+            __m128i smooth = _mm_cmpeq_epi8(_mm_min_epu8(g, smooth_max), g);
+            /* psadbw against zero: one sum per 8 pels, i.e. per block */
+            __m128i sx = _mm_sad_epu8(dx, zero);
+            __m128i sy = _mm_sad_epu8(dy, zero);
+            __m128i se = _mm_sad_epu8(_mm_and_si128(edge, one), zero);
+            __m128i ss = _mm_sad_epu8(_mm_and_si128(g, smooth), zero);
+            __m128i sn = _mm_sad_epu8(_mm_and_si128(smooth, one), zero);
+            __m128i lo = _mm_unpacklo_epi8(dx, zero);
+            __m128i hi = _mm_unpackhi_epi8(dx, zero);
+            __m128i* cs = (__m128i*)(colsum + x);
+
+            _mm_storeu_si128(cs, _mm_add_epi32(_mm_loadu_si128(cs), _mm_unpacklo_epi16(lo, zero)));
+            _mm_storeu_si128(cs + 1, _mm_add_epi32(_mm_loadu_si128(cs + 1), _mm_unpackhi_epi16(lo, zero)));
+            _mm_storeu_si128(cs + 2, _mm_add_epi32(_mm_loadu_si128(cs + 2), _mm_unpacklo_epi16(hi, zero)));
+            _mm_storeu_si128(cs + 3, _mm_add_epi32(_mm_loadu_si128(cs + 3), _mm_unpackhi_epi16(hi, zero)));
+
+            /* the sums sit in 16 bit lanes 0 and 4 */
+            Uint32 sum[5][2] = {
+                {_mm_cvtsi128_si32(sx), _mm_extract_epi16(sx, 4)},
+                {_mm_cvtsi128_si32(sy), _mm_extract_epi16(sy, 4)},
+                {_mm_cvtsi128_si32(se), _mm_extract_epi16(se, 4)},
+                {_mm_cvtsi128_si32(ss), _mm_extract_epi16(ss, 4)},
+                {_mm_cvtsi128_si32(sn), _mm_extract_epi16(sn, 4)}};
+
+            for (Uint32 h = 0; h < 2; h++) {
+                struct block_sums* b = brow + x / 8 + h;
+                Uint32 bx = abs(cur[x + 8 * h] - pad[x + 8 * h]);
+
+                b->border += bx + (top ? sum[1][h] : 0);
+                b->inner += sum[0][h] - bx + (top ? 0 : sum[1][h]);
+                b->edge += sum[2][h];
+                b->smooth += sum[3][h];
+                b->smooth_n += sum[4][h];
+                rs += sum[1][h];
+            }
+        }
+#endif
+
+        for (; x < w; x++) {
+            struct block_sums* b = brow + x / 8;
+            Uint32 dx = abs(cur[x] - pad[x]);
+            Uint32 dy = abs(cur[x] - up[x]);
+            Uint32 g = dx + dy > 255 ? 255 : dx + dy;
+
+            colsum[x] += dx;
+            rs += dy;
+            if (x % 8 == 0) {
+                b->border += dx;
+            } else {
+                b->inner += dx;
+            }
+            if (top) {
+                b->border += dy;
+            } else {
+                b->inner += dy;
+            }
+            if (g >= EDGE_STRONG) {
+                b->edge++;
+            }
+            if (g < EDGE_SMOOTH) {
+                b->smooth += g;
+                b->smooth_n++;
+            }
+        }
+        rowsum[y] = rs;
+    }
+}
+
+/* Blockiness: mean gradient across the 8x8, 16x16 and CTU grid over the
+ * mean gradient off the 8x8 grid, 1.0 is no visible grid. Ringing: mean
+ * gradient of smooth pels in 8x8 blocks with an edge over the same in
+ * blocks without one */
+void artifact_result(Uint32* colsum, Uint32* rowsum, struct block_sums* blocks,
+                     struct artifacts* out)
+{
+    Uint32 sizes[3] = {8, 16, P.ctu};
+    Uint32 nblocks = (P.width + 7) / 8 * ((P.height + 7) / 8);
+    double inner = 0;
+    Uint64 inner_n = 0;
+    double edge_s = 0, flat_s = 0;
+    Uint64 edge_n = 0, flat_n = 0;
+
+    for (Uint32 x = 1; x < P.width; x++) {
+        if (x % 8) {
+            inner += colsum[x];
+            inner_n += P.height;
+        }
+    }
+    for (Uint32 y = 1; y < P.height; y++) {
+        if (y % 8) {
+            inner += rowsum[y];
+            inner_n += P.width;
+        }
+    }
+    inner = inner_n ? inner / inner_n : 0;
+
+    for (Uint32 i = 0; i < 3; i++) {
+        double border = 0;
+        Uint64 border_n = 0;
+
+        for (Uint32 x = sizes[i]; x < P.width; x += sizes[i]) {
+            border += colsum[x];
+            border_n += P.height;
+        }
+        for (Uint32 y = sizes[i]; y < P.height; y += sizes[i]) {
+            border += rowsum[y];
+            border_n += P.width;
+        }
+        /* no grid line inside a small frame, nothing to measure */
+        if (!border_n) {
+            out->block[i] = 1.0;
+            continue;
+        }
+        border /= border_n;
+        out->block[i] = (border + BLOCK_EPS) / (inner + BLOCK_EPS);
+    }
+
+    for (Uint32 i = 0; i < nblocks; i++) {
+        if (blocks[i].edge) {
+            edge_s += blocks[i].smooth;
+            edge_n += blocks[i].smooth_n;
+        } else {
+            flat_s += blocks[i].smooth;
+            flat_n += blocks[i].smooth_n;
+        }
+    }
+    out->ringing = 1.0;
+    if (edge_n && flat_n) {
+        out->ringing = (edge_s / edge_n + BLOCK_EPS) / (flat_s / flat_n + BLOCK_EPS);
+    }
+}
+
+Uint32 artifact_alloc(void)
+{
+    Uint32 workers = POOL.count > 1 ? POOL.count : 1;
+    Uint32 nblocks = (P.width + 7) / 8 * ((P.height + 7) / 8);
+
+    if (ART.blocks) {
+        return 1;
+    }
+
+    ART.colsum = malloc(sizeof(Uint32) * P.width * workers);
+    ART.rowsum = malloc(sizeof(Uint32) * P.height);
+    ART.pad = malloc((size_t)(P.width + 1) * workers);
+    ART.luma = malloc(P.y_size);
+    ART.blocks = malloc(sizeof(struct block_sums) * nblocks);
+    if (!ART.colsum || !ART.rowsum || !ART.pad || !ART.luma || !ART.blocks) {
+        fprintf(stderr, "Error allocating memory...\n");
+        free(ART.colsum);
+        free(ART.rowsum);
+        free(ART.pad);
+        free(ART.luma);
+        free(ART.blocks);
+        memset(&ART, 0, sizeof(ART));
+        return 0;
+    }
+    return 1;
+}
+
+/* worker: a band of whole 8x8 block rows of ART.src */
+void artifact_job(void* arg, Uint32 index, Uint32 count)
+{
+    Uint32 brows = (P.height + 7) / 8;
+    Uint32 y0 = brows * index / count * 8;
+    Uint32 y1 = brows * (index + 1) / count * 8;
+    Uint32* colsum = ART.colsum + index * P.width;
+
+    (void)arg;
+    if (y1 > P.height) {
+        y1 = P.height;
+    }
+    memset(colsum, 0, sizeof(Uint32) * P.width);
+    block_rows(ART.src, y0, y1, ART.pad + index * (P.width + 1), colsum, ART.rowsum,
+               ART.blocks);
+}
+
+/* artifacts of the input frame on screen into ART.frame, also in
+ * diff-mode and temporal diff */
+Uint32 frame_artifacts(void)
+{
+    Uint32 workers = POOL.count > 1 ? POOL.count : 1;
+    Uint32 nblocks = (P.width + 7) / 8 * ((P.height + 7) / 8);
+    Uint8* src = P.diff ? P.y_ref : P.temporal ? P.y_cmp : P.y_in;
+
+    if (!artifact_alloc()) {
+        return 0;
+    }
+    /* 10 bpp rounded like the display does by default */
+    if (P.sample_bytes == 2) {
+        Uint8 lut[1024];
+
+        bits_lut(lut, BITS_ROUND);
+        to_display((Uint16*)src, ART.luma, P.y_size, lut);
+        src = ART.luma;
+    }
+
+    ART.src = src;
+    memset(ART.blocks, 0, sizeof(struct block_sums) * nblocks);
+    pool_run(artifact_job, NULL);
+    for (Uint32 i = 1; i < workers; i++) {
+        for (Uint32 x = 0; x < P.width; x++) {
+            ART.colsum[x] += ART.colsum[i * P.width + x];
+        }
+    }
+    artifact_result(ART.colsum, ART.rowsum, ART.blocks, &ART.frame);
+    return 1;
+}
+
+/* per 8x8 block blockiness, magenta tint over the frame */
+void draw_blockiness(void)
+{
+    Uint32 bw = (P.width + 7) / 8;
+    Uint32 bh = (P.height + 7) / 8;
+
+    if (P.artifacts != ARTIFACTS_OVERLAY || !ART.blocks) {
+        return;
+    }
+
+    for (Uint32 by = 0; by < bh; by++) {
+        Uint32 h = P.height - by * 8 < 8 ? P.height - by * 8 : 8;
+
+        for (Uint32 bx = 0; bx < bw; bx++) {
+            Uint32 w = P.width - bx * 8 < 8 ? P.width - bx * 8 : 8;
+            struct block_sums* b = &ART.blocks[by * bw + bx];
+            /* 16 pels on the border, 112 inside */
+            double r = (b->border / 16.0 + BLOCK_EPS) / (b->inner / 112.0 + BLOCK_EPS);
+            Sint32 level = (r - 1.0) * 64;
+            Uint8 c;
+
+            if (level <= 0) {
+                continue;
+            }
+            if (level > 255) {
+                level = 255;
+            }
+            c = 0x80 + level / 2;
+
+            if (FORMAT == YV12 || FORMAT == IYUV || FORMAT == YV1210) {
+                Uint32 pitch = my_overlay->pitches[1];
+
+                for (Uint32 i = by * 4; i < by * 4 + h / 2; i++) {
+                    for (Uint32 j = bx * 4; j < bx * 4 + w / 2; j++) {
+                        my_overlay->pixels[1][i * pitch + j] = c;
+                        my_overlay->pixels[2][i * pitch + j] = c;
+                    }
+                }
+            } else {
+                Uint8* p = my_overlay->pixels[0];
+                Uint32 pitch = my_overlay->pitches[0];
+
+                for (Uint32 i = by * 8; i < by * 8 + h; i++) {
+                    for (Uint32 j = bx * 16; j < bx * 16 + w * 2; j += 4) {
+                        p[i * pitch + j + P.cb_start_pos] = c;
+                        p[i * pitch + j + P.cr_start_pos] = c;
+                    }
+                }
+            }
+        }
+    }
+}
+
+struct artifact_clip {
+    Uint8* data;              /* mapped input */
+    Uint32 first;
+    Uint32 count;
+    struct artifacts* out;
+    Uint32 failed;
+};
+
+/* worker: whole frames of the clip, each with its own buffers */
+void artifact_clip_job(void* arg, Uint32 index, Uint32 count)
+{
+    struct artifact_clip* ac = arg;
+    Uint32 start = (Uint64)ac->count * index / count;
+    Uint32 end = (Uint64)ac->count * (index + 1) / count;
+    Uint32 nblocks = (P.width + 7) / 8 * ((P.height + 7) / 8);
+    Uint8* luma = malloc(P.wh);
+    Uint8* pad = malloc(P.width + 1);
+    Uint32* colsum = malloc(sizeof(Uint32) * P.width);
+    Uint32* rowsum = malloc(sizeof(Uint32) * P.height);
+    struct block_sums* blocks = malloc(sizeof(struct block_sums) * nblocks);
+
+    if (!luma || !pad || !colsum || !rowsum || !blocks) {
+        fprintf(stderr, "Error allocating memory...\n");
+        ac->failed = 1;
+        goto artifact_cleanup;
+    }
+
+    for (Uint32 i = start; i < end; i++) {
+        decode_frame(ac->data + frame_offset(0, ac->first + i), luma, NULL, NULL);
+        memset(colsum, 0, sizeof(Uint32) * P.width);
+        memset(blocks, 0, sizeof(struct block_sums) * nblocks);
+        block_rows(luma, 0, P.height, pad, colsum, rowsum, blocks);
+        artifact_result(colsum, rowsum, blocks, &ac->out[i]);
+    }
+
+artifact_cleanup:
+    free(blocks);
+    free(rowsum);
+    free(colsum);
+    free(pad);
+    free(luma);
+}
+
+/* headless: blockiness and ringing of the frame range as CSV */
+Uint32 write_artifacts(void)
+{
+    struct artifact_clip ac;
+    struct stat st;
+    Uint32 frames;
+    Uint32 ret = 0;
+    Uint64 size;
+    FILE* fp;
+    double t;
+
+    if (stat(P.filename, &st)) {
+        fprintf(stderr, "Error opening %s\n", P.filename);
+        return 0;
+    }
+    frames = frame_total(0, st.st_size);
+    if (!P.range_set) {
+        P.first_frame = 0;
+        P.last_frame = frames ? frames - 1 : 0;
+    }
+    if (!frames || P.last_frame >= frames) {
+        fprintf(stderr, "Frame range outside of file (%u frames)\n", frames);
+        return 0;
+    }
+
+    ac.data = map_input(P.filename, &size);
+    if (!ac.data) {
+        return 0;
+    }
+    ac.first = P.first_frame;
+    ac.count = P.last_frame - P.first_frame + 1;
+    ac.failed = 0;
+    ac.out = malloc(sizeof(struct artifacts) * ac.count);
+    if (!ac.out) {
+        fprintf(stderr, "Error allocating memory...\n");
+        munmap(ac.data, size);
+        return 0;
+    }
+
+    t = now();
+    pool_run(artifact_clip_job, &ac);
+    t = now() - t;
+    munmap(ac.data, size);
+    if (ac.failed) {
+        goto artifacts_done;
+    }
+
+    fp = fopen(P.artifacts_file, "w");
+    if (!fp) {
+        fprintf(stderr, "Error opening %s\n", P.artifacts_file);
+        goto artifacts_done;
+    }
+    fprintf(fp, "frame,block8,block16,block%u,ringing\n", P.ctu);
+    for (Uint32 i = 0; i < ac.count; i++) {
+        struct artifacts* a = &ac.out[i];
+
+        fprintf(fp, "%u,%.4f,%.4f,%.4f,%.4f\n", ac.first + i,
+                a->block[0], a->block[1], a->block[2], a->ringing);
+    }
+    if (fclose(fp)) {
+        perror("fclose");
+        goto artifacts_done;
+    }
+    fprintf(stdout, "%u frames measured in %.2f s (%.1f fps)\n", ac.count, t, ac.count / t);
+    ret = 1;
+
+artifacts_done:
+    free(ac.out);
+    return ret;
+}
+
+/* tables for planes of the given sizes, kept while the size stays */
+Uint32 sat_alloc(Uint32 planes, Uint32* width, Uint32* height, Uint32 copy)
+{
+    if (SAT.sum[0]) {
+        return 1;
+    }
+
+    for (Uint32 p = 0; p < planes; p++) {
+        Uint64 n = (Uint64)(width[p] + 1) * (height[p] + 1);
+
+        /* calloc: the first row stays zero */
+        SAT.sum[p] = calloc(n, sizeof(Uint64));
+        SAT.sq[p] = calloc(n, sizeof(Uint64));
+        if (copy) {
+            SAT.copy[p] = malloc((size_t)width[p] * height[p] * P.sample_bytes);
+        }
+        if (!SAT.sum[p] || !SAT.sq[p] || (copy && !SAT.copy[p])) {
+            fprintf(stderr, "Error allocating memory...\n");
+            sat_free();
+            return 0;
+        }
+        SAT.width[p] = width[p];
+        SAT.height[p] = height[p];
+    }
+    SAT.planes = planes;
+    return 1;
+}
+
+void sat_free(void)
+{
+    for (Uint32 p = 0; p < 3; p++) {
+        free(SAT.sum[p]);
+        free(SAT.sq[p]);
+        free(SAT.copy[p]);
+    }
+    memset(&SAT, 0, sizeof(SAT));
+}
+
+/* inclusive prefix sums of a row of samples and their squares, after a
+ * leading zero. SSE2: 4 samples at a time, scanned within the register
+ * and widened to 64 bit on top of the running sum. */
+void sat_row(const Uint8* src, Uint32 step, Uint32 bytes, Uint32 width,
+             Uint64* sum, Uint64* sq)
+{
+    Uint64 s = 0;
+    Uint64 q = 0;
+    Uint32 x = 0;
+
+    *sum++ = 0;
+    *sq++ = 0;
+
+#ifdef __SSE2__
+    if (step == 1 && width >= 4) {
+        __m128i zero = _mm_setzero_si128();
+        __m128i cs = zero;
+        __m128i cq = zero;
+
+        for (; x + 4 <= width; x += 4) {
+            __m128i v, v2, lo, hi;
+            Uint32 four;
+
+            if (bytes == 2) {
+                v = _mm_loadl_epi64((const __m128i*)(src + x * 2));
+            } else {
+                memcpy(&four, src + x, 4);
+                v = _mm_unpacklo_epi8(_mm_cvtsi32_si128(four), zero);
+            }
+            v = _mm_unpacklo_epi16(v, zero);
+            /* 10 bit samples, v * v + 0 * 0 */
+            v2 = _mm_madd_epi16(v, v);
+            v = _mm_add_epi32(v, _mm_slli_si128(v, 4));
+            v = _mm_add_epi32(v, _mm_slli_si128(v, 8));
+            v2 = _mm_add_epi32(v2, _mm_slli_si128(v2, 4));
+            v2 = _mm_add_epi32(v2, _mm_slli_si128(v2, 8));
+
+            lo = _mm_add_epi64(_mm_unpacklo_epi32(v, zero), cs);
+            hi = _mm_add_epi64(_mm_unpackhi_epi32(v, zero), cs);
+            _mm_storeu_si128((__m128i*)(sum + x), lo);
+            _mm_storeu_si128((__m128i*)(sum + x + 2), hi);
+            cs = _mm_unpackhi_epi64(hi, hi);
+
+            lo = _mm_add_epi64(_mm_unpacklo_epi32(v2, zero), cq);
+            hi = _mm_add_epi64(_mm_unpackhi_epi32(v2, zero), cq);
+            _mm_storeu_si128((__m128i*)(sq + x), lo);
+            _mm_storeu_si128((__m128i*)(sq + x + 2), hi);
+            cq = _mm_unpackhi_epi64(hi, hi);
+        }
+        s = sum[x - 1];
+        q = sq[x - 1];
+    }
+#endif
+
+    for (; x < width; x++) {
+        Uint32 v = bytes == 2 ? ((const Uint16*)src)[x * step] : src[x * step];
+
+        s += v;
+        q += v * v;
+        sum[x] = s;
+        sq[x] = q;
+    }
+}
+
+/* worker: row sums of a band of rows of every plane */
+void sat_rows_job(void* arg, Uint32 index, Uint32 count)
+{
+    (void)arg;
+    for (Uint32 p = 0; p < SAT.planes; p++) {
+        Uint32 w = SAT.width[p];
+        Uint32 y0 = SAT.height[p] * index / count;
+        Uint32 y1 = SAT.height[p] * (index + 1) / count;
+
+        for (Uint32 y = y0; y < y1; y++) {
+            const Uint8* row = SAT.src[p] + (Uint64)y * SAT.pitch[p] * SAT.bytes;
+            Uint64 at = (Uint64)(y + 1) * (w + 1);
+
+            sat_row(row, SAT.step[p], SAT.bytes, w, SAT.sum[p] + at, SAT.sq[p] + at);
+            if (SAT.copy[p]) {
+                memcpy(SAT.copy[p] + (Uint64)y * w * SAT.bytes, row, (size_t)w * SAT.bytes);
+            }
+        }
+    }
+}
+
+/* worker: add up the row sums down a strip of columns of every plane */
+void sat_cols_job(void* arg, Uint32 index, Uint32 count)
+{
+    (void)arg;
+    for (Uint32 p = 0; p < SAT.planes; p++) {
+        Uint32 pitch = SAT.width[p] + 1;
+        /* even strips, pairs of 64 bit sums per register */
+        Uint32 x0 = pitch / 2 * index / count * 2;
+        Uint32 x1 = index + 1 == count ? pitch : pitch / 2 * (index + 1) / count * 2;
+
+        for (Uint32 y = 1; y <= SAT.height[p]; y++) {
+            Uint64* prev = SAT.sum[p] + (Uint64)(y - 1) * pitch;
+            Uint64* row = prev + pitch;
+            Uint64* prev2 = SAT.sq[p] + (Uint64)(y - 1) * pitch;
+            Uint64* row2 = prev2 + pitch;
+            Uint32 x = x0;
+
+#ifdef __SSE2__
+            for (; x + 2 <= x1; x += 2) {
+                __m128i a = _mm_loadu_si128((__m128i*)(row + x));
+                __m128i b = _mm_loadu_si128((__m128i*)(prev + x));
+                __m128i c = _mm_loadu_si128((__m128i*)(row2 + x));
+                __m128i d = _mm_loadu_si128((__m128i*)(prev2 + x));
+
+                _mm_storeu_si128((__m128i*)(row + x), _mm_add_epi64(a, b));
+                _mm_storeu_si128((__m128i*)(row2 + x), _mm_add_epi64(c, d));
+            }
+#endif
+            for (; x < x1; x++) {
+                row[x] += prev[x];
+                row2[x] += prev2[x];
+            }
+        }
+    }
+}
+
+/* tables of SAT.src, the rows then the columns on all workers */
+void sat_build(void)
+{
+    pool_run(sat_rows_job, NULL);
+    pool_run(sat_cols_job, NULL);
+}
+
+/* tables of the planes of a frame, in file order, at full precision */
+void sat_frame(Uint8* y, Uint8* cb, Uint8* cr)
+{
+    Uint32 width[3] = {P.width, P.width / 2, P.width / 2};
+    Uint32 height[3] = {P.height, P.cb_size / (P.width / 2), P.cr_size / (P.width / 2)};
+    double t = now();
+
+    if (!sat_alloc(3, width, height, 1)) {
+        P.sat = 0;
+        return;
+    }
+    /* YV12 keeps Cr first, so cb_in holds Cr there */
+    SAT.src[0] = y;
+    SAT.src[1] = FORMAT == YV12 || FORMAT == YV1210 ? cr : cb;
+    SAT.src[2] = FORMAT == YV12 || FORMAT == YV1210 ? cb : cr;
+    for (Uint32 p = 0; p < 3; p++) {
+        SAT.pitch[p] = width[p];
+        SAT.step[p] = 1;
+    }
+    SAT.bytes = P.sample_bytes;
+    sat_build();
+    /* the cost per frame, once: on the second, the first faults them in */
+    if (P.sat < 3 && P.sat++ == 2) {
+        fprintf(stdout, "Summed-area tables in %.2f ms per frame\n", (now() - t) * 1000);
+    }
+}
+
+/* mean and variance of samples x0..x1-1, y0..y1-1 of plane p */
+void sat_region(Uint32 p, Uint32 x0, Uint32 y0, Uint32 x1, Uint32 y1,
+                double* mean, double* variance)
+{
+    Uint64 pitch = SAT.width[p] + 1;
+    Uint64 a = y0 * pitch + x0;
+    Uint64 b = y0 * pitch + x1;
+    Uint64 c = y1 * pitch + x0;
+    Uint64 d = y1 * pitch + x1;
+    double n = (double)(x1 - x0) * (y1 - y0);
+    Uint64 sum = SAT.sum[p][d] - SAT.sum[p][b] - SAT.sum[p][c] + SAT.sum[p][a];
+    Uint64 sq = SAT.sq[p][d] - SAT.sq[p][b] - SAT.sq[p][c] + SAT.sq[p][a];
+
+    *mean = sum / n;
+    *variance = sq / n - *mean * *mean;
+    if (*variance < 0) {
+        *variance = 0;
+    }
+}
+
+/* smallest and largest sample of the region, which no table has */
+void region_range(Uint32 p, Uint32 x0, Uint32 y0, Uint32 x1, Uint32 y1,
+                  Uint32* min, Uint32* max)
+{
+    Uint32 lo = ~0u;
+    Uint32 hi = 0;
+
+    for (Uint32 y = y0; y < y1; y++) {
+        Uint32 x = x0;
+
+        if (SAT.bytes == 2) {
+            const Uint16* row = (const Uint16*)SAT.copy[p] + (Uint64)y * SAT.width[p];
+
+            for (; x < x1; x++) {
+                lo = row[x] < lo ? row[x] : lo;
+                hi = row[x] > hi ? row[x] : hi;
+            }
+            continue;
+        }
+
+        const Uint8* row = SAT.copy[p] + (Uint64)y * SAT.width[p];
+#ifdef __SSE2__
+        if (x1 - x0 >= 16) {
+            __m128i vlo = _mm_set1_epi8((char)0xFF);
+            __m128i vhi = _mm_setzero_si128();
+            Uint8 out[16];
+
+            for (; x + 16 <= x1; x += 16) {
+                __m128i v = _mm_loadu_si128((const __m128i*)(row + x));
+
+                vlo = _mm_min_epu8(vlo, v);
+                vhi = _mm_max_epu8(vhi, v);
+            }
+            _mm_storeu_si128((__m128i*)out, vlo);
+            for (Uint32 i = 0; i < 16; i++) {
+                lo = out[i] < lo ? out[i] : lo;
+            }
+            _mm_storeu_si128((__m128i*)out, vhi);
+            for (Uint32 i = 0; i < 16; i++) {
+                hi = out[i] > hi ? out[i] : hi;
+            }
+        }
+#endif
+        for (; x < x1; x++) {
+            lo = row[x] < lo ? row[x] : lo;
+            hi = row[x] > hi ? row[x] : hi;
+        }
+    }
+    *min = lo;
+    *max = hi;
+}
+
+/* stdout: statistics of each plane over luma x0..x1-1, y0..y1-1 */
+void region_stats(Uint32 x0, Uint32 y0, Uint32 x1, Uint32 y1)
+{
+    const char* name[3] = {"Y ", "Cb", "Cr"};
+
+    for (Uint32 p = 0; p < SAT.planes; p++) {
+        /* chroma: half width, half height if 4:2:0 */
+        Uint32 sx = SAT.width[0] / SAT.width[p];
+        Uint32 sy = SAT.height[0] / SAT.height[p];
+        Uint32 cx0 = x0 / sx;
+        Uint32 cy0 = y0 / sy;
+        Uint32 cx1 = (x1 + sx - 1) / sx;
+        Uint32 cy1 = (y1 + sy - 1) / sy;
+        double mean, variance;
+        Uint32 min, max;
+
+        sat_region(p, cx0, cy0, cx1, cy1, &mean, &variance);
+        region_range(p, cx0, cy0, cx1, cy1, &min, &max);
+        printf("%s mean %8.2f variance %9.2f min %4u max %4u\n",
+               name[p], mean, variance, min, max);
+    }
+}
+
+/* render thread: a rectangle dragged with the mouse, any zoom */
+void region_probe(Sint32 a, Sint32 b)
+{
+    Uint32 x0 = (Uint32)(a >> 16) * P.width / P.zoom_width;
+    Uint32 y0 = (Uint32)(a & 0xFFFF) * P.height / P.zoom_height;
+    Uint32 x1 = (Uint32)(b >> 16) * P.width / P.zoom_width;
+    Uint32 y1 = (Uint32)(b & 0xFFFF) * P.height / P.zoom_height;
+    Uint32 keep = P.sat;
+    double t;
+
+    if (!R.frame) {
+        return;
+    }
+    if (x0 > x1) {
+        Uint32 tmp = x0;
+        x0 = x1;
+        x1 = tmp;
+    }
+    if (y0 > y1) {
+        Uint32 tmp = y0;
+        y0 = y1;
+        y1 = tmp;
+    }
+    /* both corners inside */
+    x1 = x1 < P.width ? x1 + 1 : P.width;
+    y1 = y1 < P.height ? y1 + 1 : P.height;
+    if (x0 >= x1 || y0 >= y1) {
+        return;
+    }
+
+    /* without --sat, tables of the frame on screen only, 3 skips the
+     * cost line; the diff modes drew over the planes as read */
+    if (!keep) {
+        P.sat = 3;
+        if (P.diff || P.temporal) {
+            sat_frame(P.diff ? P.y_ref : P.y_cmp, P.cb_ref, P.cr_ref);
+        } else {
+            sat_frame(P.y_in, P.cb_in, P.cr_in);
+        }
+        if (!P.sat) {
+            return;
+        }
+    }
+
+    t = now();
+    printf("\nRegion %u,%u %ux%u of frame %u\n", x0, y0, x1 - x0, y1 - y0, R.frame - 1);
+    region_stats(x0, y0, x1, y1);
+    printf("in %.1f us\n", (now() - t) * 1e6);
+    fflush(stdout);
+    P.sat = keep;
+}
+
+/* Headless: luma variance of every MB of the frames in range to a .npy
+ * file of shape (frames, mb_rows, mb_cols), float32. Each frame is
+ * summed once on all workers, then an MB is four lookups. */
+Uint32 write_variance(void)
+{
+    Uint32 offset[3], pitch[3], width[3], height[3], step[3];
+    Uint32 frames;
+    Uint64 size;
+    Uint8* data;
+    float* out;
+    FILE* fp;
+    char header[256];
+    int len;
+    Uint32 ret = 1;
+    double t;
+
+    data = map_input(P.filename, &size);
+    if (!data) {
+        return 0;
+    }
+    frames = frame_total(0, size);
+    if (!P.range_set) {
+        P.first_frame = 0;
+        P.last_frame = frames ? frames - 1 : 0;
+    }
+    if (!frames || P.last_frame >= frames) {
+        fprintf(stderr, "Frame range outside of file (%u frames)\n", frames);
+        munmap(data, size);
+        return 0;
+    }
+    frames = P.last_frame - P.first_frame + 1;
+
+    plane_layout(offset, pitch, width, height, step);
+    out = malloc(sizeof(float) * P.mb_cols * P.mb_rows);
+    fp = fopen(P.variance_file, "wb");
+    if (!out || !fp || !sat_alloc(1, width, height, 0)) {
+        fprintf(stderr, "Error opening %s\n", P.variance_file);
+        ret = 0;
+        goto variance_cleanup;
+    }
+    SAT.pitch[0] = pitch[0];
+    SAT.step[0] = step[0];
+    SAT.bytes = P.sample_bytes;
+
+    /* .npy v1.0, as extract_mb() writes it */
+    len = snprintf(header + 10, sizeof(header) - 10,
+                   "{'descr': '<f4', 'fortran_order': False, 'shape': (%u, %u, %u), }",
+                   frames, P.mb_rows, P.mb_cols);
+    while ((10 + len + 1) % 64) {
+        header[10 + len++] = ' ';
+    }
+    header[10 + len++] = '\n';
+    memcpy(header, "\x93NUMPY\x01\x00", 8);
+    header[8] = len & 0xFF;
+    header[9] = len >> 8;
+    fwrite(header, 1, 10 + len, fp);
+
+    t = now();
+    for (Uint32 f = P.first_frame; f <= P.last_frame; f++) {
+        SAT.src[0] = data + frame_offset(0, f) + (Uint64)offset[0] * P.sample_bytes;
+        sat_build();
+
+        for (Uint32 my = 0; my < P.mb_rows; my++) {
+            for (Uint32 mx = 0; mx < P.mb_cols; mx++) {
+                Uint32 x1 = mx * 16 + 16 < P.width ? mx * 16 + 16 : P.width;
+                Uint32 y1 = my * 16 + 16 < P.height ? my * 16 + 16 : P.height;
+                double mean, variance;
+
+                sat_region(0, mx * 16, my * 16, x1, y1, &mean, &variance);
+                out[my * P.mb_cols + mx] = variance;
+            }
+        }
+        if (fwrite(out, sizeof(float), P.mb_cols * P.mb_rows, fp) != P.mb_cols * P.mb_rows) {
+            perror("fwrite");
+            ret = 0;
+            break;
+        }
+    }
+    t = now() - t;
+
+    if (ret) {
+        fprintf(stdout, "%u frames x %ux%u MB variances written to %s in %.2f s (%.1f fps)\n",
+                frames, P.mb_cols, P.mb_rows, P.variance_file, t, frames / t);
+    }
+
+variance_cleanup:
+    if (fp && fclose(fp)) {
+        perror("fclose");
+        ret = 0;
+    }
+    free(out);
+    sat_free();
+    munmap(data, size);
+    return ret;
+}
+
+/* LZ4 block format (as LZ4_compress_default() writes it), greedy with
+ * one hash table: no dependency, and decoding is a few memcpy per
+ * match. Returns the packed size, 0 if it does not fit cap. */
+Uint32 lz4_pack(const Uint8* src, Uint32 n, Uint8* dst, Uint32 cap, Uint32* table)
+{
+    const Uint8* ip = src;
+    const Uint8* anchor = src;
+    const Uint8* end = src + n;
+    /* no match starts in the last 12 bytes nor reaches the last 5 */
+    const Uint8* mflimit = n > LZ4_MFLIMIT ? end - LZ4_MFLIMIT : src;
+    const Uint8* matchlimit = n > LZ4_LASTLITERALS ? end - LZ4_LASTLITERALS : src;
+    Uint8* op = dst;
+    Uint8* oend = dst + cap;
+    Uint32 lit;
+
+    memset(table, 0, sizeof(Uint32) << LZ4_HASH_BITS);
+
+    while (ip < mflimit) {
+        Uint32 seq, h, len, off;
+        const Uint8* ref;
+
+        memcpy(&seq, ip, 4);
+        h = (seq * 2654435761u) >> (32 - LZ4_HASH_BITS);
+        ref = src + table[h];
+        table[h] = ip - src;
+        if (ref >= ip || ip - ref > LZ4_MAX_OFFSET || memcmp(ref, ip, 4)) {
+            /* skip faster through data that does not compress */
+            ip += 1 + ((ip - anchor) >> 6);
+            continue;
+        }
+
+        while (ip > anchor && ref > src && ip[-1] == ref[-1]) {
+            ip--;
+            ref--;
+        }
+        for (len = 4; ip + len < matchlimit && ip[len] == ref[len]; len++) {
+        }
+
+        lit = ip - anchor;
+        off = ip - ref;
+        /* token, lengths, literals and offset */
+        if (op + 1 + lit / 255 + 1 + lit + 2 + (len - 4) / 255 + 1 > oend) {
+            return 0;
+        }
+        *op = (lit < 15 ? lit : 15) << 4 | (len - 4 < 15 ? len - 4 : 15);
+        op++;
+        if (lit >= 15) {
+            Uint32 l = lit - 15;
+
+            for (; l >= 255; l -= 255) {
+                *op++ = 255;
+            }
+            *op++ = l;
+        }
+        memcpy(op, anchor, lit);
+        op += lit;
+        *op++ = off & 0xFF;
+        *op++ = off >> 8;
+        if (len - 4 >= 15) {
+            Uint32 l = len - 4 - 15;
+
+            for (; l >= 255; l -= 255) {
+                *op++ = 255;
+            }
+            *op++ = l;
+        }
+
+        ip += len;
+        anchor = ip;
+    }
+
+    /* the rest as literals, a sequence without match */
+    lit = end - anchor;
+    if (op + 1 + lit / 255 + 1 + lit > oend) {
+        return 0;
+    }
+    *op++ = (lit < 15 ? lit : 15) << 4;
+    if (lit >= 15) {
+        Uint32 l = lit - 15;
+
+        for (; l >= 255; l -= 255) {
+            *op++ = 255;
+        }
+        *op++ = l;
+    }
+    memcpy(op, anchor, lit);
+    op += lit;
+    return op - dst;
+}
+
+/* LZ4 block of n bytes to exactly size bytes, 0 on corrupt input */
+Uint32 lz4_unpack(const Uint8* src, Uint32 n, Uint8* dst, Uint32 size)
+{
+    const Uint8* ip = src;
+    const Uint8* iend = src + n;
+    Uint8* op = dst;
+    Uint8* oend = dst + size;
+
+    while (ip < iend) {
+        Uint32 token = *ip++;
+        Uint32 lit = token >> 4;
+        Uint32 len = token & 15;
+        Uint32 off;
+        Uint8* ref;
+
+        if (lit == 15) {
+            Uint32 b;
+
+            do {
+                if (ip >= iend) {
+                    return 0;
+                }
+                b = *ip++;
+                lit += b;
+            } while (b == 255);
+        }
+        if (lit > (Uint32)(iend - ip) || lit > (Uint32)(oend - op)) {
+            return 0;
+        }
+        memcpy(op, ip, lit);
+        op += lit;
+        ip += lit;
+        if (ip == iend) {
+            /* last literals */
+            break;
+        }
+
+        if (iend - ip < 2) {
+            return 0;
+        }
+        off = ip[0] | ip[1] << 8;
+        ip += 2;
+        if (!off || off > (Uint32)(op - dst)) {
+            return 0;
+        }
+        if (len == 15) {
+            Uint32 b;
+
+            do {
+                if (ip >= iend) {
+                    return 0;
+                }
+                b = *ip++;
+                len += b;
+            } while (b == 255);
+        }
+        len += 4;
+        if (len > (Uint32)(oend - op)) {
+            return 0;
+        }
+
+        ref = op - off;
+        if (off >= len) {
+            memcpy(op, ref, len);
+            op += len;
+        } else if (off == 1) {
+            memset(op, *ref, len);
+            op += len;
+        } else {
+            /* overlapping, repeats the last off bytes; the copied
+             * pattern doubles with every pass */
+            while (len) {
+                Uint32 cnt = op - ref;
+
+                if (cnt > len) {
+                    cnt = len;
+                }
+                memcpy(op, ref, cnt);
+                op += cnt;
+                len -= cnt;
+            }
+        }
+    }
+    return op == oend;
+}
+
+/* worst case packed size of n bytes */
+Uint32 pack_bound(Uint32 codec, Uint32 n)
+{
+#ifdef HAVE_ZSTD
+    if (codec == PACK_ZSTD) {
+        return ZSTD_compressBound(n);
+    }
+#else
+    (void)codec;
+#endif
+    return n + n / 255 + 16;
+}
+
+Uint32 unpack_chunk(Uint32 codec, const Uint8* src, Uint32 n, Uint8* dst, Uint32 size)
+{
+#ifdef HAVE_ZSTD
+    if (codec == PACK_ZSTD) {
+        size_t ret = ZSTD_decompress(dst, size, src, n);
+
+        return !ZSTD_isError(ret) && ret == size;
+    }
+#endif
+    return codec == PACK_LZ4 && lz4_unpack(src, n, dst, size);
+}
+
+Uint32 write_all(int out, const Uint8* data, Uint64 size)
+{
+    while (size) {
+        ssize_t n = write(out, data, size);
+
+        if (n < 0) {
+            perror("write");
+            return 0;
+        }
+        data += n;
+        size -= n;
+    }
+    return 1;
+}
+
+struct pack_state {
+    Uint8* data;              /* mapped input */
+    Uint8* out;               /* per frame of the batch, bound bytes */
+    Uint32* packed;           /* size of every chunk of the batch */
+    Uint32 first;             /* frame number of first frame in batch */
+    Uint32 frames;            /* frames in batch */
+    Uint32 chunk_size[3];
+    Uint64 bound;             /* room for one packed frame */
+    Uint32 failed;
+};
+
+/* worker: every count'th frame of the batch */
+void pack_job(void* arg, Uint32 index, Uint32 count)
+{
+    struct pack_state* ps = arg;
+    Uint32* table = malloc(sizeof(Uint32) << LZ4_HASH_BITS);
+
+    if (!table) {
+        fprintf(stderr, "Error allocating memory...\n");
+        ps->failed = 1;
+        return;
+    }
+
+    for (Uint32 f = index; f < ps->frames; f += count) {
+        Uint8* src = ps->data + frame_offset(0, ps->first + f);
+        Uint8* dst = ps->out + f * ps->bound;
+
+        for (Uint32 c = 0; c < P.pack_chunks; c++) {
+            Uint32 size = ps->chunk_size[c];
+            Uint32 n = 0;
+
+#ifdef HAVE_ZSTD
+            if (P.codec == PACK_ZSTD) {
+                size_t ret = ZSTD_compress(dst, pack_bound(P.codec, size), src, size,
+                                           PACK_ZSTD_LEVEL);
+
+                n = ZSTD_isError(ret) ? 0 : ret;
+            }
+#endif
+            if (P.codec == PACK_LZ4) {
+                n = lz4_pack(src, size, dst, size - 1, table);
+            }
+            /* stored when packing does not help */
+            if (!n || n >= size) {
+                memcpy(dst, src, size);
+                n = size;
+            }
+            ps->packed[f * P.pack_chunks + c] = n;
+            src += size;
+            dst += n;
+        }
+    }
+    free(table);
+}
+
+/* Headless: frame range to a .yvz container. Frames are packed in
+ * batches of 16 MB on all cores, the chunk offsets follow the last
+ * frame and the header is completed last. */
+Uint32 write_pack(void)
+{
+    struct pack_header hdr;
+    struct pack_state ps;
+    Uint64* index = NULL;
+    Uint64 size, pos, batch, total = 0;
+    Uint32 frames;
+    Uint32 ret = 1;
+    double t;
+    int out;
+
+    memset(&ps, 0, sizeof(ps));
+    /* packed 4:2:2 has no planes to split */
+    if (P.pack_chunks == 3 && !(FORMAT == YV12 || FORMAT == IYUV || FORMAT == YV1210 ||
+                                FORMAT == Y42210)) {
+        P.pack_chunks = 1;
+    }
+    if (!P.pack_chunks) {
+        P.pack_chunks = 1;
+    }
+    pack_chunks(P.pack_chunks, ps.chunk_size);
+
+    ps.data = map_input(P.filename, &size);
+    if (!ps.data) {
+        return 0;
+    }
+    frames = frame_total(0, size);
+    if (!P.range_set) {
+        P.first_frame = 0;
+        P.last_frame = frames ? frames - 1 : 0;
+    }
+    if (!frames || P.last_frame >= frames) {
+        fprintf(stderr, "Frame range outside of file (%u frames)\n", frames);
+        munmap(ps.data, size);
+        return 0;
+    }
+    frames = P.last_frame - P.first_frame + 1;
+
+    out = open(P.pack, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (out < 0) {
+        fprintf(stderr, "Error opening %s\n", P.pack);
+        munmap(ps.data, size);
+        return 0;
+    }
+
+    /* batches of at least 16 MB, one write each */
+    batch = ((1 << 24) + P.file_frame_size - 1) / P.file_frame_size;
+    if (batch < POOL.count) {
+        batch = POOL.count;
+    }
+    if (batch > frames) {
+        batch = frames;
+    }
+    for (Uint32 c = 0; c < P.pack_chunks; c++) {
+        ps.bound += pack_bound(P.codec, ps.chunk_size[c]);
+    }
+    ps.out = malloc(batch * ps.bound);
+    ps.packed = malloc(sizeof(Uint32) * batch * P.pack_chunks);
+    index = malloc(((size_t)frames * P.pack_chunks + 1) * sizeof(Uint64));
+    if (!ps.out || !ps.packed || !index) {
+        fprintf(stderr, "Error allocating memory...\n");
+        ret = 0;
+        goto pack_cleanup;
+    }
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, PACK_MAGIC, sizeof(hdr.magic));
+    snprintf(hdr.format, sizeof(hdr.format), "%s", format_names[FORMAT]);
+    hdr.width = P.width;
+    hdr.height = P.height;
+    hdr.frame_ms = P.frame_ms;
+    hdr.codec = P.codec;
+    hdr.chunks = P.pack_chunks;
+    hdr.frames = frames;
+    /* index stays 0 until the file is complete */
+    if (!write_all(out, (Uint8*)&hdr, sizeof(hdr))) {
+        ret = 0;
+        goto pack_cleanup;
+    }
+    pos = sizeof(hdr);
+
+    t = now();
+    for (ps.first = P.first_frame; ps.first <= P.last_frame && ret;
+         ps.first += ps.frames) {
+        Uint32 done = ps.first - P.first_frame;
+
+        ps.frames = P.last_frame - ps.first + 1 < batch ? P.last_frame - ps.first + 1 : batch;
+        pool_run(pack_job, &ps);
+        if (ps.failed) {
+            ret = 0;
+            break;
+        }
+        for (Uint32 f = 0; f < ps.frames && ret; f++) {
+            Uint64 bytes = 0;
+
+            for (Uint32 c = 0; c < P.pack_chunks; c++) {
+                index[(done + f) * P.pack_chunks + c] = pos + bytes;
+                bytes += ps.packed[f * P.pack_chunks + c];
+            }
+            ret = write_all(out, ps.out + f * ps.bound, bytes);
+            pos += bytes;
+        }
+    }
+    index[frames * P.pack_chunks] = pos;
+    t = now() - t;
+
+    hdr.index = pos;
+    if (ret) {
+        ret = write_all(out, (Uint8*)index, ((Uint64)frames * P.pack_chunks + 1) * sizeof(Uint64));
+    }
+    if (ret && pwrite(out, &hdr, sizeof(hdr), 0) != sizeof(hdr)) {
+        perror("pwrite");
+        ret = 0;
+    }
+    if (!ret) {
+        goto pack_cleanup;
+    }
+
+    total = (Uint64)frames * P.file_frame_size;
+    fprintf(stdout, "%u frames (%.1f MB) packed to %s, %.1f MB (%.1f%%) in %.2f s (%.1f MB/s)\n",
+            frames, total / 1e6, P.pack, pos / 1e6, 100.0 * pos / total, t, total / 1e6 / t);
+
+pack_cleanup:
+    if (close(out)) {
+        perror("close");
+        ret = 0;
+    }
+    free(index);
+    free(ps.packed);
+    free(ps.out);
+    munmap(ps.data, size);
+    return ret;
+}
+
+/* sum of squared differences of every step-th 8 bit sample */
+Uint64 plane_sse8(const Uint8* a, const Uint8* b, Uint32 n, Uint32 step)
+{
+    Uint64 sse = 0;
+    Uint32 i = 0;
+
+#ifdef __SSE2__
+    while (step == 1 && i + 16 <= n) {
+        __m128i zero = _mm_setzero_si128();
+        __m128i acc = zero;
+        Uint32 lanes[4];
+
+        /* a lane gains at most 4 * 255^2 per step */
+        for (Uint32 k = 0; k < 1024 && i + 16 <= n; k++, i += 16) {
+            __m128i va = _mm_loadu_si128((__m128i*)(a + i));
+            __m128i vb = _mm_loadu_si128((__m128i*)(b + i));
+            __m128i lo = _mm_sub_epi16(_mm_unpacklo_epi8(va, zero), _mm_unpacklo_epi8(vb, zero));
+            __m128i hi = _mm_sub_epi16(_mm_unpackhi_epi8(va, zero), _mm_unpackhi_epi8(vb, zero));
+
+            acc = _mm_add_epi32(acc, _mm_madd_epi16(lo, lo));
+            acc = _mm_add_epi32(acc, _mm_madd_epi16(hi, hi));
+        }
+        _mm_storeu_si128((__m128i*)lanes, acc);
+        sse += (Uint64)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    }
+#endif
+
+    for (i *= step; i < n * step; i += step) {
+        int d = a[i] - b[i];
+        sse += d * d;
+    }
+    return sse;
+}
+
+/* PSNR of sse over n samples, INFINITY for identical planes */
+double sse_psnr(Uint64 sse, Uint64 n, Uint32 depth)
+{
+    double peak = (1 << depth) - 1;
+
+    if (!sse) {
+        return INFINITY;
+    }
+    return 10.0 * log10(peak * peak / ((double)sse / n));
+}
+
+/* JSON string, names may hold anything but NUL */
+void json_string(FILE* fp, const char* s)
+{
+    fputc('"', fp);
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\') {
+            fprintf(fp, "\\%c", *s);
+        } else if ((unsigned char)*s < 0x20) {
+            fprintf(fp, "\\u%04x", *s);
+        } else {
+            fputc(*s, fp);
+        }
+    }
+    fputc('"', fp);
+}
+
+/* "null" for identical clips, JSON has no infinity */
+void json_psnr(FILE* fp, const char* key, double psnr)
+{
+    if (isinf(psnr)) {
+        fprintf(fp, ",\"%s\":null", key);
+    } else {
+        fprintf(fp, ",\"%s\":%.4f", key, psnr);
+    }
+}
+
+/* Y, Cb, Cr SSE per frame of a job, packed 4:2:2 is walked sample by
+ * sample; planes as format_layout() finds them */
+Uint32 batch_compare(struct batch_job* job, FILE* out, Uint32 worker, double queued)
+{
+    Uint32 offset[3], pitch[3], width[3], height[3], step[3];
+    Uint32 bytes = (job->format == YV1210 || job->format == Y42210) ? 2 : 1;
+    Uint32 depth = bytes == 2 ? 10 : 8;
+    Uint64 wh = (Uint64)job->width * job->height;
+    Uint64 chroma;
+    Uint64 frame_size = format_frame_size(job->format, job->width, job->height);
+    Uint64 sse[3] = {0, 0, 0};
+    Uint64 size[2] = {0, 0};
+    Uint8* data[2] = {NULL, NULL};
+    char* names[2] = {job->ref, job->test};
+    double worst = INFINITY;
+    Uint32 worst_frame = 0;
+    Uint32 first = P.range_set ? P.first_frame : 0;
+    Uint32 frames = 0, last = 0;
+    double t = now();
+
+    format_layout(job->format, job->width, job->height, offset, pitch, width, height, step);
+    chroma = width[1] * height[1];
+    for (Uint32 i = 0; i < 2 && !job->error[0]; i++) {
+        struct stat st;
+        int in = open(names[i], O_RDONLY);
+
+        if (in < 0 || fstat(in, &st)) {
+            snprintf(job->error, sizeof(job->error), "%s: %s", names[i], strerror(errno));
+        } else if ((Uint64)st.st_size < frame_size) {
+            snprintf(job->error, sizeof(job->error), "%s: shorter than one frame", names[i]);
+        } else {
+            size[i] = st.st_size;
+            data[i] = mmap(NULL, size[i], PROT_READ, MAP_SHARED, in, 0);
+            if (data[i] == MAP_FAILED) {
+                data[i] = NULL;
+                snprintf(job->error, sizeof(job->error), "%s: %s", names[i], strerror(errno));
+            } else {
+                madvise(data[i], size[i], MADV_SEQUENTIAL);
+            }
+        }
+        if (in >= 0) {
+            close(in);
+        }
+    }
+
+    if (!job->error[0]) {
+        last = (size[0] < size[1] ? size[0] : size[1]) / frame_size;
+        if (P.range_set && P.last_frame + 1 < last) {
+            last = P.last_frame + 1;
+        }
+        if (first >= last) {
+            snprintf(job->error, sizeof(job->error), "no frames in range");
+        }
+    }
+
+    for (Uint32 f = first; f < last && !job->error[0]; f++) {
+        Uint8* a = data[0] + f * frame_size;
+        Uint8* b = data[1] + f * frame_size;
+        Uint64 y = 0;
+
+        for (Uint32 p = 0; p < 3; p++) {
+            Uint64 s = bytes == 2 ?
+                       plane_sse16((Uint16*)a + offset[p], (Uint16*)b + offset[p],
+                                   width[p] * height[p]) :
+                       plane_sse8(a + offset[p], b + offset[p], width[p] * height[p], step[p]);
+
+            sse[p] += s;
+            y = p ? y : s;
+        }
+        if (sse_psnr(y, wh, depth) < worst) {
+            worst = sse_psnr(y, wh, depth);
+            worst_frame = f;
+        }
+        frames++;
+    }
+
+    for (Uint32 i = 0; i < 2; i++) {
+        if (data[i]) {
+            munmap(data[i], size[i]);
+        }
+    }
+    t = now() - t;
+
+    fprintf(out, "{\"line\":%u,\"ref\":", job->line);
+    json_string(out, job->ref);
+    fprintf(out, ",\"test\":");
+    json_string(out, job->test);
+    fprintf(out, ",\"width\":%u,\"height\":%u,\"format\":\"%s\"",
+            job->width, job->height, format_names[job->format]);
+    if (job->error[0]) {
+        fprintf(out, ",\"status\":\"error\",\"error\":");
+        json_string(out, job->error);
+    } else {
+        fprintf(out, ",\"status\":\"ok\",\"frames\":%u", frames);
+        json_psnr(out, "psnr_y", sse_psnr(sse[0], wh * frames, depth));
+        json_psnr(out, "psnr_cb", sse_psnr(sse[1], chroma * frames, depth));
+        json_psnr(out, "psnr_cr", sse_psnr(sse[2], chroma * frames, depth));
+        json_psnr(out, "psnr_y_min", worst);
+        if (!isinf(worst)) {
+            fprintf(out, ",\"min_frame\":%u", worst_frame);
+        }
+    }
+    fprintf(out, ",\"worker\":%u,\"queued_s\":%.3f,\"run_s\":%.3f,\"mb_s\":%.1f}\n",
+            worker, queued, t, t > 0 ? 2.0 * frames * frame_size / 1e6 / t : 0.0);
+    return !job->error[0];
+}
+
+/* worker: take the first job in manifest order whose devices have a
+ * reader to spare, wait if all remaining ones are on busy devices */
+void batch_job(void* arg, Uint32 index, Uint32 count)
+{
+    struct batch_state* bs = arg;
+    char* buf = NULL;
+    size_t len = 0;
+    FILE* line = open_memstream(&buf, &len);
+
+    (void)count;
+    if (!line) {
+        fprintf(stderr, "Error allocating memory...\n");
+        return;
+    }
+
+    SDL_LockMutex(bs->lock);
+    for (;;) {
+        struct batch_job* job = NULL;
+        Uint32 ok;
+
+        while (bs->first < bs->count && bs->jobs[bs->first].started) {
+            bs->first++;
+        }
+        if (bs->first == bs->count) {
+            break;
+        }
+        for (Uint32 i = bs->first; i < bs->count && !job; i++) {
+            struct batch_job* j = &bs->jobs[i];
+            Uint32 idle = 1;
+
+            for (Uint32 d = 0; d < j->devs; d++) {
+                idle &= bs->readers[j->dev[d]] < P.readers;
+            }
+            if (!j->started && idle) {
+                job = j;
+            }
+        }
+        if (!job) {
+            SDL_CondWait(bs->cond, bs->lock);
+            continue;
+        }
+
+        job->started = 1;
+        for (Uint32 d = 0; d < job->devs; d++) {
+            bs->readers[job->dev[d]]++;
+        }
+        SDL_UnlockMutex(bs->lock);
+
+        rewind(line);
+        ok = batch_compare(job, line, index, now() - bs->start);
+        fflush(line);
+
+        SDL_LockMutex(bs->lock);
+        for (Uint32 d = 0; d < job->devs; d++) {
+            bs->readers[job->dev[d]]--;
+        }
+        /* whole lines only, in the order the jobs finish */
+        fwrite(buf, 1, ftello(line), bs->out);
+        fflush(bs->out);
+        bs->failed += !ok;
+        SDL_CondBroadcast(bs->cond);
+    }
+    SDL_UnlockMutex(bs->lock);
+
+    fclose(line);
+    free(buf);
+}
+
+/* device of a clip as index into bs->dev[], ~0 if it can't be found */
+Uint32 batch_device(struct batch_state* bs, char* name)
+{
+    struct stat st;
+    Uint32 i;
+
+    if (stat(name, &st)) {
+        return ~0u;
+    }
+    for (i = 0; i < bs->devs; i++) {
+        if (bs->dev[i] == st.st_dev) {
+            return i;
+        }
+    }
+    bs->dev[bs->devs] = st.st_dev;
+    bs->readers[bs->devs] = 0;
+    return bs->devs++;
+}
+
+/* manifest: "reference test width height format" per line, # comments */
+Uint32 read_manifest(struct batch_state* bs)
+{
+    char text[4096];
+    Uint32 line = 0;
+    Uint32 size = 0;
+    FILE* fp = fopen(P.batch, "r");
+
+    if (!fp) {
+        fprintf(stderr, "Error opening %s\n", P.batch);
+        return 0;
+    }
+
+    while (fgets(text, sizeof(text), fp)) {
+        struct batch_job* job;
+        char* field[6];
+        char* save;
+        Uint32 n = 0;
+
+        line++;
+        for (char* s = strtok_r(text, " \t\r\n", &save); s && n < 6;
+             s = strtok_r(NULL, " \t\r\n", &save)) {
+            field[n++] = s;
+        }
+        if (!n || field[0][0] == '#') {
+            continue;
+        }
+        if (n != 5) {
+            fprintf(stderr, "%s:%u: expected reference test width height format\n",
+                    P.batch, line);
+            fclose(fp);
+            return 0;
+        }
+
+        if (bs->count == size) {
+            size = size ? size * 2 : 64;
+            job = realloc(bs->jobs, sizeof(*job) * size);
+            bs->dev = realloc(bs->dev, sizeof(dev_t) * size * 2);
+            bs->readers = realloc(bs->readers, sizeof(Uint32) * size * 2);
+            if (!job || !bs->dev || !bs->readers) {
+                fprintf(stderr, "Error allocating memory...\n");
+                fclose(fp);
+                return 0;
+            }
+            bs->jobs = job;
+        }
+        job = &bs->jobs[bs->count];
+        memset(job, 0, sizeof(*job));
+        job->line = line;
+        job->width = atoi(field[2]);
+        job->height = atoi(field[3]);
+        if (!job->width || !job->height || job->width % 2 || job->height % 2) {
+            fprintf(stderr, "%s:%u: bad size %sx%s\n", P.batch, line, field[2], field[3]);
+            fclose(fp);
+            return 0;
+        }
+        if (!parse_format(field[4], &job->format)) {
+            fprintf(stderr, "%s:%u: bad format\n", P.batch, line);
+            fclose(fp);
+            return 0;
+        }
+        job->ref = strdup(field[0]);
+        job->test = strdup(field[1]);
+        bs->count++;
+        if (!job->ref || !job->test) {
+            fprintf(stderr, "Error allocating memory...\n");
+            fclose(fp);
+            return 0;
+        }
+
+        /* a job takes one reader of each device it reads from, a missing
+         * file is reported when the job runs */
+        job->dev[0] = batch_device(bs, job->ref);
+        job->dev[1] = batch_device(bs, job->test);
+        if (job->dev[0] != ~0u && job->dev[1] != ~0u) {
+            job->devs = job->dev[0] == job->dev[1] ? 1 : 2;
+        }
+    }
+    fclose(fp);
+    return 1;
+}
+
+/* Headless: PSNR of every manifest entry, scheduled on the worker pool
+ * with at most --readers jobs per device, one JSON line per job */
+Uint32 run_batch(void)
+{
+    struct batch_state bs;
+    Uint32 ret = 0;
+
+    memset(&bs, 0, sizeof(bs));
+    if (!P.readers) {
+        P.readers = BATCH_READERS;
+    }
+    if (!read_manifest(&bs)) {
+        goto batch_cleanup;
+    }
+
+    bs.out = stdout;
+    if (P.results && !(bs.out = fopen(P.results, "w"))) {
+        fprintf(stderr, "Error opening %s\n", P.results);
+        goto batch_cleanup;
+    }
+    bs.lock = SDL_CreateMutex();
+    bs.cond = SDL_CreateCond();
+    if (!bs.lock || !bs.cond) {
+        fprintf(stderr, "Error allocating memory...\n");
+        goto batch_cleanup;
+    }
+
+    bs.start = now();
+    pool_run(batch_job, &bs);
+    fprintf(stderr, "%u jobs on %u workers, %u device(s), %u failed in %.2f s\n",
+            bs.count, POOL.count, bs.devs, bs.failed, now() - bs.start);
+    ret = !bs.failed;
+
+batch_cleanup:
+    if (bs.out && bs.out != stdout && fclose(bs.out)) {
+        perror("fclose");
+        ret = 0;
+    }
+    if (bs.cond) {
+        SDL_DestroyCond(bs.cond);
+    }
+    if (bs.lock) {
+        SDL_DestroyMutex(bs.lock);
+    }
+    for (Uint32 i = 0; i < bs.count; i++) {
+        free(bs.jobs[i].ref);
+        free(bs.jobs[i].test);
+    }
+    free(bs.jobs);
+    free(bs.dev);
+    free(bs.readers);
+    return ret;
+}
+
+/* commands that run without a window */
+Uint32 run_headless(void)
+{
+    if (PAK.packed) {
+        fprintf(stderr, "%s: headless commands read raw or Y4M input\n", P.filename);
+        return 0;
+    }
+    if (P.pack) {
+        return write_pack();
+    }
+    if (P.extract) {
+        return extract_mb();
+    }
+    if (P.output) {
+        return write_frames();
+    }
+    if (P.stats_file) {
+        return write_stats();
+    }
+    if (P.artifacts_file) {
+        return write_artifacts();
+    }
+    if (P.variance_file) {
+        return write_variance();
+    }
+    return export_frames();
+}
+
+Uint32 create_message_queue(void)
+{
+    /* Should probably use argv[0] or similar as pathname
+     * when creating the key;
+     * but let's keep it simple for now. Y for YCbCr
+     */
+    if ((P.key = ftok("/tmp", 'Y')) == -1) {
+        perror("ftok");
+        return 0;
+    }
+
+    if ((P.msqid = msgget(P.key, 0644 | IPC_CREAT)) == -1) {
+        perror("msgget");
+        return 0;
+    }
+
+    /* we don't really care in this case */
+    P.buf.mtype = 1;
+    return 1;
+}
+
+Uint32 connect_message_queue(void)
+{
+    if ((P.key = ftok("/tmp", 'Y')) == -1) {
+        perror("ftok");
+        return 0;
+    }
+
+    /* connect to the queue */
+    if ((P.msqid = msgget(P.key, 0644)) == -1) {
+        perror("msgget");
+        return 0;
+    }
+
+    printf("Ready to receive messages, captain.\n");
+    return 1;
+}
+
+Uint32 send_message(char cmd, Uint32 frame)
+{
+    if (P.mode != MASTER) {
+        return 1;
+    }
+
+    P.buf.mtext[0] = cmd;
+    P.buf.mtext[1] = '\0';
+    P.buf.frame = frame;
+
+    if (msgsnd(P.msqid, &P.buf, sizeof(P.buf) - sizeof(long), 0) == -1) {
+        perror("msgsnd");
+        return 0;
+    }
+
+    return 1;
+}
+
+Uint32 read_message(void)
+{
+    /* polled, so that the slave thread notices a mode change */
+    if (msgrcv(P.msqid, &P.buf, sizeof(P.buf) - sizeof(long), 0, IPC_NOWAIT) == -1) {
+        if (errno == ENOMSG) {
+            return 0;
+        }
+        perror("msgrcv");
+        P.mode = NONE;
+        return 0;
+    }
+
+    return 1;
+}
+
+void destroy_message_queue(void)
+{
+    if (P.mode == MASTER) {
+        if (msgctl(P.msqid, IPC_RMID, NULL) == -1) {
+            perror("msgctl");
+        }
+        printf("queue destroyed\n");
+    }
+}
+
+/* runs on the slave thread, SDL_PushEvent() is thread safe */
+Uint32 event_dispatcher(void)
+{
+    SDL_Event event;
+
+    if (read_message()) {
+
+        switch (P.buf.mtext[0])
+        {
+            case NEXT:
+                event.type = SDL_KEYDOWN;
+                event.key.keysym.sym = SDLK_RIGHT;
+                SDL_PushEvent(&event);
+                break;
+
+            case PREV:
+                event.type = SDL_KEYDOWN;
+                event.key.keysym.sym = SDLK_LEFT;
+                SDL_PushEvent(&event);
+                break;
+
+            case REW:
+                event.type = SDL_KEYDOWN;
+                event.key.keysym.sym = SDLK_r;
+                SDL_PushEvent(&event);
+                break;
+
+            case ZOOM_IN:
+                event.type = SDL_KEYDOWN;
+                event.key.keysym.sym = SDLK_UP;
+                SDL_PushEvent(&event);
+                break;
 
-    if (FORMAT == YV12 || FORMAT == IYUV) {
-        P.frame_size = P.wh * 3 / 2;
-        P.y_size = P.wh;
-        P.cb_size = P.wh / 4;
-        P.cr_size = P.wh / 4;
-    } else if (FORMAT == YUY2 || FORMAT == UYVY || FORMAT == YVYU || FORMAT == Y42210) {
-        P.grid_start_pos = 0;
-        P.frame_size = P.wh * 2;
-        P.y_size = P.wh;
-        P.cb_size = P.wh / 2;
-        P.cr_size = P.wh / 2;
-    } else if (FORMAT == YV1210) {
-        /* SDL cannot natively display this format; let's fake it
-         * and pretend it's YV12 */
-        P.frame_size = P.wh * 3 / 2;
-        P.y_size = P.wh;
-        P.cb_size = P.wh / 4;
-        P.cr_size = P.wh / 4;
+            case ZOOM_OUT:
+                event.type = SDL_KEYDOWN;
+                event.key.keysym.sym = SDLK_DOWN;
+                SDL_PushEvent(&event);
+                break;
+
+            case QUIT:
+                event.type = SDL_KEYDOWN;
+                event.key.keysym.sym = SDLK_q;
+                SDL_PushEvent(&event);
+                break;
+
+            case Y_ONLY:
+                event.type = SDL_KEYDOWN;
+                event.key.keysym.sym = SDLK_F5;
+                SDL_PushEvent(&event);
+                break;
+
+            case CB_ONLY:
+                event.type = SDL_KEYDOWN;
+                event.key.keysym.sym = SDLK_F6;
+                SDL_PushEvent(&event);
+                break;
+
+            case CR_ONLY:
+                event.type = SDL_KEYDOWN;
+                event.key.keysym.sym = SDLK_F7;
+                SDL_PushEvent(&event);
+                break;
+
+            case ALL_PLANES:
+                event.type = SDL_KEYDOWN;
+                event.key.keysym.sym = SDLK_F8;
+                SDL_PushEvent(&event);
+                break;
+
+            case GOTO:
+                event.type = SDL_USEREVENT;
+                event.user.code = EV_GOTO;
+                event.user.data1 = (void*)(intptr_t)P.buf.frame;
+                SDL_PushEvent(&event);
+                break;
+
+            default:
+                fprintf(stderr, "~TILT\n");
+                return 0;
+        }
+        return 1;
+    }
+    return 0;
+}
+
+void set_caption(char *array, Uint32 frame, Uint32 bytes)
+{
+    char speed[16] = "";
+    const char* scaler[SCALE_MODES] = {"", " nearest", " bilinear", " area"};
+    const char* bits[BITS_MODES] = {"", " bits 8-1", " bits 7-0", " stretch"};
+    const char* scope[SCOPE_MODES] = {"", " waveform", " parade", " vectorscope"};
+    char art[64] = "";
+    char clip[32] = "";
+
+    if (LIST.count > 1) {
+        snprintf(clip, sizeof(clip), " [%u/%u]", LIST.current + 1, LIST.count);
+    }
+    if (P.speed != 0 && P.speed != 1) {
+        snprintf(speed, sizeof(speed), " x%d", P.speed);
+    }
+    if (P.artifacts) {
+        snprintf(art, sizeof(art), " B8 %.2f B16 %.2f B%u %.2f R %.2f",
+                 ART.frame.block[0], ART.frame.block[1], P.ctu, ART.frame.block[2],
+                 ART.frame.ringing);
+    }
+
+    snprintf(array, bytes, "%s%s - %s%s%s%s%s%s%s%s%s%s%s%s frame %d, size %dx%d%s%s%s%s",
+            P.filename,
+            clip,
+            (P.mode == MASTER) ? "[MASTER]" :
+            (P.mode == SLAVE) ? "[SLAVE]": "",
+            P.grid ? "G" : "",
+            P.mb ? "M" : "",
+            P.diff ? "D" : "",
+            P.temporal ? "T" : "",
+            P.loop ? "L" : "",
+            P.heatmap ? "E" : "",
+            P.hist ? "H" : "",
+            P.y_only ? "Y" : "",
+            P.cb_only ? "Cb" : "",
+            P.cr_only ? "Cr" : "",
+            speed,
+            frame,
+            P.zoom_width,
+            P.zoom_height,
+            scaler[P.scaler],
+            bits[P.bits],
+            scope[P.scope],
+            art);
+}
+
+void set_zoom_rect(void)
+{
+    if (P.scale > 0) {
+        /* fractional zoom, keep even for the chroma planes */
+        P.zoom_width = ((Uint32)(P.width * P.scale + 0.5) + 1) & ~1;
+        P.zoom_height = ((Uint32)(P.height * P.scale + 0.5) + 1) & ~1;
+        if (P.zoom_width < 2)
+            P.zoom_width = 2;
+        if (P.zoom_height < 2)
+            P.zoom_height = 2;
+    } else if (P.zoom > 0) {
+        P.zoom_width = P.width * P.zoom;
+        P.zoom_height = P.height * P.zoom;
+    } else if (P.zoom <= 0) {
+        P.zoom_width = P.width / (abs(P.zoom) + 2);
+        P.zoom_height = P.height / (abs(P.zoom) + 2);
+    } else {
+        fprintf(stderr, "ERROR in zoom:\n");
+    }
+}
+
+/* UI thread only */
+Uint32 push_command(Uint32 type, Sint32 a, Sint32 b)
+{
+    Uint32 tail = R.tail;
+
+    if (tail - __atomic_load_n(&R.head, __ATOMIC_ACQUIRE) == CMD_QUEUE_SIZE) {
+        /* render thread is far behind, drop rather than block the UI */
+        return 0;
+    }
+
+    R.queue[tail & (CMD_QUEUE_SIZE - 1)].type = type;
+    R.queue[tail & (CMD_QUEUE_SIZE - 1)].a = a;
+    R.queue[tail & (CMD_QUEUE_SIZE - 1)].b = b;
+    R.queue[tail & (CMD_QUEUE_SIZE - 1)].t = now();
+    __atomic_store_n(&R.tail, tail + 1, __ATOMIC_RELEASE);
+    SDL_SemPost(R.wake);
+    return 1;
+}
+
+/* render thread only */
+Uint32 pop_command(struct command* cmd, Uint32 wait)
+{
+    Uint32 head = R.head;
+
+    /* ready for the next input, so the last one is done */
+    if (SES.busy) {
+        input_handled();
+        SES.busy = 0;
+    }
+
+    if (wait) {
+        SDL_SemWait(R.wake);
+    } else if (SDL_SemTryWait(R.wake) != 0) {
+        return 0;
+    }
+
+    /* the wake-up may belong to a queued command, the counts add up */
+    if (__atomic_load_n(&R.control, __ATOMIC_ACQUIRE)) {
+        cmd->type = CMD_CONTROL;
+        return 1;
+    }
+
+    if (head == __atomic_load_n(&R.tail, __ATOMIC_ACQUIRE)) {
+        /* woken up to quit */
+        return 0;
+    }
+
+    *cmd = R.queue[head & (CMD_QUEUE_SIZE - 1)];
+    __atomic_store_n(&R.head, head + 1, __ATOMIC_RELEASE);
+    if (SES.on && (cmd->type == CMD_KEY || cmd->type == CMD_CLICK ||
+                   cmd->type == CMD_REGION)) {
+        SES.taken = *cmd;
+        SES.busy = 1;
+    }
+    return 1;
+}
+
+void post_event(Sint32 code, void* data1, void* data2)
+{
+    SDL_Event ev;
+
+    ev.type = SDL_USEREVENT;
+    ev.user.code = code;
+    ev.user.data1 = data1;
+    ev.user.data2 = data2;
+    SDL_PushEvent(&ev);
+}
+
+void post_caption(void)
+{
+    SDL_LockMutex(R.lock);
+    set_caption(R.caption, R.frame, sizeof(R.caption));
+    SDL_UnlockMutex(R.lock);
+    post_event(EV_CAPTION, NULL, NULL);
+}
+
+/* render thread: new window size, and with the built-in scaler new
+ * overlays, then redraw. Waits until the UI thread has made them. */
+void resize(void)
+{
+    set_zoom_rect();
+    post_event(EV_RESIZE, (void*)(intptr_t)P.zoom_width,
+               (void*)(intptr_t)P.zoom_height);
+    while (SDL_SemWaitTimeout(R.resized, 100) == SDL_MUTEX_TIMEDOUT) {
+        if (__atomic_load_n(&R.quit, __ATOMIC_ACQUIRE)) {
+            return;
+        }
+    }
+    if (P.scaler != SCALE_SDL && R.frame) {
+        draw_frame();
+    }
+}
+
+/* open the next clip, find its geometry and read its start while the
+ * current one plays */
+int prefetch_thread(void* data)
+{
+    struct playlist_entry* clip = &LIST.clips[LIST.next];
+    Uint64 limit = (Uint64)PLAYLIST_PREFETCH_MB << 20;
+    Uint8* buf;
+    char magic[8];
+    ssize_t n;
+
+    (void)data;
+    LIST.bytes = 0;
+    LIST.fd = open(clip->name, O_RDONLY);
+    if (LIST.fd < 0) {
+        return 0;
+    }
+    /* .yvz headers are left to open_clip(), they go into PAK */
+    if (pread(LIST.fd, magic, sizeof(magic), 0) != sizeof(magic) ||
+        memcmp(magic, PACK_MAGIC, sizeof(magic))) {
+        LIST.probed = clip_probe(clip) ? 1 : -1;
+    }
+
+    buf = malloc(1 << 20);
+    if (!buf) {
+        return 0;
+    }
+    while (LIST.bytes < limit && !__atomic_load_n(&LIST.stop, __ATOMIC_ACQUIRE) &&
+           (n = pread(LIST.fd, buf, 1 << 20, LIST.bytes)) > 0) {
+        LIST.bytes += n;
+    }
+    free(buf);
+    return 0;
+}
+
+void prefetch_clip(Uint32 index)
+{
+    if (index >= LIST.count) {
+        return;
+    }
+    LIST.next = index;
+    LIST.stop = 0;
+    LIST.fd = -1;
+    LIST.probed = 0;
+    memset(&LIST.index, 0, sizeof(LIST.index));
+    LIST.thread = start_thread(prefetch_thread, "prefetch", NULL);
+}
+
+/* everything allocate_memory() and the lazy caches sized by the frame */
+void free_frame_buffers(void)
+{
+    if (P.y_in != P.y_data) {
+        free(P.y_in);
+        free(P.cb_in);
+        free(P.cr_in);
+    }
+    free(P.raw);
+    free(P.y_data);
+    free(P.cb_data);
+    free(P.cr_data);
+    free(P.y_ref);
+    free(P.y_cmp);
+    free(P.y_prev);
+    free(P.cb_ref);
+    free(P.cr_ref);
+    free(P.mb_sad);
+    free(P.mb_sse);
+    P.y_in = P.cb_in = P.cr_in = NULL;
+    P.raw = P.y_data = P.cb_data = P.cr_data = NULL;
+    P.y_ref = P.y_cmp = P.y_prev = NULL;
+    P.cb_ref = P.cr_ref = NULL;
+    P.mb_sad = P.mb_sse = NULL;
+
+    if (SC.stage && SC.stage->planes == 1) {
+        free(SC.stage_pixels[0]);
+    }
+    free(SC.stage);
+    free(SC.src_planes);
+    SC.stage = NULL;
+    SC.src_planes = NULL;
+
+    free(SCOPE.bins);
+    free(SCOPE.vbins);
+    free(SCOPE.vshade);
+    free(SCOPE.y);
+    free(SCOPE.cb);
+    free(SCOPE.cr);
+    free(SCOPE.rgb);
+    free(SCOPE.col);
+    memset(&SCOPE, 0, sizeof(SCOPE));
+
+    free(ART.luma);
+    free(ART.pad);
+    free(ART.colsum);
+    free(ART.rowsum);
+    free(ART.blocks);
+    memset(&ART, 0, sizeof(ART));
+    sat_free();
+}
+
+/* render thread: the clip on screen, or what a failed start_clip()
+ * left of its clip */
+void close_clip(void)
+{
+    preload_free();
+    if (PAK.packed) {
+        pack_close();
+        memset(&PAK, 0, sizeof(PAK));
+    }
+    aio_close();
+    memset(&AIO, 0, sizeof(AIO));
+    if (fd) {
+        fclose(fd);
+        fd = NULL;
+    }
+    free(P.stats);
+    P.stats = NULL;
+    P.stats_count = 0;
+    free(P.index[0].offset);
+    memset(&P.index[0], 0, sizeof(P.index[0]));
+    P.loop = 0;
+    P.mark_a = 0;
+    P.mark_b = 0;
+}
+
+/* render thread: open clip index after close_clip(), with what the
+ * prefetch thread found if prefetched. buffers holds width, height and
+ * format of the frame buffers (width 0 while there are none) and is
+ * set to 1 when they are allocated anew. */
+Uint32 start_clip(Uint32 index, Uint32 prefetched, Uint32* buffers)
+{
+    struct playlist_entry* clip = &LIST.clips[index];
+    Sint32 zoom = P.zoom;
+    int in = -1;
+
+    if (prefetched) {
+        in = LIST.fd;
+        LIST.fd = -1;
+    }
+    LIST.current = index;
+    P.filename = clip->name;
+    P.frame_ms = FRAME_MS;
+    if (prefetched && LIST.probed > 0) {
+        P.width = LIST.width;
+        P.height = LIST.height;
+        FORMAT = LIST.format;
+        if (LIST.frame_ms) {
+            P.frame_ms = LIST.frame_ms;
+        }
+        P.index[0] = LIST.index;
+        memset(&LIST.index, 0, sizeof(LIST.index));
+        set_overlay_format();
+    } else if ((prefetched && LIST.probed < 0) || !clip_geometry(clip)) {
+        if (in >= 0) {
+            close(in);
+        }
+        return 0;
+    }
+
+    if (P.width != buffers[0] || P.height != buffers[1] || FORMAT != buffers[2]) {
+        free_frame_buffers();
+        buffers[0] = 0;
+        setup_param();
+        P.zoom = zoom;
+        if (!allocate_memory()) {
+            if (in >= 0) {
+                close(in);
+            }
+            return 0;
+        }
+        buffers[0] = P.width;
+        buffers[1] = P.height;
+        buffers[2] = FORMAT;
+        buffers[3] = 1;
+    }
+
+    fd = in >= 0 ? fdopen(in, "rb") : fopen(P.filename, "rb");
+    if (!fd) {
+        fprintf(stderr, "Error opening %s\n", P.filename);
+        if (in >= 0) {
+            close(in);
+        }
+        return 0;
+    }
+    /* a prefetched Y4M clip comes indexed */
+    if (!P.index[0].offset && !build_index(0, P.filename)) {
+        return 0;
+    }
+    if (PAK.packed ? !pack_open() : P.aio_depth && !aio_open()) {
+        return 0;
+    }
+    check_input();
+    if (P.preload_mb && P.num_frames) {
+        preload(0, P.num_frames - 1);
+    }
+    seek_frame(0);
+    R.frame = 0;
+    return 1;
+}
+
+/* render thread: close the clip on screen and open clip index of the
+ * playlist, or the first one after it that opens. Buffers and overlays
+ * stay if size and format do. */
+Uint32 open_clip(Uint32 index)
+{
+    Uint32 buffers[4] = {P.width, P.height, FORMAT, 0};
+    Uint32 prefetched = 0;
+    Uint64 warm = 0;
+    double start = now();
+
+    if (LIST.thread) {
+        __atomic_store_n(&LIST.stop, 1, __ATOMIC_RELEASE);
+        SDL_WaitThread(LIST.thread, NULL);
+        LIST.thread = NULL;
+        if (LIST.next == index) {
+            prefetched = 1;
+            warm = LIST.bytes;
+        } else {
+            if (LIST.fd >= 0) {
+                close(LIST.fd);
+            }
+            free(LIST.index.offset);
+        }
+    }
+
+    for (;; index++, prefetched = 0, warm = 0) {
+        close_clip();
+        if (index >= LIST.count) {
+            fprintf(stderr, "No more clips to play\n");
+            return 0;
+        }
+        if (start_clip(index, prefetched, buffers)) {
+            break;
+        }
+        fprintf(stderr, "Skipping %s\n", LIST.clips[index].name);
+        if (prefetched) {
+            /* the index, if start_clip() did not take it over */
+            free(LIST.index.offset);
+            memset(&LIST.index, 0, sizeof(LIST.index));
+        }
+    }
+
+    if (buffers[3]) {
+        resize();
+    }
+    fprintf(stdout, "Clip %u/%u %s: %ux%u %s, %u frames, %s, %.1f MB prefetched, "
+            "open in %.1f ms\n", index + 1, LIST.count, P.filename, P.width, P.height,
+            format_names[FORMAT], P.num_frames, buffers[3] ? "new buffers" : "buffers kept",
+            warm / 1e6, (now() - start) * 1000);
+    fflush(stdout);
+
+    prefetch_clip(index + 1);
+    return 1;
+}
+
+/* past the last frame of a playlist clip: the next one, 0 on error */
+Uint32 clip_end(void)
+{
+    if (!LIST.count || P.loop || P.next_frame < P.num_frames ||
+        LIST.current + 1 >= LIST.count) {
+        return 1;
+    }
+    return open_clip(LIST.current + 1);
+}
+
+/* SPACE, f and b - returns when a key is pressed or the clip ends */
+void play(SDLKey sym)
+{
+    struct command cmd;
+    Uint32 next_tick = SDL_GetTicks();
+    Uint32 ticks;
+    int play_yuv = 1; /* play it, sam! */
+
+    P.speed = sym == SDLK_SPACE ? 1 : sym == SDLK_f ? 2 : -2;
+
+    while (play_yuv) {
+        /* window closed, draw_frame() no longer waits for it */
+        if (__atomic_load_n(&R.quit, __ATOMIC_ACQUIRE)) {
+            break;
+        }
+        post_caption();
+
+        /* R.frame is the next frame, leaving the loop seeks back to A */
+        if (P.speed == 1 && loop_target(R.frame) == R.frame) {
+            /* check for next frame existing, or the next clip */
+            if (!clip_end()) {
+                __atomic_store_n(&R.quit, 1, __ATOMIC_RELEASE);
+                play_yuv = 0;
+            } else if (read_frame()) {
+                draw_frame();
+                R.frame++;
+                send_message(NEXT, R.frame - 1);
+            } else {
+                play_yuv = 0;
+            }
+        } else {
+            /* trick play, seek straight to every Nth frame and read
+             * ahead the ones after it */
+            Sint64 target = loop_target((Sint64)R.frame - 1 + P.speed);
+
+            AIO.step = P.speed;
+            if (target >= 0 && goto_frame(target)) {
+                R.frame = target + 1;
+                send_message(GOTO, R.frame - 1);
+            } else {
+                play_yuv = 0;
+            }
+        }
+        if (__atomic_load_n(&R.quit, __ATOMIC_ACQUIRE)) {
+            break;
+        }
+        /* insert delay for real time viewing, on a fixed schedule so
+         * pacing does not drift; start over after falling behind */
+        next_tick += P.frame_ms;
+        ticks = SDL_GetTicks();
+        if (play_yuv && (Sint32)(next_tick - ticks) > 0)
+            SDL_Delay(next_tick - ticks);
+        else if ((Sint32)(ticks - next_tick) > (Sint32)P.frame_ms)
+            next_tick = ticks;
+
+        /* check for any key event */
+        if (pop_command(&cmd, 0)) {
+            if (cmd.type == CMD_QUIT) {
+                __atomic_store_n(&R.quit, 1, __ATOMIC_RELEASE);
+                play_yuv = 0;
+            } else if (cmd.type == CMD_CONTROL) {
+                run_control();
+                play_yuv = !__atomic_load_n(&R.quit, __ATOMIC_ACQUIRE);
+            } else if (cmd.type != CMD_KEY) {
+                continue;
+            } else if (cmd.a == SDLK_f) {
+                /* 2x, 4x, 8x, 16x forward */
+                P.speed = P.speed > 1 ? P.speed * 2 : 2;
+                if (P.speed > MAX_SPEED)
+                    P.speed = MAX_SPEED;
+            } else if (cmd.a == SDLK_b) {
+                P.speed = P.speed < 0 ? P.speed * 2 : -2;
+                if (P.speed < -MAX_SPEED)
+                    P.speed = -MAX_SPEED;
+            } else {
+                /* stop playing */
+                play_yuv = 0;
+            }
+        }
+    }
+    P.speed = 0;
+    AIO.step = 1;
+}
+
+/* render thread, returns 1 on quit */
+Uint32 handle_key(SDLKey sym)
+{
+    switch (sym)
+    {
+        case SDLK_SPACE:
+        case SDLK_f: /* fast forward */
+        case SDLK_b: /* fast rewind */
+            play(sym);
+            break;
+        case SDLK_RIGHT: /* next frame */
+            if (!clip_end()) {
+                return 1;
+            }
+            /* check for next frame existing */
+            if (read_frame()) {
+                draw_frame();
+                R.frame++;
+                send_message(NEXT, R.frame - 1);
+            }
+            break;
+        case SDLK_PAGEDOWN: /* next clip of the playlist */
+        case SDLK_PAGEUP: /* previous clip */
+            if (sym == SDLK_PAGEDOWN ? LIST.current + 1 < LIST.count : LIST.current > 0) {
+                if (!open_clip(sym == SDLK_PAGEDOWN ? LIST.current + 1 : LIST.current - 1)) {
+                    return 1;
+                }
+                if (read_frame()) {
+                    draw_frame();
+                    R.frame++;
+                }
+            }
+            break;
+        case SDLK_LEFT: /* previous frame */
+            if (R.frame > 1) {
+                R.frame--;
+                seek_frame(R.frame - 1);
+                read_frame();
+                draw_frame();
+                send_message(PREV, R.frame - 1);
+            }
+            break;
+        case SDLK_UP: /* zoom in */
+            P.zoom++;
+            P.scale = 0;
+            resize();
+            send_message(ZOOM_IN, R.frame - 1);
+            break;
+        case SDLK_DOWN: /* zoom out */
+            P.zoom--;
+            P.scale = 0;
+            resize();
+            send_message(ZOOM_OUT, R.frame - 1);
+            break;
+        case SDLK_EQUALS: /* fractional zoom in */
+        case SDLK_MINUS: /* fractional zoom out */
+            if (P.scale == 0) {
+                P.scale = (double)P.zoom_width / P.width;
+            }
+            P.scale *= sym == SDLK_EQUALS ? 1.25 : 0.8;
+            resize();
+            break;
+        case SDLK_w: /* fit to window */
+            P.scale = (double)P.screen_w / P.width;
+            if ((double)P.screen_h / P.height < P.scale)
+                P.scale = (double)P.screen_h / P.height;
+            resize();
+            break;
+        case SDLK_s: /* cycle scaler: sdl, nearest, bilinear, area */
+            P.scaler = (P.scaler + 1) % SCALE_MODES;
+            resize();
+            if (P.scaler == SCALE_SDL && R.frame)
+                draw_frame();
+            break;
+        case SDLK_r: /* rewind */
+            if (R.frame > 1) {
+                R.frame = 1;
+                seek_frame(0);
+                read_frame();
+                draw_frame();
+                send_message(REW, R.frame - 1);
+            }
+            break;
+        case SDLK_g: /* display grid */
+            P.grid = ~P.grid;
+            if (P.zoom < 1)
+                P.grid = 0;
+            draw_frame();
+            break;
+        case SDLK_m: /* show mb-data on stdout */
+            P.mb = ~P.mb;
+            if (P.zoom < 1)
+                P.mb = 0;
+            draw_frame();
+            break;
+        case SDLK_F5: /* Luma data only */
+            P.y_only = ~P.y_only;
+            P.cb_only = 0;
+            P.cr_only = 0;
+            draw_frame();
+            send_message(Y_ONLY, R.frame - 1);
+            break;
+        case SDLK_F6: /* Cb data only */
+            P.cb_only = ~P.cb_only;
+            P.y_only = 0;
+            P.cr_only = 0;
+            draw_frame();
+            send_message(CB_ONLY, R.frame - 1);
+            break;
+        case SDLK_F7: /* Cr data only */
+            P.cr_only = ~P.cr_only;
+            P.y_only = 0;
+            P.cb_only = 0;
+            send_message(CR_ONLY, R.frame - 1);
+            draw_frame();
+            break;
+        case SDLK_F8: /* display all color planes */
+            P.y_only = 0;
+            P.cb_only = 0;
+            P.cr_only = 0;
+            draw_frame();
+            send_message(ALL_PLANES, R.frame - 1);
+            break;
+        case SDLK_e: /* per-MB error heatmap */
+            P.heatmap = ~P.heatmap;
+            if (!P.diff && !P.temporal)
+                P.heatmap = 0;
+            draw_frame();
+            break;
+        case SDLK_a: /* artifacts: off, in caption, with 8x8 overlay */
+            P.artifacts = (P.artifacts + 1) % ARTIFACTS_MODES;
+            if (R.frame)
+                draw_frame();
+            break;
+        case SDLK_o: /* scopes: off, waveform, RGB parade, vectorscope */
+            P.scope = (P.scope + 1) % SCOPE_MODES;
+            if (R.frame)
+                draw_frame();
+            break;
+        case SDLK_v: /* 10 bpp: rounded, bits 8-1, bits 7-0, stretched */
+            if (P.depth == 8)
+                break;
+            P.bits = (P.bits + 1) % BITS_MODES;
+            if (R.frame)
+                draw_frame();
+            break;
+        case SDLK_t: /* temporal diff, frame N vs N-1 */
+            P.temporal = ~P.temporal;
+            if (P.diff)
+                P.temporal = 0;
+            if (!P.temporal && !P.diff)
+                P.heatmap = 0;
+            if (R.frame) {
+                seek_frame(R.frame - 1);
+                read_frame();
+                draw_frame();
+            }
+            break;
+        case SDLK_n: /* next cut, black or frozen frame */
+            next_event();
+            break;
+        case SDLK_LEFTBRACKET: /* A marker */
+        case SDLK_RIGHTBRACKET: /* B marker */
+            set_marker(sym == SDLK_RIGHTBRACKET);
+            break;
+        case SDLK_l: /* loop A-B */
+            toggle_loop();
+            break;
+        case SDLK_p: /* save frame as PNG */
+            dump_frame();
+            break;
+        case SDLK_h: /* histogram */
+            P.hist = ~P.hist;
+            draw_frame();
+            break;
+        case SDLK_F1: /* MASTER-mode */
+            if (create_message_queue()) {
+                P.mode = MASTER;
+                stop_slave();
+            }
+            break;
+        case SDLK_F2: /* SLAVE-mode */
+            if (P.mode == MASTER) {
+                destroy_message_queue();
+            }
+            if (connect_message_queue()) {
+                P.mode = SLAVE;
+                if (!R.slave) {
+                    R.slave = start_thread(slave_thread, "slave", NULL);
+                }
+            }
+            break;
+        case SDLK_F3: /* NONE-mode */
+            destroy_message_queue();
+            P.mode = NONE;
+            stop_slave();
+            break;
+        case SDLK_q: /* quit */
+            send_message(QUIT, R.frame - 1);
+            return 1;
+        default:
+            break;
+    } /* switch key */
+
+    return 0;
+}
+
+/* loop inspired by yay
+ * http://freecode.com/projects/yay
+ */
+int render_thread(void* data)
+{
+    struct command cmd;
+    SDL_Event ev;
+
+    (void)data;
+
+    while (!__atomic_load_n(&R.quit, __ATOMIC_ACQUIRE)) {
+        if (!pop_command(&cmd, 1)) {
+            continue;
+        }
+
+        switch (cmd.type)
+        {
+            case CMD_KEY:
+                if (handle_key(cmd.a)) {
+                    __atomic_store_n(&R.quit, 1, __ATOMIC_RELEASE);
+                }
+                break;
+            case CMD_CLICK:
+                show_mb(cmd.a, cmd.b);
+                break;
+            case CMD_REGION:
+                region_probe(cmd.a, cmd.b);
+                break;
+            case CMD_GOTO: /* from master */
+                if (goto_frame(cmd.a)) {
+                    R.frame = cmd.a + 1;
+                }
+                break;
+            case CMD_QUIT:
+                __atomic_store_n(&R.quit, 1, __ATOMIC_RELEASE);
+                break;
+            case CMD_CONTROL:
+                run_control();
+                break;
+            default:
+                break;
+        }
+        post_caption();
     }
 
-    if (FORMAT == YUY2) {
-        /* Y U Y V
-         * 0 1 2 3 */
-        P.y_start_pos = 0;
-        P.cb_start_pos = 1;
-        P.cr_start_pos = 3;
-    } else if (FORMAT == UYVY) {
-        /* U Y V Y
-         * 0 1 2 3 */
-        P.y_start_pos = 1;
-        P.grid_start_pos = 1;
-        P.cb_start_pos = 0;
-        P.cr_start_pos = 2;
-    } else if (FORMAT == YVYU || FORMAT == Y42210)  {
-        /* Y V Y U
-         * 0 1 2 3 */
-        P.y_start_pos = 0;
-        P.cb_start_pos = 3;
-        P.cr_start_pos = 1;
+    if (P.mode == SLAVE) {
+        P.mode = NONE;
+        stop_slave();
     }
+
+    /* let the UI thread know, in case the quit came from a key */
+    ev.type = SDL_QUIT;
+    SDL_PushEvent(&ev);
+    return 0;
 }
 
-void check_input(void)
+/* Control socket: one client at a time, one command per line and one
+ * status line per reply, "OK ..." or "ERR ...". grab is followed by
+ * the frame. Commands run on the render thread between frames. */
+Uint32 control_open(void)
 {
-    Uint32 file_size;
+    struct sockaddr_un addr;
+    struct stat st;
 
-    /* Frame Size is an even multipe of 16x16? */
-    if (P.width % 16 != 0) {
-        fprintf(stderr, "WIDTH not multiple of 16, check input...\n");
+    if (strlen(P.control_path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Control socket path too long\n");
+        return 0;
     }
-    if (P.height % 16 != 0) {
-        fprintf(stderr, "HEIGHT not multiple of 16, check input...\n");
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, P.control_path);
+
+    P.control_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (P.control_fd < 0) {
+        perror("socket");
+        return 0;
+    }
+    /* a socket left over from an earlier run, never anything else */
+    if (!lstat(P.control_path, &st)) {
+        if (!S_ISSOCK(st.st_mode)) {
+            fprintf(stderr, "%s exists and is not a socket\n", P.control_path);
+            close(P.control_fd);
+            P.control_fd = -1;
+            return 0;
+        }
+        unlink(P.control_path);
+    }
+    if (bind(P.control_fd, (struct sockaddr*)&addr, sizeof(addr)) ||
+        listen(P.control_fd, 4)) {
+        perror(P.control_path);
+        close(P.control_fd);
+        P.control_fd = -1;
+        return 0;
     }
+    return 1;
+}
 
-    /* Even number of frames? */
-    fseek(fd, 0L, SEEK_END);
-    file_size = ftell(fd);
-    fseek(fd, 0L, SEEK_SET);
+void control_close(void)
+{
+    struct stat st;
 
-    if (file_size % P.frame_size != 0) {
-        fprintf(stderr, "#FRAMES not an integer, check input...\n");
+    if (P.control_path && P.control_fd >= 0) {
+        close(P.control_fd);
+        /* unless it was replaced meanwhile */
+        if (!lstat(P.control_path, &st) && S_ISSOCK(st.st_mode)) {
+            unlink(P.control_path);
+        }
     }
 }
 
-Uint32 create_message_queue(void)
+Uint32 send_all(int fd, const void* data, Uint64 size)
 {
-    /* Should probably use argv[0] or similar as pathname
-     * when creating the key;
-     * but let's keep it simple for now. Y for YCbCr
-     */
-    if ((P.key = ftok("/tmp", 'Y')) == -1) {
-        perror("ftok");
-        return 0;
-    }
+    const Uint8* p = data;
 
-    if ((P.msqid = msgget(P.key, 0644 | IPC_CREAT)) == -1) {
-        perror("msgget");
-        return 0;
-    }
+    while (size) {
+        ssize_t n = send(fd, p, size, MSG_NOSIGNAL);
 
-    /* we don't really care in this case */
-    P.buf.mtype = 1;
+        if (n < 0) {
+            return 0;
+        }
+        p += n;
+        size -= n;
+    }
     return 1;
 }
 
-Uint32 connect_message_queue(void)
+/* hand one line to the render thread and send back its answer */
+Uint32 control_request(int client, char* line, SDL_sem* done)
 {
-    if ((P.key = ftok("/tmp", 'Y')) == -1) {
-        perror("ftok");
-        return 0;
+    struct control c;
+    struct control* mine = &c;
+    Uint32 ret;
+
+    c.line = line;
+    c.data = NULL;
+    c.size = 0;
+    c.done = done;
+    __atomic_store_n(&R.control, &c, __ATOMIC_RELEASE);
+    SDL_SemPost(R.wake);
+
+    while (SDL_SemWaitTimeout(done, 100) == SDL_MUTEX_TIMEDOUT) {
+        /* on quit take it back, unless the render thread has it */
+        if (__atomic_load_n(&R.quit, __ATOMIC_ACQUIRE) &&
+            __atomic_compare_exchange_n(&R.control, &mine, NULL, 0,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            return 0;
+        }
     }
 
-    /* connect to the queue */
-    if ((P.msqid = msgget(P.key, 0644)) == -1) {
-        perror("msgget");
-        return 0;
+    ret = send_all(client, c.reply, strlen(c.reply));
+    if (ret && c.data) {
+        ret = send_all(client, c.data, c.size);
     }
+    free(c.data);
+    return ret;
+}
 
-    printf("Ready to receive messages, captain.\n");
-    return 1;
+int control_thread(void* data)
+{
+    char buf[1024];
+    Uint32 len = 0;
+    int client = -1;
+    SDL_sem* done = SDL_CreateSemaphore(0);
+
+    (void)data;
+
+    while (done && !__atomic_load_n(&R.quit, __ATOMIC_ACQUIRE)) {
+        struct pollfd pfd;
+        char* nl;
+        ssize_t n;
+
+        pfd.fd = client >= 0 ? client : P.control_fd;
+        pfd.events = POLLIN;
+        if (poll(&pfd, 1, 100) <= 0) {
+            continue;
+        }
+        if (client < 0) {
+            client = accept(P.control_fd, NULL, NULL);
+            len = 0;
+            continue;
+        }
+
+        n = read(client, buf + len, sizeof(buf) - 1 - len);
+        if (n <= 0) {
+            close(client);
+            client = -1;
+            continue;
+        }
+        len += n;
+
+        /* pipelined commands are answered in order */
+        while ((nl = memchr(buf, '\n', len))) {
+            Uint32 used = nl + 1 - buf;
+
+            *nl = '\0';
+            if (!control_request(client, buf, done)) {
+                break;
+            }
+            memmove(buf, nl + 1, len - used);
+            len -= used;
+        }
+        if (len == sizeof(buf) - 1) {
+            send_all(client, "ERR line too long\n", 18);
+            len = 0;
+        }
+    }
+
+    if (client >= 0) {
+        close(client);
+    }
+    if (done) {
+        SDL_DestroySemaphore(done);
+    }
+    return 0;
 }
 
-Uint32 send_message(char cmd)
+/* render thread: answer the pending control request */
+void run_control(void)
 {
-    if (P.mode != MASTER) {
-        return 1;
+    struct control* c = __atomic_exchange_n(&R.control, NULL, __ATOMIC_ACQ_REL);
+    /* YV12 keeps Cr first, so cb_data holds Cr there */
+    Uint32 cr_first = FORMAT == YV12 || FORMAT == YV1210;
+    char cmd[32] = "";
+    char arg[64] = "";
+    char* end;
+    Uint32 f;
+
+    if (!c) {
+        return;
+    }
+    sscanf(c->line, "%31s %63s", cmd, arg);
+
+    if (!strcmp(cmd, "goto")) {
+        f = strtoul(arg, &end, 10);
+        if (!*arg || *end || !goto_frame(f)) {
+            snprintf(c->reply, sizeof(c->reply), "ERR bad frame '%s'\n", arg);
+        } else {
+            R.frame = f + 1;
+            send_message(GOTO, R.frame - 1);
+            snprintf(c->reply, sizeof(c->reply), "OK %u\n", f);
+        }
+    } else if (!strcmp(cmd, "next") || !strcmp(cmd, "prev")) {
+        f = R.frame;
+        /* the playlist ran out of clips that open, as from a key */
+        if (handle_key(cmd[0] == 'n' ? SDLK_RIGHT : SDLK_LEFT)) {
+            __atomic_store_n(&R.quit, 1, __ATOMIC_RELEASE);
+            snprintf(c->reply, sizeof(c->reply), "ERR no clip left, quitting\n");
+        } else if (f == R.frame) {
+            snprintf(c->reply, sizeof(c->reply), "ERR no %s frame\n", cmd);
+        } else {
+            snprintf(c->reply, sizeof(c->reply), "OK %u\n", R.frame - 1);
+        }
+    } else if (!strcmp(cmd, "frame")) {
+        snprintf(c->reply, sizeof(c->reply), "OK %u %u\n", R.frame - 1, P.num_frames);
+    } else if (!strcmp(cmd, "zoom")) {
+        double scale = atof(arg);
+
+        if (!strcmp(arg, "fit")) {
+            if (handle_key(SDLK_w)) {
+                __atomic_store_n(&R.quit, 1, __ATOMIC_RELEASE);
+                snprintf(c->reply, sizeof(c->reply), "ERR quitting\n");
+                goto control_done;
+            }
+        } else if (scale > 0) {
+            P.scale = scale;
+            resize();
+        } else {
+            snprintf(c->reply, sizeof(c->reply), "ERR bad zoom '%s'\n", arg);
+            goto control_done;
+        }
+        snprintf(c->reply, sizeof(c->reply), "OK %ux%u\n", P.zoom_width, P.zoom_height);
+    } else if (!strcmp(cmd, "plane")) {
+        if (strcmp(arg, "all") && strcmp(arg, "y") && strcmp(arg, "cb") && strcmp(arg, "cr")) {
+            snprintf(c->reply, sizeof(c->reply), "ERR bad plane '%s'\n", arg);
+            goto control_done;
+        }
+        P.y_only = !strcmp(arg, "y") ? ~0u : 0;
+        P.cb_only = !strcmp(arg, "cb") ? ~0u : 0;
+        P.cr_only = !strcmp(arg, "cr") ? ~0u : 0;
+        draw_frame();
+        snprintf(c->reply, sizeof(c->reply), "OK %s\n", arg);
+    } else if (!strcmp(cmd, "psnr")) {
+        double psnr;
+
+        if (!P.diff && !P.temporal) {
+            snprintf(c->reply, sizeof(c->reply), "ERR needs diff or temporal mode\n");
+            goto control_done;
+        }
+        psnr = luma_psnr(P.y_ref, P.y_cmp);
+        snprintf(c->reply, sizeof(c->reply), isinf(psnr) ? "OK inf\n" : "OK %.4f\n", psnr);
+    } else if (!strcmp(cmd, "hist")) {
+        Uint32 counts[1024];
+        Uint32 pos;
+        /* 10 bpp samples as read, unless a diff is shown */
+        Uint32 native = P.depth > 8 && !P.diff && !P.temporal;
+        Uint32 bins = native ? 1u << P.depth : 256;
+        Uint8* y = native ? P.y_in : P.y_data;
+        Uint8* cb = native ? (cr_first ? P.cr_in : P.cb_in) : (cr_first ? P.cr_data : P.cb_data);
+        Uint8* cr = native ? (cr_first ? P.cb_in : P.cr_in) : (cr_first ? P.cb_data : P.cr_data);
+        Uint8* data = NULL;
+        Uint32 size = 0;
+
+        if (!strcmp(arg, "y")) {
+            data = y;
+            size = P.y_size;
+        } else if (!strcmp(arg, "cb")) {
+            data = cb;
+            size = P.cb_size;
+        } else if (!strcmp(arg, "cr")) {
+            data = cr;
+            size = P.cr_size;
+        } else {
+            snprintf(c->reply, sizeof(c->reply), "ERR bad plane '%s'\n", arg);
+            goto control_done;
+        }
+        if (native) {
+            plane_histogram16((Uint16*)data, size, counts);
+        } else {
+            plane_histogram(data, size, counts);
+        }
+        pos = snprintf(c->reply, sizeof(c->reply), "OK");
+        for (Uint32 i = 0; i < bins; i++) {
+            pos += snprintf(c->reply + pos, sizeof(c->reply) - pos, " %u", counts[i]);
+        }
+        snprintf(c->reply + pos, sizeof(c->reply) - pos, "\n");
+    } else if (!strcmp(cmd, "grab")) {
+        /* displayed 8 bit planes, Y then Cb then Cr */
+        display_planes();
+        c->size = P.y_size + P.cb_size + P.cr_size;
+        c->data = malloc(c->size);
+        if (!c->data) {
+            snprintf(c->reply, sizeof(c->reply), "ERR out of memory\n");
+            goto control_done;
+        }
+        memcpy(c->data, P.y_data, P.y_size);
+        memcpy(c->data + P.y_size, cr_first ? P.cr_data : P.cb_data, P.cb_size);
+        memcpy(c->data + P.y_size + P.cb_size, cr_first ? P.cb_data : P.cr_data, P.cr_size);
+        snprintf(c->reply, sizeof(c->reply), "OK %u\n", c->size);
+    } else if (!strcmp(cmd, "display")) {
+        P.no_display = !strcmp(arg, "off");
+        if (!P.no_display && R.frame) {
+            draw_frame();
+        }
+        snprintf(c->reply, sizeof(c->reply), "OK %s\n", P.no_display ? "off" : "on");
+    } else if (!strcmp(cmd, "quit")) {
+        send_message(QUIT, R.frame - 1);
+        __atomic_store_n(&R.quit, 1, __ATOMIC_RELEASE);
+        snprintf(c->reply, sizeof(c->reply), "OK\n");
+    } else {
+        snprintf(c->reply, sizeof(c->reply), "ERR unknown command '%s'\n", cmd);
     }
 
-    P.buf.mtext[0] = cmd;
-    P.buf.mtext[1] = '\0';
+control_done:
+    SDL_SemPost(c->done);
+}
 
-    if (msgsnd(P.msqid, &P.buf, 2, 0) == -1) {
-        perror("msgsnd");
+/* --record and --replay: open the files, before the window opens */
+Uint32 session_open(void)
+{
+    if (SES.record_file) {
+        SES.record = fopen(SES.record_file, "w");
+        if (!SES.record) {
+            fprintf(stderr, "Error opening %s\n", SES.record_file);
+            return 0;
+        }
+        fprintf(SES.record, "# yv session %s %ux%u\n", P.filename, P.width, P.height);
+    }
+    if (SES.replay_file) {
+        SES.replay = fopen(SES.replay_file, "r");
+        if (!SES.replay) {
+            fprintf(stderr, "Error opening %s\n", SES.replay_file);
+            return 0;
+        }
+    }
+    SES.handled = SDL_CreateSemaphore(0);
+    if (!SES.handled) {
+        fprintf(stderr, "Couldn't create semaphore: %s\n", SDL_GetError());
         return 0;
     }
-
     return 1;
 }
 
-Uint32 read_message(void)
+void session_close(void)
 {
-    if (msgrcv(P.msqid, &P.buf, sizeof(P.buf.mtext), 0, 0) == -1) {
-        perror("msgrcv");
-        P.mode = NONE;
-        return 0;
+    if (SES.record && fclose(SES.record)) {
+        perror("fclose");
+    }
+    if (SES.replay) {
+        fclose(SES.replay);
     }
+    if (SES.handled) {
+        SDL_DestroySemaphore(SES.handled);
+    }
+    free(SES.inputs);
+}
 
-    return 1;
+/* UI thread: one input line, seconds since the event loop started */
+void record_input(Uint32 type, Sint32 a, Sint32 b)
+{
+    if (!SES.record || !SES.started) {
+        return;
+    }
+    if (type == CMD_KEY) {
+        fprintf(SES.record, "%.6f key %d\n", now() - SES.start, a);
+    } else if (type == CMD_CLICK) {
+        fprintf(SES.record, "%.6f click %d %d\n", now() - SES.start, a, b);
+    } else {
+        fprintf(SES.record, "%.6f region %d %d %d %d\n", now() - SES.start,
+                a >> 16, a & 0xFFFF, b >> 16, b & 0xFFFF);
+    }
 }
 
-void destroy_message_queue(void)
+/* render thread: SES.taken is done, the next input may run */
+void input_handled(void)
 {
-    if (P.mode == MASTER) {
-        if (msgctl(P.msqid, IPC_RMID, NULL) == -1) {
-            perror("msgctl");
+    double done = now();
+
+    /* only the replay waits for the first frame */
+    if (!SES.first_done) {
+        SES.first_done = 1;
+        SDL_SemPost(SES.handled);
+        return;
+    }
+    if (SES.count == SES.size) {
+        Uint32 size = SES.size ? SES.size * 2 : 1024;
+        struct session_input* in = realloc(SES.inputs, sizeof(struct session_input) * size);
+
+        if (!in) {
+            fprintf(stderr, "Error allocating memory...\n");
+            SDL_SemPost(SES.handled);
+            return;
         }
-        printf("queue destroyed\n");
+        SES.inputs = in;
+        SES.size = size;
     }
+    SES.inputs[SES.count].at = SES.taken.t - SES.start;
+    SES.inputs[SES.count].latency = done - SES.taken.t;
+    SES.inputs[SES.count].type = SES.taken.type;
+    SES.inputs[SES.count].a = SES.taken.a;
+    SES.inputs[SES.count].b = SES.taken.b;
+    SES.count++;
+    SDL_SemPost(SES.handled);
 }
 
-Uint32 event_dispatcher(void)
+/* replay thread: 0 when the viewer quit first */
+Uint32 wait_handled(void)
 {
-    if (read_message()) {
+    while (SDL_SemWaitTimeout(SES.handled, 100) == SDL_MUTEX_TIMEDOUT) {
+        if (__atomic_load_n(&R.quit, __ATOMIC_ACQUIRE)) {
+            return 0;
+        }
+    }
+    return 1;
+}
 
-        switch (P.buf.mtext[0])
-        {
-            case NEXT:
-                event.type = SDL_KEYDOWN;
-                event.key.keysym.sym = SDLK_RIGHT;
-                SDL_PushEvent(&event);
-                break;
+/* Feeds the recorded inputs to the UI thread as SDL events, at their
+ * recorded time or, with --replay-fast, each one as soon as the one
+ * before is handled. Ends the session after the last one. */
+int replay_thread(void* data)
+{
+    char line[128];
+    /* the first frame, main() asks for it */
+    Uint32 pending = 1;
 
-            case PREV:
-                event.type = SDL_KEYDOWN;
-                event.key.keysym.sym = SDLK_LEFT;
-                SDL_PushEvent(&event);
-                break;
+    (void)data;
 
-            case REW:
-                event.type = SDL_KEYDOWN;
-                event.key.keysym.sym = SDLK_r;
-                SDL_PushEvent(&event);
-                break;
+    while (fgets(line, sizeof(line), SES.replay)) {
+        SDL_Event ev;
+        SDL_Event up;
+        char what[8];
+        double at;
+        int a, b = 0, c = 0, d = 0;
 
-            case ZOOM_IN:
-                event.type = SDL_KEYDOWN;
-                event.key.keysym.sym = SDLK_UP;
-                SDL_PushEvent(&event);
-                break;
+        if (line[0] == '#' || sscanf(line, "%lf %7s %d %d %d %d", &at, what, &a, &b, &c, &d) < 3) {
+            continue;
+        }
+        memset(&ev, 0, sizeof(ev));
+        memset(&up, 0, sizeof(up));
+        if (!strcmp(what, "key")) {
+            ev.type = SDL_KEYDOWN;
+            ev.key.keysym.sym = a;
+        } else if (!strcmp(what, "click") || !strcmp(what, "region")) {
+            /* a click is a press and release in place */
+            if (strcmp(what, "region")) {
+                c = a;
+                d = b;
+            }
+            ev.type = SDL_MOUSEBUTTONDOWN;
+            ev.button.button = SDL_BUTTON_LEFT;
+            ev.button.x = a;
+            ev.button.y = b;
+            up.type = SDL_MOUSEBUTTONUP;
+            up.button.button = SDL_BUTTON_LEFT;
+            up.button.x = c;
+            up.button.y = d;
+        } else {
+            continue;
+        }
 
-            case ZOOM_OUT:
-                event.type = SDL_KEYDOWN;
-                event.key.keysym.sym = SDLK_DOWN;
-                SDL_PushEvent(&event);
-                break;
+        if (SES.fast) {
+            for (; pending; pending--) {
+                if (!wait_handled()) {
+                    return 0;
+                }
+            }
+        } else {
+            double wait;
 
-            case QUIT:
-                event.type = SDL_KEYDOWN;
-                event.key.keysym.sym = SDLK_q;
-                SDL_PushEvent(&event);
-                break;
+            while ((wait = SES.start + at - now()) > 0) {
+                if (__atomic_load_n(&R.quit, __ATOMIC_ACQUIRE)) {
+                    return 0;
+                }
+                SDL_Delay(wait > 0.1 ? 100 : wait * 1000 + 1);
+            }
+        }
+        SDL_PushEvent(&ev);
+        if (up.type) {
+            SDL_PushEvent(&up);
+        }
+        pending++;
+    }
 
-            case Y_ONLY:
-                event.type = SDL_KEYDOWN;
-                event.key.keysym.sym = SDLK_F5;
-                SDL_PushEvent(&event);
-                break;
+    for (; pending; pending--) {
+        if (!wait_handled()) {
+            return 0;
+        }
+    }
+    if (!__atomic_load_n(&R.quit, __ATOMIC_ACQUIRE)) {
+        SDL_Event ev;
 
-            case CB_ONLY:
-                event.type = SDL_KEYDOWN;
-                event.key.keysym.sym = SDLK_F6;
-                SDL_PushEvent(&event);
-                break;
+        ev.type = SDL_QUIT;
+        SDL_PushEvent(&ev);
+    }
+    return 0;
+}
 
-            case CR_ONLY:
-                event.type = SDL_KEYDOWN;
-                event.key.keysym.sym = SDLK_F7;
-                SDL_PushEvent(&event);
-                break;
+/* the same key, clicks and drags are one kind of input each wherever
+ * they are */
+Uint32 same_input(const struct session_input* x, const struct session_input* y)
+{
+    return x->type == y->type && (x->type != CMD_KEY || x->a == y->a);
+}
 
-            case ALL_PLANES:
-                event.type = SDL_KEYDOWN;
-                event.key.keysym.sym = SDLK_F8;
-                SDL_PushEvent(&event);
-                break;
+/* by kind of input, then by latency */
+int compare_inputs(const void* a, const void* b)
+{
+    const struct session_input* x = a;
+    const struct session_input* y = b;
 
-            default:
-                fprintf(stderr, "~TILT\n");
-                return 0;
+    if (!same_input(x, y)) {
+        if (x->type != y->type) {
+            return x->type < y->type ? -1 : 1;
         }
+        return x->a < y->a ? -1 : 1;
     }
-    return 1;
+    return x->latency < y->latency ? -1 : x->latency > y->latency;
 }
 
-void set_caption(char *array, Uint32 frame, Uint32 bytes)
+/* latency per kind of input on stdout, every input with --latency */
+void session_report(double seconds)
 {
-    snprintf(array, bytes, "%s - %s%s%s%s%s%s%s%s frame %d, size %dx%d",
-            P.filename,
-            (P.mode == MASTER) ? "[MASTER]" :
-            (P.mode == SLAVE) ? "[SLAVE]": "",
-            P.grid ? "G" : "",
-            P.mb ? "M" : "",
-            P.diff ? "D" : "",
-            P.hist ? "H" : "",
-            P.y_only ? "Y" : "",
-            P.cb_only ? "Cb" : "",
-            P.cr_only ? "Cr" : "",
-            frame,
-            P.zoom_width,
-            P.zoom_height);
+    struct session_input* sorted;
+
+    if (SES.latency_file) {
+        FILE* fp = fopen(SES.latency_file, "w");
+
+        if (!fp) {
+            fprintf(stderr, "Error opening %s\n", SES.latency_file);
+        } else {
+            fprintf(fp, "input,at,type,a,b,latency_ms\n");
+            for (Uint32 i = 0; i < SES.count; i++) {
+                struct session_input* in = &SES.inputs[i];
+
+                fprintf(fp, "%u,%.6f,%s,%d,%d,%.3f\n", i, in->at,
+                        input_names[in->type], in->a, in->b, in->latency * 1000);
+            }
+            if (fclose(fp)) {
+                perror("fclose");
+            }
+        }
+    }
+
+    fprintf(stdout, "%u inputs in %.2f s, %u frames drawn (%.1f fps), %u dropped\n",
+            SES.count, seconds, SES.drawn, SES.drawn / seconds, SES.dropped);
+    if (!SES.count) {
+        return;
+    }
+
+    sorted = malloc(sizeof(struct session_input) * SES.count);
+    if (!sorted) {
+        fprintf(stderr, "Error allocating memory...\n");
+        return;
+    }
+    memcpy(sorted, SES.inputs, sizeof(struct session_input) * SES.count);
+    qsort(sorted, SES.count, sizeof(struct session_input), compare_inputs);
+
+    fprintf(stdout, "%-12s %6s %9s %9s %9s %9s\n", "input", "count", "mean ms",
+            "p50 ms", "p95 ms", "max ms");
+    for (Uint32 i = 0, n; i < SES.count; i += n) {
+        struct session_input* in = &sorted[i];
+        char name[13];
+        double sum = 0;
+
+        for (n = 0; i + n < SES.count && same_input(in, &sorted[i + n]); n++) {
+            sum += sorted[i + n].latency;
+        }
+        snprintf(name, sizeof(name), "%s",
+                 in->type == CMD_KEY ? SDL_GetKeyName(in->a) : input_names[in->type]);
+        fprintf(stdout, "%-12s %6u %9.3f %9.3f %9.3f %9.3f\n", name, n,
+                sum / n * 1000, in[n / 2].latency * 1000,
+                in[(n * 95 - 1) / 100].latency * 1000, in[n - 1].latency * 1000);
+    }
+    free(sorted);
 }
 
-void set_zoom_rect(void)
+/* SLAVE-mode, turns messages from the master into SDL events */
+int slave_thread(void* data)
 {
-    if (P.zoom > 0) {
-        P.zoom_width = P.width * P.zoom;
-        P.zoom_height = P.height * P.zoom;
-    } else if (P.zoom <= 0) {
-        P.zoom_width = P.width / (abs(P.zoom) + 2);
-        P.zoom_height = P.height / (abs(P.zoom) + 2);
-    } else {
-        fprintf(stderr, "ERROR in zoom:\n");
+    (void)data;
+
+    while (__atomic_load_n(&P.mode, __ATOMIC_ACQUIRE) == SLAVE &&
+           !__atomic_load_n(&R.quit, __ATOMIC_ACQUIRE)) {
+        if (!event_dispatcher()) {
+            SDL_Delay(1);
+        }
     }
+    return 0;
 }
 
-/* loop inspired by yay
- * http://freecode.com/projects/yay
- */
+/* render thread, after P.mode has left SLAVE */
+void stop_slave(void)
+{
+    if (R.slave) {
+        SDL_WaitThread(R.slave, NULL);
+        R.slave = NULL;
+    }
+}
+
+/* UI thread: forwards input to the render thread and puts finished
+ * frames on screen, so it never waits for reading or conversion */
 Uint32 event_loop(void)
 {
+    SDL_Overlay* front = NULL;
     char caption[256];
     Uint16 quit = 0;
-    Uint32 frame = 0;
-    int play_yuv = 0;
-    unsigned int start_ticks = 0;
+    Sint32 down_x = -1;       /* left button pressed here */
+    Sint32 down_y = -1;
+
+    R.wake = SDL_CreateSemaphore(0);
+    R.back_free = SDL_CreateSemaphore(1);
+    R.resized = SDL_CreateSemaphore(0);
+    R.lock = SDL_CreateMutex();
+    R.thread = start_thread(render_thread, "render", NULL);
+    if (!R.wake || !R.back_free || !R.resized || !R.lock || !R.thread) {
+        fprintf(stderr, "Couldn't start render thread: %s\n", SDL_GetError());
+        return 0;
+    }
+    if (P.control_path) {
+        R.control_thread = start_thread(control_thread, "control", NULL);
+    }
+    SES.start = now();
+    if (SES.replay) {
+        SES.thread = start_thread(replay_thread, "replay", NULL);
+    }
 
     while (!quit) {
 
-        set_caption(caption, frame, 256);
-        SDL_WM_SetCaption(caption, NULL);
-
-        /* wait for SDL event */
-        if (P.mode == NONE || P.mode == MASTER) {
-            SDL_WaitEvent(&event);
-        } else if (P.mode == SLAVE) {
-            if (!event_dispatcher()) {
-                SDL_WaitEvent(&event);
-            }
-        }
+        SDL_WaitEvent(&event);
 
         switch (event.type)
         {
             case SDL_KEYDOWN:
-                switch (event.key.keysym.sym)
+                record_input(CMD_KEY, event.key.keysym.sym, 0);
+                SES.started = 1;
+                if (!push_command(CMD_KEY, event.key.keysym.sym, 0) && SES.on) {
+                    SES.dropped++;
+                    SDL_SemPost(SES.handled);
+                }
+                break;
+            case SDL_QUIT:
+                /* stops play() too, which only looks at commands */
+                push_command(CMD_QUIT, 0, 0);
+                quit = 1;
+                break;
+#ifdef USE_SDL2
+            case SDL_WINDOWEVENT:
+                /* exposed or resized by the user, the renderer scales
+                 * to the window */
+                if (front) {
+                    present_overlay(front, 0);
+                }
+                break;
+#else
+            case SDL_VIDEOEXPOSE:
+                if (front) {
+                    present_overlay(front, 0);
+                }
+                break;
+#endif
+            case SDL_MOUSEBUTTONDOWN:
+                /* left button: a click or a drag, told apart on release */
+                if (event.button.button == SDL_BUTTON_LEFT ) {
+                    down_x = event.button.x;
+                    down_y = event.button.y;
+                }
+                break;
+            case SDL_MOUSEBUTTONUP:
+                if (event.button.button == SDL_BUTTON_LEFT && down_x >= 0) {
+                    Uint32 type = CMD_CLICK;
+                    Sint32 a = down_x;
+                    Sint32 b = down_y;
+                    /* SDL2 reports a release outside the window */
+                    Sint32 up_x = event.button.x;
+                    Sint32 up_y = event.button.y;
+
+                    up_x = up_x < 0 ? 0 : up_x;
+                    up_y = up_y < 0 ? 0 : up_y;
+                    /* dragged rather than clicked: statistics of the region */
+                    if (abs(up_x - down_x) + abs(up_y - down_y) > 2) {
+                        type = CMD_REGION;
+                        a = down_x << 16 | down_y;
+                        b = up_x << 16 | up_y;
+                    }
+                    record_input(type, a, b);
+                    if (!push_command(type, a, b) && SES.on) {
+                        SES.dropped++;
+                        SDL_SemPost(SES.handled);
+                    }
+                }
+                down_x = -1;
+                break;
+            case SDL_USEREVENT:
+                switch (event.user.code)
                 {
-                    case SDLK_SPACE:
-                        play_yuv = 1; /* play it, sam! */
-                        while (play_yuv) {
-                            start_ticks = SDL_GetTicks();
-                            set_caption(caption, frame, 256);
-                            SDL_WM_SetCaption( caption, NULL );
-
-                            /* check for next frame existing */
-                            if (read_frame()) {
-                                draw_frame();
-                                /* insert delay for real time viewing */
-                                if (SDL_GetTicks() - start_ticks < 40)
-                                    SDL_Delay(40 - (SDL_GetTicks() - start_ticks));
-                                frame++;
-                                send_message(NEXT);
-                            } else {
-                                play_yuv = 0;
-                            }
-                            /* check for any key event */
-                            if (SDL_PollEvent(&event)) {
-                                if (event.type == SDL_KEYDOWN) {
-                                    /* stop playing */
-                                    play_yuv = 0;
-                                }
-                            }
-                        }
-                        break;
-                    case SDLK_RIGHT: /* next frame */
-                        /* check for next frame existing */
-                        if (read_frame()) {
-                            draw_frame();
-                            frame++;
-                            send_message(NEXT);
-                        }
-                        break;
-                    case SDLK_LEFT: /* previous frame */
-                        if (frame > 1) {
-                            frame--;
-                            fseek(fd, ((frame-1) * P.frame_size), SEEK_SET);
-                            if (P.diff) {
-                                fseek(P.fd2, ((frame-1) * P.frame_size), SEEK_SET);
-                            }
-                            read_frame();
-                            draw_frame();
-                            send_message(PREV);
-                        }
-                        break;
-                    case SDLK_UP: /* zoom in */
-                        P.zoom++;
-                        set_zoom_rect();
-                        screen = SDL_SetVideoMode(P.zoom_width,
-                                                  P.zoom_height,
-                                                  P.bpp, P.vflags);
-                        video_rect.w = P.zoom_width;
-                        video_rect.h = P.zoom_height;
-                        SDL_DisplayYUVOverlay(my_overlay, &video_rect);
-                        send_message(ZOOM_IN);
-                        break;
-                    case SDLK_DOWN: /* zoom out */
-                        P.zoom--;
-                        set_zoom_rect();
-                        screen = SDL_SetVideoMode(P.zoom_width,
-                                                  P.zoom_height,
-                                                  P.bpp, P.vflags);
-                        video_rect.w = P.zoom_width;
-                        video_rect.h = P.zoom_height;
-                        SDL_DisplayYUVOverlay(my_overlay, &video_rect);
-                        send_message(ZOOM_OUT);
-                        break;
-                    case SDLK_r: /* rewind */
-                        if (frame > 1) {
-                            frame = 1;
-                            fseek(fd, 0, SEEK_SET);
-                            if (P.diff) {
-                                fseek(P.fd2, 0, SEEK_SET);
-                            }
-                            read_frame();
-                            draw_frame();
-                            send_message(REW);
-                        }
-                        break;
-                    case SDLK_g: /* display grid */
-                        P.grid = ~P.grid;
-                        if (P.zoom < 1)
-                            P.grid = 0;
-                        draw_frame();
-                        break;
-                    case SDLK_m: /* show mb-data on stdout */
-                        P.mb = ~P.mb;
-                        if (P.zoom < 1)
-                            P.mb = 0;
-                        draw_frame();
-                        break;
-                    case SDLK_F5: /* Luma data only */
-                        P.y_only = ~P.y_only;
-                        P.cb_only = 0;
-                        P.cr_only = 0;
-                        draw_frame();
-                        send_message(Y_ONLY);
-                        break;
-                    case SDLK_F6: /* Cb data only */
-                        P.cb_only = ~P.cb_only;
-                        P.y_only = 0;
-                        P.cr_only = 0;
-                        draw_frame();
-                        send_message(CB_ONLY);
-                        break;
-                    case SDLK_F7: /* Cr data only */
-                        P.cr_only = ~P.cr_only;
-                        P.y_only = 0;
-                        P.cb_only = 0;
-                        send_message(CR_ONLY);
-                        draw_frame();
-                        break;
-                    case SDLK_F8: /* display all color planes */
-                        P.y_only = 0;
-                        P.cb_only = 0;
-                        P.cr_only = 0;
-                        draw_frame();
-                        send_message(ALL_PLANES);
+                    case EV_GOTO:
+                        push_command(CMD_GOTO, (intptr_t)event.user.data1, 0);
                         break;
-                    case SDLK_h: /* histogram */
-                        P.hist = ~P.hist;
-                        draw_frame();
-                        break;
-                    case SDLK_F1: /* MASTER-mode */
-                        if (create_message_queue()) {
-                            P.mode = MASTER;
+                    case EV_PRESENT:
+                        front = event.user.data1;
+                        present_overlay(front, 1);
+                        if (P.probed == 1) {
+                            fprintf(stdout, "First frame after %.1f ms\n",
+                                    (now() - P.start) * 1000);
+                            P.probed = 2;
                         }
+                        /* the old front overlay may be drawn again */
+                        SDL_SemPost(R.back_free);
                         break;
-                    case SDLK_F2: /* SLAVE-mode */
-                        if (P.mode == MASTER) {
-                            destroy_message_queue();
+                    case EV_RESIZE:
+                        video_rect.w = (intptr_t)event.user.data1;
+                        video_rect.h = (intptr_t)event.user.data2;
+                        video_mode(video_rect.w, video_rect.h);
+                        if (P.scaler != SCALE_SDL) {
+                            /* scaled by us, overlays have window size */
+                            create_overlays(video_rect.w, video_rect.h);
+                            front = NULL;
+                        } else if ((Uint32)R.overlay[0]->w != P.width ||
+                                   (Uint32)R.overlay[0]->h != P.height ||
+                                   R.overlay[0]->format != P.overlay_format) {
+                            create_overlays(P.width, P.height);
+                            front = NULL;
                         }
-                        if (connect_message_queue()) {
-                            P.mode = SLAVE;
+                        if (front) {
+                            present_overlay(front, 0);
                         }
+                        SDL_SemPost(R.resized);
                         break;
-                    case SDLK_F3: /* NONE-mode */
-                        destroy_message_queue();
-                        P.mode = NONE;
-                        break;
-                    case SDLK_q: /* quit */
-                        quit = 1;
-                        send_message(QUIT);
+                    case EV_CAPTION:
+                        SDL_LockMutex(R.lock);
+                        strcpy(caption, R.caption);
+                        SDL_UnlockMutex(R.lock);
+                        video_caption(caption);
                         break;
                     default:
                         break;
-                } /* switch key */
-                break;
-            case SDL_QUIT:
-                quit = 1;
-                break;
-            case SDL_VIDEOEXPOSE:
-                SDL_DisplayYUVOverlay(my_overlay, &video_rect);
-                break;
-            case SDL_MOUSEBUTTONDOWN:
-                /* If the left mouse button was pressed */
-                if (event.button.button == SDL_BUTTON_LEFT ) {
-                    show_mb(event.button.x, event.button.y);
                 }
                 break;
 
@@ -1058,23 +9257,483 @@ Uint32 event_loop(void)
 
     } /* while */
 
+    /* wake the render thread wherever it is waiting */
+    __atomic_store_n(&R.quit, 1, __ATOMIC_RELEASE);
+    SDL_SemPost(R.wake);
+    SDL_SemPost(R.back_free);
+    SDL_WaitThread(R.thread, NULL);
+    if (R.control_thread) {
+        SDL_WaitThread(R.control_thread, NULL);
+    }
+    if (SES.thread) {
+        SDL_WaitThread(SES.thread, NULL);
+    }
+    if (SES.on) {
+        session_report(now() - SES.start);
+    }
+
+    SDL_DestroySemaphore(R.wake);
+    SDL_DestroySemaphore(R.back_free);
+    SDL_DestroySemaphore(R.resized);
+    SDL_DestroyMutex(R.lock);
+
     return quit;
 }
 
+/* playlist: "filename [width height format]" per line, # comments */
+Uint32 read_playlist(char* name)
+{
+    char text[4096];
+    Uint32 line = 0;
+    Uint32 size = 0;
+    FILE* fp = fopen(name, "r");
+
+    if (!fp) {
+        fprintf(stderr, "Error opening %s\n", name);
+        return 0;
+    }
+
+    while (fgets(text, sizeof(text), fp)) {
+        struct playlist_entry* clip;
+        char* field[5];
+        char* save;
+        Uint32 n = 0;
+
+        line++;
+        for (char* s = strtok_r(text, " \t\r\n", &save); s && n < 5;
+             s = strtok_r(NULL, " \t\r\n", &save)) {
+            field[n++] = s;
+        }
+        if (!n || field[0][0] == '#') {
+            continue;
+        }
+        if (n != 1 && n != 4) {
+            fprintf(stderr, "%s:%u: expected filename [width height format]\n",
+                    name, line);
+            fclose(fp);
+            return 0;
+        }
+        if (access(field[0], R_OK)) {
+            fprintf(stderr, "%s:%u: Error opening %s\n", name, line, field[0]);
+            fclose(fp);
+            return 0;
+        }
+
+        if (LIST.count == size) {
+            size = size ? size * 2 : 64;
+            clip = realloc(LIST.clips, sizeof(*clip) * size);
+            if (!clip) {
+                fprintf(stderr, "Error allocating memory...\n");
+                fclose(fp);
+                return 0;
+            }
+            LIST.clips = clip;
+        }
+        clip = &LIST.clips[LIST.count];
+        memset(clip, 0, sizeof(*clip));
+        if (n == 4) {
+            clip->width = atoi(field[1]);
+            clip->height = atoi(field[2]);
+            if (!clip->width || !clip->height || clip->width % 2 || clip->height % 2) {
+                fprintf(stderr, "%s:%u: bad size %sx%s\n", name, line, field[1], field[2]);
+                fclose(fp);
+                return 0;
+            }
+            if (!parse_format(field[3], &clip->format)) {
+                fprintf(stderr, "%s:%u: bad format\n", name, line);
+                fclose(fp);
+                return 0;
+            }
+        }
+        clip->name = strdup(field[0]);
+        if (!clip->name) {
+            fprintf(stderr, "Error allocating memory...\n");
+            fclose(fp);
+            return 0;
+        }
+        LIST.count++;
+    }
+    fclose(fp);
+
+    if (!LIST.count) {
+        fprintf(stderr, "%s: no clips\n", name);
+        return 0;
+    }
+    return 1;
+}
+
+/* prefetch thread: what clip_geometry() finds for a clip that is not a
+ * .yvz file, into LIST and without touching the clip on screen. A Y4M
+ * clip is indexed too. */
+Uint32 clip_probe(struct playlist_entry* clip)
+{
+    LIST.frame_ms = 0;
+    if (!y4m_parse(clip->name, &LIST.index.header, &LIST.width, &LIST.height,
+                   &LIST.format, &LIST.frame_ms)) {
+        return 0;
+    }
+    if (LIST.index.header) {
+        return index_frames(&LIST.index, clip->name,
+                            format_frame_size(LIST.format, LIST.width, LIST.height));
+    }
+    if (clip->width) {
+        LIST.width = clip->width;
+        LIST.height = clip->height;
+        LIST.format = clip->format;
+        return 1;
+    }
+    return probe_geometry(clip->name, &LIST.width, &LIST.height, &LIST.format, 1);
+}
+
+/* size and format of a playlist clip: as listed, from a Y4M or .yvz
+ * header, or guessed. Y4M and .yvz headers win as on the command line. */
+Uint32 clip_geometry(struct playlist_entry* clip)
+{
+    if (!y4m_header(0, clip->name) || !pack_header(clip->name)) {
+        return 0;
+    }
+    if (PAK.packed || P.index[0].header) {
+        return 1;
+    }
+    if (clip->width) {
+        P.width = clip->width;
+        P.height = clip->height;
+        FORMAT = clip->format;
+    } else if (!probe_geometry(clip->name, &P.width, &P.height, &FORMAT, 1)) {
+        return 0;
+    }
+    set_overlay_format();
+    return 1;
+}
+
 Uint32 parse_input(int argc, char **argv)
 {
-    if (argc != 5 && argc != 6) {
-        usage(argv[0]);
+    int opt;
+    char* name = argv[0];
+    const struct option options[] = {
+        {"aio", optional_argument, NULL, 'a'},
+        {"scale", required_argument, NULL, 's'},
+        {"zoom", required_argument, NULL, 'z'},
+        {"fit", no_argument, NULL, 'F'},
+        {"bits", required_argument, NULL, 'V'},
+        {"scope", required_argument, NULL, 'W'},
+        {"temporal", no_argument, NULL, 't'},
+        {"preload", optional_argument, NULL, 'P'},
+        {"control", required_argument, NULL, 'c'},
+        {"threads", required_argument, NULL, 'j'},
+        {"export", required_argument, NULL, 'e'},
+        {"matrix", required_argument, NULL, 'X'},
+        {"full-range", no_argument, NULL, 'U'},
+        {"output", required_argument, NULL, 'o'},
+        {"to", required_argument, NULL, 'T'},
+        {"crop", required_argument, NULL, 'C'},
+        {"blank", required_argument, NULL, 'B'},
+        {"stats", required_argument, NULL, 'S'},
+        {"pack", required_argument, NULL, 'Z'},
+        {"codec", required_argument, NULL, 'G'},
+        {"pack-planes", no_argument, NULL, 'Q'},
+        {"record", required_argument, NULL, 'r'},
+        {"replay", required_argument, NULL, 'y'},
+        {"replay-fast", required_argument, NULL, 'Y'},
+        {"latency", required_argument, NULL, 'L'},
+        {"artifacts", required_argument, NULL, 'k'},
+        {"sat", no_argument, NULL, 'i'},
+        {"variance", required_argument, NULL, 'I'},
+        {"batch", required_argument, NULL, 'b'},
+        {"results", required_argument, NULL, 'O'},
+        {"readers", required_argument, NULL, 'D'},
+        {"playlist", required_argument, NULL, 'l'},
+        {"ctu", required_argument, NULL, 'K'},
+        {"frames", required_argument, NULL, 'f'},
+        {"extract", required_argument, NULL, 'x'},
+        {"mbs", required_argument, NULL, 'M'},
+        {"mb-rect", required_argument, NULL, 'R'},
+        {NULL, 0, NULL, 0}
+    };
+
+    while ((opt = getopt_long(argc, argv, "a::s:z:j:tc:e:o:f:x:", options, NULL)) != -1) {
+        switch (opt)
+        {
+            case 'a':
+                P.aio_depth = optarg ? atoi(optarg) : AIO_DEFAULT_DEPTH;
+                if (P.aio_depth < 1 || P.aio_depth > AIO_MAX_DEPTH) {
+                    fprintf(stderr, "aio depth must be 1..%d\n", AIO_MAX_DEPTH);
+                    return 0;
+                }
+                break;
+            case 's':
+                if (!strcmp(optarg, "sdl")) {
+                    P.scaler = SCALE_SDL;
+                } else if (!strcmp(optarg, "nearest")) {
+                    P.scaler = SCALE_NEAREST;
+                } else if (!strcmp(optarg, "bilinear")) {
+                    P.scaler = SCALE_BILINEAR;
+                } else if (!strcmp(optarg, "area")) {
+                    P.scaler = SCALE_AREA;
+                } else {
+                    fprintf(stderr, "The scaler '%s' is not recognized\n", optarg);
+                    return 0;
+                }
+                break;
+            case 'z':
+                P.scale = atof(optarg);
+                if (P.scale <= 0) {
+                    fprintf(stderr, "Bad zoom '%s'\n", optarg);
+                    return 0;
+                }
+                break;
+            case 'F':
+                P.fit = 1;
+                break;
+            case 'V':
+                if (!strcmp(optarg, "round")) {
+                    P.bits = BITS_ROUND;
+                } else if (!strcmp(optarg, "mid")) {
+                    P.bits = BITS_MID;
+                } else if (!strcmp(optarg, "low")) {
+                    P.bits = BITS_LOW;
+                } else if (!strcmp(optarg, "stretch")) {
+                    P.bits = BITS_STRETCH;
+                } else {
+                    fprintf(stderr, "The bits mode '%s' is not recognized\n", optarg);
+                    return 0;
+                }
+                break;
+            case 'W':
+                if (!strcmp(optarg, "waveform")) {
+                    P.scope = SCOPE_LUMA;
+                } else if (!strcmp(optarg, "parade")) {
+                    P.scope = SCOPE_PARADE;
+                } else if (!strcmp(optarg, "vector")) {
+                    P.scope = SCOPE_VECTOR;
+                } else {
+                    fprintf(stderr, "The scope '%s' is not recognized\n", optarg);
+                    return 0;
+                }
+                break;
+            case 't':
+                P.temporal = 1;
+                break;
+            case 'c':
+                P.control_path = optarg;
+                break;
+            case 'P':
+                P.preload_mb = optarg ? atoi(optarg) : PRELOAD_DEFAULT_MB;
+                if (P.preload_mb < 1) {
+                    fprintf(stderr, "Bad preload budget '%s'\n", optarg);
+                    return 0;
+                }
+                break;
+            case 'j':
+                P.threads = atoi(optarg);
+                if (P.threads < 1) {
+                    fprintf(stderr, "Bad thread count '%s'\n", optarg);
+                    return 0;
+                }
+                break;
+            case 'e':
+                P.export = optarg;
+                break;
+            case 'X':
+                if (!strcmp(optarg, "601")) {
+                    P.matrix = BT601;
+                } else if (!strcmp(optarg, "709")) {
+                    P.matrix = BT709;
+                } else if (!strcmp(optarg, "2020")) {
+                    P.matrix = BT2020;
+                } else {
+                    fprintf(stderr, "The matrix '%s' is not recognized\n", optarg);
+                    return 0;
+                }
+                break;
+            case 'U':
+                P.full_range = 1;
+                break;
+            case 'o':
+                P.output = optarg;
+                break;
+            case 'T':
+                if (!parse_format(optarg, &P.out_format)) {
+                    return 0;
+                }
+                P.out_format_set = 1;
+                break;
+            case 'C':
+                if (!parse_crop(optarg)) {
+                    return 0;
+                }
+                break;
+            case 'B':
+                if (!parse_blank(optarg)) {
+                    return 0;
+                }
+                break;
+            case 'Z':
+                P.pack = optarg;
+                break;
+            case 'G':
+                if (!strcmp(optarg, "lz4")) {
+                    P.codec = PACK_LZ4;
+                } else if (!strcmp(optarg, "zstd")) {
+#ifdef HAVE_ZSTD
+                    P.codec = PACK_ZSTD;
+#else
+                    fprintf(stderr, "Zstd needs a build with ZSTD=1\n");
+                    return 0;
+#endif
+                } else {
+                    fprintf(stderr, "Codec must be lz4 or zstd\n");
+                    return 0;
+                }
+                break;
+            case 'Q':
+                P.pack_chunks = 3;
+                break;
+            case 'r':
+                SES.record_file = optarg;
+                SES.on = 1;
+                break;
+            case 'y':
+            case 'Y':
+                SES.replay_file = optarg;
+                SES.fast = opt == 'Y';
+                SES.on = 1;
+                break;
+            case 'L':
+                SES.latency_file = optarg;
+                SES.on = 1;
+                break;
+            case 'k':
+                P.artifacts_file = optarg;
+                break;
+            case 'i':
+                P.sat = 1;
+                break;
+            case 'I':
+                P.variance_file = optarg;
+                break;
+            case 'b':
+                P.batch = optarg;
+                break;
+            case 'O':
+                P.results = optarg;
+                break;
+            case 'D':
+                P.readers = atoi(optarg);
+                if (P.readers < 1) {
+                    fprintf(stderr, "Readers per device must be at least 1\n");
+                    return 0;
+                }
+                break;
+            case 'l':
+                P.playlist = optarg;
+                break;
+            case 'K':
+                P.ctu = atoi(optarg);
+                if (P.ctu != 32 && P.ctu != 64 && P.ctu != 128) {
+                    fprintf(stderr, "CTU size must be 32, 64 or 128\n");
+                    return 0;
+                }
+                break;
+            case 'S':
+                P.stats_file = optarg;
+                break;
+            case 'f':
+                if (!parse_range(optarg)) {
+                    return 0;
+                }
+                break;
+            case 'x':
+                P.extract = optarg;
+                break;
+            case 'M':
+            case 'R':
+                if (!parse_mb_list(optarg, opt == 'R')) {
+                    return 0;
+                }
+                break;
+            default:
+                usage(name);
+                return 0;
+        }
+    }
+
+    /* positional arguments */
+    argc -= optind - 1;
+    argv += optind - 1;
+
+    /* the manifest names the clips */
+    if (P.batch) {
+        if (argc != 1) {
+            fprintf(stderr, "--batch takes no clip arguments\n");
+            return 0;
+        }
+        return 1;
+    }
+
+    /* the first clip of the playlist stands in for the input */
+    if (P.playlist) {
+        if (argc != 1) {
+            fprintf(stderr, "--playlist takes no clip arguments\n");
+            return 0;
+        }
+        if (P.extract || P.export || P.output || P.stats_file || P.artifacts_file || P.pack ||
+            P.variance_file) {
+            fprintf(stderr, "--playlist is for viewing, headless commands take one clip\n");
+            return 0;
+        }
+        P.frame_ms = FRAME_MS;
+        if (!read_playlist(P.playlist)) {
+            return 0;
+        }
+        P.filename = LIST.clips[0].name;
+        return clip_geometry(&LIST.clips[0]);
+    }
+
+    if (argc != 2 && argc != 3 && argc != 5 && argc != 6) {
+        usage(name);
         return 0;
     }
 
-    if (argc == 6) {
+    if (argc == 3 || argc == 6) {
         /* diff mode */
         P.diff = 1;
-        P.fname_diff = argv[5];
+        P.fname_diff = argv[argc - 1];
+        if (P.temporal) {
+            fprintf(stderr, "Temporal diff works on a single clip\n");
+            return 0;
+        }
     }
 
     P.filename = argv[1];
+    P.frame_ms = FRAME_MS;
+
+    /* a Y4M stream header wins over width, height and format */
+    if (!y4m_header(0, P.filename) || !pack_header(P.filename)) {
+        return 0;
+    }
+    if (PAK.packed) {
+        if (argc >= 5) {
+            fprintf(stderr, "%s: using size and format of the .yvz header\n", P.filename);
+        }
+        return !P.diff || y4m_header(1, P.fname_diff);
+    }
+    if (P.index[0].header) {
+        if (argc >= 5) {
+            fprintf(stderr, "%s: using size and format of the Y4M header\n", P.filename);
+        }
+        return !P.diff || y4m_header(1, P.fname_diff);
+    }
+    if (argc < 5) {
+        /* guess them, the probe reports what it took */
+        if (!probe_geometry(P.filename, &P.width, &P.height, &FORMAT, 1)) {
+            usage(name);
+            return 0;
+        }
+        set_overlay_format();
+        P.probed = 1;
+        return !P.diff || y4m_header(1, P.fname_diff);
+    }
 
     P.width = atoi(argv[2]);
     P.height = atoi(argv[3]);
@@ -1106,7 +9765,7 @@ Uint32 parse_input(int argc, char **argv)
         return 0;
     }
 
-    return 1;
+    return !P.diff || y4m_header(1, P.fname_diff);
 }
 
 Uint32 open_input(void)
@@ -1124,6 +9783,14 @@ Uint32 open_input(void)
             return 0;
         }
     }
+
+    if (PAK.packed) {
+        /* --aio reads raw frames, the decoder threads read ahead here */
+        return pack_open();
+    }
+    if (P.aio_depth && !aio_open()) {
+        return 0;
+    }
     return 1;
 }
 
@@ -1136,6 +9803,14 @@ Uint32 sdl_init(void)
         return 0;
     }
 
+#ifdef USE_SDL2
+    SDL_DisplayMode mode;
+
+    if (SDL_GetDesktopDisplayMode(0, &mode) == 0) {
+        P.screen_w = mode.w;
+        P.screen_h = mode.h;
+    }
+#else
     info = SDL_GetVideoInfo();
     if (!info) {
         fprintf(stderr, "SDL ERROR Video query failed: %s\n", SDL_GetError());
@@ -1144,24 +9819,43 @@ Uint32 sdl_init(void)
     }
 
     P.bpp = info->vfmt->BitsPerPixel;
+    P.screen_w = info->current_w;
+    P.screen_h = info->current_h;
+#endif
+
+    if (P.fit && P.screen_w && P.screen_h) {
+        P.scale = (double)P.screen_w / P.width;
+        if ((double)P.screen_h / P.height < P.scale)
+            P.scale = (double)P.screen_h / P.height;
+    }
+    set_zoom_rect();
 
+#ifndef USE_SDL2
     if (info->hw_available){
         P.vflags = SDL_HWSURFACE;
     } else {
         P.vflags = SDL_SWSURFACE;
     }
+#endif
 
-    if ((screen = SDL_SetVideoMode(P.width, P.height, P.bpp, P.vflags)) == 0) {
+    if (!video_mode(P.zoom_width, P.zoom_height)) {
         fprintf(stderr, "SDL ERROR Video mode set failed: %s\n", SDL_GetError());
         SDL_Quit();
         return 0;
     }
 
-    my_overlay = SDL_CreateYUVOverlay(P.width, P.height, P.overlay_format, screen);
-    if (!my_overlay) {
-        fprintf(stderr, "Couldn't create overlay\n");
+    if (P.scaler != SCALE_SDL) {
+        if (!create_overlays(P.zoom_width, P.zoom_height)) {
+            return 0;
+        }
+    } else if (!create_overlays(P.width, P.height)) {
         return 0;
     }
+
+    video_rect.x = 0;
+    video_rect.y = 0;
+    video_rect.w = P.zoom_width;
+    video_rect.h = P.zoom_height;
     return 1;
 }
 
@@ -1171,14 +9865,47 @@ int main(int argc, char** argv)
 
     /* Initialize param struct to zero */
     memset(&P, 0, sizeof(P));
+    P.start = now();
 
     if (!parse_input(argc, argv)) {
         return EXIT_FAILURE;
     }
 
+    if (P.batch) {
+        if (!pool_start(P.threads ? P.threads : sysconf(_SC_NPROCESSORS_ONLN))) {
+            return EXIT_FAILURE;
+        }
+        ret = run_batch() ? EXIT_SUCCESS : EXIT_FAILURE;
+        pool_stop();
+        return ret;
+    }
+
     /* Initialize parameters corresponding to YUV-format */
     setup_param();
 
+    if (!build_index(0, P.filename) || (P.diff && !build_index(1, P.fname_diff))) {
+        return EXIT_FAILURE;
+    }
+
+    if (!P.threads) {
+        P.threads = sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    if (!pool_start(P.threads)) {
+        return EXIT_FAILURE;
+    }
+
+    /* headless commands, no window needed */
+    if (P.extract || P.export || P.output || P.stats_file || P.artifacts_file || P.pack ||
+        P.variance_file) {
+        ret = run_headless() ? EXIT_SUCCESS : EXIT_FAILURE;
+        pool_stop();
+        free(P.mb_list);
+        free(P.stats);
+        free(P.index[0].offset);
+        free(P.index[1].offset);
+        return ret;
+    }
+
     if (!sdl_init()) {
         return EXIT_FAILURE;
     }
@@ -1187,6 +9914,13 @@ int main(int argc, char** argv)
         return EXIT_FAILURE;
     }
 
+    if (P.control_path && !control_open()) {
+        return EXIT_FAILURE;
+    }
+    if (SES.on && !session_open()) {
+        return EXIT_FAILURE;
+    }
+
     if (!allocate_memory()) {
         ret = EXIT_FAILURE;
         goto cleanup;
@@ -1195,6 +9929,12 @@ int main(int argc, char** argv)
     /* Lets do some basic consistency check on input */
     check_input();
 
+    /* whole clip in memory if it fits, else wait for an A-B loop */
+    if (P.preload_mb && P.num_frames && !preload(0, P.num_frames - 1)) {
+        fprintf(stderr, "Set A-B markers with [ and ], l preloads the loop\n");
+    }
+    prefetch_clip(1);
+
     /* send event to display first frame */
     event.type = SDL_KEYDOWN;
     event.key.keysym.sym = SDLK_RIGHT;
@@ -1204,12 +9944,42 @@ int main(int argc, char** argv)
     event_loop();
 
 cleanup:
+    pool_stop();
+    preload_free();
+    control_close();
+    session_close();
+    if (PAK.packed) {
+        pack_close();
+    }
+    aio_close();
     destroy_message_queue();
-    SDL_FreeYUVOverlay(my_overlay);
-    free(P.raw);
-    free(P.y_data);
-    free(P.cb_data);
-    free(P.cr_data);
+    for (Uint32 i = 0; i < 2; i++) {
+        if (R.overlay[i]) {
+            free_overlay(R.overlay[i]);
+        }
+    }
+    free_frame_buffers();
+    free(P.stats);
+    free(P.index[0].offset);
+    free(P.index[1].offset);
+    free(SC.dst_planes);
+    free(SC.scratch);
+    for (Uint32 p = 0; p < 3; p++) {
+        free(SC.plane[p].xs);
+        free(SC.plane[p].fx);
+    }
+    if (LIST.thread) {
+        __atomic_store_n(&LIST.stop, 1, __ATOMIC_RELEASE);
+        SDL_WaitThread(LIST.thread, NULL);
+        if (LIST.fd >= 0) {
+            close(LIST.fd);
+        }
+        free(LIST.index.offset);
+    }
+    for (Uint32 i = 0; i < LIST.count; i++) {
+        free(LIST.clips[i].name);
+    }
+    free(LIST.clips);
     if (fd) {
         fclose(fd);
     }